@@ -6,10 +6,15 @@
 #include <sstream>
 #include <limits>
 #include <vector>
+#include <memory>
+#include <string>
 #include <ctime>
 #include <unistd.h>
 
 #include "zip_tree.hpp"
+#include "persistent_zip_tree.hpp"
+
+using namespace no_parent_pointer;
 
 
 std::uint64_t random_int(std::uint64_t p, std::uint64_t r) {
@@ -207,4 +212,390 @@ int main() {
 
     fprintf(stderr, "\n");
   }
+
+  // Check the tree with the plain heap allocator, and
+  // check that a cleared tree (whose pooled memory was
+  // released at once) can be used again.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type, heap_allocator> heap_tree_type;
+    typedef zip_tree<key_type, value_type, pool_allocator> pool_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      heap_tree_type *heap_tree = new heap_tree_type();
+      pool_tree_type *pool_tree = new pool_tree_type();
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < 200; ++j) {
+        if (j == 100) {
+          pool_tree->clear();
+          s.clear();
+          for (std::uint64_t key = 0; key <= 10; ++key)
+            heap_tree->erase(key);
+        }
+        std::uint64_t op = random_int(0, 1);
+        std::uint64_t key = random_int(0, 10);
+        if (op == 0) {
+          std::string value = random_string();
+          bool res1 = heap_tree->insert(key, value);
+          bool res2 = pool_tree->insert(key, value);
+          bool res = s.insert(std::make_pair(key, value)).second;
+          if (res1 != res || res2 != res) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else {
+          bool res1 = heap_tree->erase(key);
+          bool res2 = pool_tree->erase(key);
+          bool res = (s.erase(key) > 0);
+          if (res1 != res || res2 != res) {
+            fprintf(stderr, "\nError: wrong erase result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        for (std::uint64_t key2 = 0; key2 <= 10; ++key2) {
+          std::pair<bool, value_type> p1 = heap_tree->search(key2);
+          std::pair<bool, value_type> p2 = pool_tree->search(key2);
+          std::map<key_type, value_type>::iterator it = s.find(key2);
+          bool found = (it != s.end());
+          if (p1.first != found || p2.first != found ||
+              (found && (p1.second != it->second ||
+                         p2.second != it->second))) {
+            fprintf(stderr, "\nError: search failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        heap_tree->check_correctness();
+        pool_tree->check_correctness();
+      }
+
+      delete heap_tree;
+      delete pool_tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check the tree with ranks derived from hashes of keys.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type,
+            pool_allocator, hashed_ranks> zip_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type(i);
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::uint64_t op = random_int(0, 2);
+        std::uint64_t key = random_int(0, 10);
+        if (op == 0) {
+          std::string value = random_string();
+          bool res = tree->insert(key, value);
+          if (res != s.insert(std::make_pair(key, value)).second) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op == 1) {
+          bool res = tree->erase(key);
+          if (res != (s.erase(key) > 0)) {
+            fprintf(stderr, "\nError: wrong erase result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else {
+          std::pair<bool, value_type> p = tree->search(key);
+          std::map<key_type, value_type>::iterator it = s.find(key);
+          if (p.first != (it != s.end()) ||
+              (p.first && p.second != it->second)) {
+            fprintf(stderr, "\nError: search failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+
+        tree->check_correctness();
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check range queries against std::map.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+    typedef std::map<key_type, value_type>::iterator map_iterator;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type();
+      std::map<key_type, value_type> s;
+      std::uint64_t n_items = random_int(0, 30);
+      for (std::uint64_t j = 0; j < n_items; ++j) {
+        std::uint64_t key = random_int(0, 40);
+        std::string value = random_string();
+        tree->insert(key, value);
+        s.insert(std::make_pair(key, value));
+      }
+
+      for (std::uint64_t j = 0; j < 20; ++j) {
+        std::uint64_t lo = random_int(0, 41);
+        std::uint64_t hi = random_int(0, 41);
+
+        // Bounds.
+        zip_tree_type::iterator it = tree->lower_bound(lo);
+        map_iterator it2 = s.lower_bound(lo);
+        if ((it == tree->end()) != (it2 == s.end()) ||
+            (it2 != s.end() && it.key() != it2->first)) {
+          fprintf(stderr, "\nError: lower_bound failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+        it = tree->upper_bound(lo);
+        it2 = s.upper_bound(lo);
+        if ((it == tree->end()) != (it2 == s.end()) ||
+            (it2 != s.end() && it.key() != it2->first)) {
+          fprintf(stderr, "\nError: upper_bound failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+        std::pair<zip_tree_type::iterator, zip_tree_type::iterator> r =
+          tree->equal_range(lo);
+        std::pair<map_iterator, map_iterator> r2 = s.equal_range(lo);
+        if (std::distance(r2.first, r2.second) == 1) {
+          if (r.first == tree->end() || r.first.key() != lo ||
+              ++r.first != r.second) {
+            fprintf(stderr, "\nError: equal_range failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (r.first != r.second) {
+          fprintf(stderr, "\nError: equal_range failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+
+        // Scan of [lo, hi) with iterators and with the visitor.
+        std::vector<std::pair<key_type, value_type> > v, v1, v2;
+        for (it2 = s.lower_bound(lo); it2 != s.end() && it2->first < hi; ++it2)
+          v.push_back(*it2);
+        for (it = tree->lower_bound(lo); it != tree->end() && it.key() < hi; ++it)
+          v1.push_back(std::make_pair(it.key(), it.value()));
+        tree->for_each_in_range(lo, hi,
+            [&v2](const key_type &key, value_type &value) {
+              v2.push_back(std::make_pair(key, value));
+            });
+        if (v1 != v || v2 != v || tree->count_in_range(lo, hi) != v.size()) {
+          fprintf(stderr, "\nError: range scan failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check persistent_zip_tree against std::map. Snapshots are taken
+  // at random moments and must not change when the tree (or another
+  // snapshot) is modified afterwards.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef persistent_zip_tree<key_type, value_type> zip_tree_type;
+    typedef std::map<key_type, value_type> map_type;
+    typedef std::vector<std::pair<key_type, value_type> > vector_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      std::vector<std::pair<zip_tree_type, map_type> > versions(1);
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::uint64_t op = random_int(0, 3);
+        std::uint64_t v = random_int(0, versions.size() - 1);
+        zip_tree_type &tree = versions[v].first;
+        map_type &s = versions[v].second;
+        std::uint64_t key = random_int(0, 20);
+        if (op == 0) {
+          std::string value = random_string();
+          bool res = tree.insert(key, value);
+          if (res != s.insert(std::make_pair(key, value)).second) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op == 1) {
+          bool res = tree.erase(key);
+          if (res != (s.erase(key) > 0)) {
+            fprintf(stderr, "\nError: wrong deletion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op == 2) {
+          if (versions.size() < 5)
+            versions.push_back(std::make_pair(tree.snapshot(), s));
+          else versions.erase(versions.begin() + v);
+        } else {
+          std::pair<bool, value_type> res = tree.search(key);
+          map_type::iterator it = s.find(key);
+          if (res.first != (it != s.end()) ||
+              (res.first && res.second != it->second)) {
+            fprintf(stderr, "\nError: wrong search result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        if (versions.empty())
+          versions.resize(1);
+      }
+
+      // Compare all versions with their maps.
+      for (std::uint64_t v = 0; v < versions.size(); ++v) {
+        versions[v].first.check_correctness();
+        vector_type items;
+        versions[v].first.for_each(
+            [&items](const key_type &key, const value_type &value) {
+              items.push_back(std::make_pair(key, value));
+            });
+        if (items != vector_type(versions[v].second.begin(),
+              versions[v].second.end())) {
+          fprintf(stderr, "\nError: snapshot has changed\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check insert() with rvalues, emplace() and try_emplace() with
+  // a move-only value type and compare the result to std::map. An
+  // insertion which does not take place must not move its arguments.
+  {
+    typedef std::string key_type;
+    typedef std::unique_ptr<std::uint64_t> value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      std::map<key_type, std::uint64_t> s;
+      std::uint64_t n_ops = random_int(0, 300);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n_ops; ++j) {
+        key_type key = std::to_string(random_int(0, max_key));
+        std::uint64_t value = random_int(0, 1000000);
+        std::uint64_t op = random_int(0, 3);
+        if (op == 3) {
+          tree.erase(key);
+          s.erase(key);
+          continue;
+        }
+        bool expected = (s.find(key) == s.end());
+        bool res = false, moved = false;
+        value_type ptr(new std::uint64_t(value));
+        if (op == 0) {
+          key_type k = key;
+          res = tree.insert(std::move(k), std::move(ptr));
+          moved = (k != key || !ptr);
+        } else if (op == 1) {
+          res = tree.try_emplace(key, std::move(ptr));
+          moved = !ptr;
+        } else res = tree.emplace(key, new std::uint64_t(value));
+        if (res != expected || (!res && moved)) {
+          fprintf(stderr, "\nError: wrong insertion result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        if (res) s[key] = value;
+      }
+      tree.check_correctness();
+
+      std::vector<std::pair<key_type, std::uint64_t> > v;
+      for (zip_tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), *(it.value())));
+      if (v != std::vector<std::pair<key_type, std::uint64_t> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check find(), lookup() and contains() against std::map.
+  // Values are modified through the returned pointers.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::uint64_t value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      std::map<key_type, value_type> s;
+      std::uint64_t n = random_int(0, 200);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n; ++j) {
+        key_type key = random_int(0, max_key);
+        value_type value = random_int(0, 1000000);
+        tree.insert(key, value);
+        s.insert(std::make_pair(key, value));
+        if (random_int(0, 3) == 0) {
+          key = random_int(0, max_key);
+          tree.erase(key);
+          s.erase(key);
+        }
+      }
+
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        key_type key = random_int(0, max_key + 1);
+        std::map<key_type, value_type>::iterator it = s.find(key);
+        bool found = (it != s.end());
+        zip_tree_type::iterator f = tree.find(key);
+        value_type *v = tree.lookup(key);
+        const zip_tree_type &const_tree = tree;
+        if (tree.contains(key) != found || (f != tree.end()) != found ||
+            (v != 0) != found || const_tree.lookup(key) != v ||
+            (found && (f.key() != key || &(f.value()) != v ||
+                       *v != it->second))) {
+          fprintf(stderr, "\nError: wrong lookup result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        if (found) {
+          ++(*v);
+          ++(it->second);
+
+          // The iterator returned by find() continues in order.
+          ++f;
+          ++it;
+          if ((f == tree.end()) != (it == s.end()) ||
+              (it != s.end() && f.key() != it->first)) {
+            fprintf(stderr, "\nError: wrong iterator after find\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+      }
+
+      std::vector<std::pair<key_type, value_type> > v;
+      for (zip_tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
 }
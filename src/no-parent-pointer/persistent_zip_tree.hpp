@@ -0,0 +1,425 @@
+/**
+ * @file    persistent_zip_tree.hpp
+ * @section LICENCE
+ *
+ * Implementation of the persistent (copy-on-write) Zip Tree without
+ * parent pointer, v0.1.0
+ * See: https://github.com/dominikkempa/zip-tree
+ *
+ * Copyright (C) 2018-2020
+ *   Dominik Kempa <dominik.kempa (at) gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef __PERSISTENT_ZIP_TREE_HPP_INCLUDED
+#define __PERSISTENT_ZIP_TREE_HPP_INCLUDED
+
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <atomic>
+
+#include "zip_tree.hpp"
+
+
+namespace no_parent_pointer {
+
+//=============================================================================
+// Node of a persistent Zip Tree. A node can be shared by many versions
+// of the tree; `m_refs' counts the pointers to it (from parents in all
+// versions and from the roots of versions).
+//=============================================================================
+template<typename key_type, typename value_type>
+class persistent_node {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef persistent_node<key_type, value_type> node_type;
+
+  public:
+
+    //=========================================================================
+    // Key, value, children, reference count, and rank.
+    //=========================================================================
+    key_type m_key;
+    value_type m_value;
+    node_type *m_left;
+    node_type *m_right;
+    std::atomic<std::uint32_t> m_refs;
+    std::uint8_t m_rank;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    persistent_node(
+        const key_type &key,
+        const value_type &value,
+        const std::uint8_t rank,
+        node_type *left,
+        node_type *right)
+      : m_key(key),
+        m_value(value),
+        m_left(left),
+        m_right(right),
+        m_refs(1),
+        m_rank(rank) {}
+};
+
+//=============================================================================
+// Persistent Zip Tree using path copying. Copying the tree (or calling
+// snapshot()) takes O(1) time: both versions share all nodes. A node is
+// modified in place only if it is not shared, i.e., if it and all its
+// ancestors have a single reference. Otherwise insert() and erase()
+// copy the nodes whose children change: the nodes on the search path
+// down to the new/deleted node, and the nodes on the unzip path (or on
+// the two zip paths) below it, i.e., O(log n) nodes in expectation. The
+// nodes are reference-counted and deleted with the last version using
+// them. Different versions may be used (and destroyed) by different
+// threads at the same time; a single version must not be modified
+// concurrently with any other use of it.
+//=============================================================================
+template<
+  typename key_type,
+  typename value_type,
+  typename rank_policy = random_ranks>
+class persistent_zip_tree {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef persistent_node<key_type, value_type> node_type;
+
+    //=========================================================================
+    // Pointer to the root of the tree and the number of nodes.
+    //=========================================================================
+    node_type *m_root;
+    std::uint64_t m_size;
+
+    //=========================================================================
+    // Source of ranks.
+    //=========================================================================
+    rank_policy m_ranks;
+
+  public:
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    persistent_zip_tree() {
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Constructor with an explicit seed for the rank policy.
+    //=========================================================================
+    explicit persistent_zip_tree(std::uint64_t seed)
+      : m_ranks(seed) {
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Copy constructor and assignment. Take O(1) time, the
+    // nodes are shared by both versions.
+    //=========================================================================
+    persistent_zip_tree(const persistent_zip_tree &other)
+      : m_ranks(other.m_ranks) {
+      m_root = acquire(other.m_root);
+      m_size = other.m_size;
+    }
+
+    persistent_zip_tree& operator=(const persistent_zip_tree &other) {
+      node_type *old_root = m_root;
+      m_root = acquire(other.m_root);
+      m_size = other.m_size;
+      m_ranks = other.m_ranks;
+      release(old_root);
+      return *this;
+    }
+
+    //=========================================================================
+    // Destructor.
+    //=========================================================================
+    ~persistent_zip_tree() {
+      release(m_root);
+    }
+
+    //=========================================================================
+    // Return a snapshot of the tree, i.e., its copy, in O(1) time.
+    //=========================================================================
+    persistent_zip_tree snapshot() const {
+      return *this;
+    }
+
+    //=========================================================================
+    // Remove all items from this version of the tree.
+    //=========================================================================
+    void clear() {
+      release(m_root);
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Return the number of items in the tree.
+    //=========================================================================
+    inline std::uint64_t size() const {
+      return m_size;
+    }
+
+    //=========================================================================
+    // Insert a node with a given (key, value) pair into the tree.
+    // Return true if the insertion took place and false otherwise (the
+    // key was already in the tree). The key is looked up first, so that
+    // no nodes are copied in vain.
+    //=========================================================================
+    bool insert(const key_type &key, const value_type &value) {
+      if (find(key)) return false;
+      std::uint8_t rank = m_ranks.new_rank(key);
+      node_type **edge = &m_root;
+      while (*edge && ((*edge)->m_rank > rank ||
+            ((*edge)->m_rank == rank && (*edge)->m_key < key))) {
+        node_type *x = unshare(*edge);
+        *edge = x;
+        edge = (key < x->m_key ? &(x->m_left) : &(x->m_right));
+      }
+      node_type *newnode = new node_type(key, value, rank, 0, 0);
+      node_type *cur = *edge;
+      *edge = newnode;
+      unzip(cur, key, newnode);
+      ++m_size;
+      return true;
+    }
+
+    //=========================================================================
+    // Delete the node with a given key from the tree.
+    // Return true if the deletion took place.
+    //=========================================================================
+    bool erase(const key_type &key) {
+      if (!find(key)) return false;
+      node_type **edge = &m_root;
+      while (true) {
+        node_type *x = unshare(*edge);
+        *edge = x;
+        if (key < x->m_key) edge = &(x->m_left);
+        else if (x->m_key < key) edge = &(x->m_right);
+        else break;
+      }
+      node_type *x = *edge;
+      *edge = zip(x->m_left, x->m_right);
+      x->m_left = 0;
+      x->m_right = 0;
+      release(x);
+      --m_size;
+      return true;
+    }
+
+    //=========================================================================
+    // Search for a given key in the tree.
+    // Return a pair containing the key and its value.
+    //=========================================================================
+    std::pair<bool, value_type> search(const key_type &key) const {
+      const node_type *x = find(key);
+      if (!x) return std::make_pair(false, value_type());
+      else return std::make_pair(true, x->m_value);
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item, in the increasing order of keys.
+    //=========================================================================
+    template<typename function_type>
+    void for_each(function_type fn) const {
+      for_each(m_root, fn);
+    }
+
+    //=========================================================================
+    // Check if a tree is a correct zip-tree, i.e., if the order of keys
+    // is correct, and whether rank[left[v]] < rank[v] and
+    // rank[right[v]] <= rank[v] conditions hold for every node. Also
+    // check that every node is referenced and that the size is correct.
+    //=========================================================================
+    void check_correctness() const {
+      std::uint64_t count = 0;
+      const node_type *prev = 0;
+      check(m_root, prev, count);
+      if (count != m_size) {
+        std::cerr << "\nError: check_size failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+    }
+
+  private:
+
+    //=========================================================================
+    // Add a reference to the node `x' (if any) and return it.
+    //=========================================================================
+    static node_type* acquire(node_type *x) {
+      if (x) x->m_refs.fetch_add(1, std::memory_order_relaxed);
+      return x;
+    }
+
+    //=========================================================================
+    // Drop a reference to the node `x' (if any). Nodes without
+    // references are deleted, which drops references to their
+    // children. An explicit stack is used instead of recursion.
+    //=========================================================================
+    static void release(node_type *x) {
+      std::vector<node_type*> stack;
+      while (true) {
+        if (x && x->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          if (x->m_right) stack.push_back(x->m_right);
+          node_type *left = x->m_left;
+          delete x;
+          x = left;
+        } else if (stack.empty()) break;
+        else {
+          x = stack.back();
+          stack.pop_back();
+        }
+      }
+    }
+
+    //=========================================================================
+    // Return a node which the caller can modify in place of `x'. This is
+    // `x' itself if the caller holds the only reference to it, otherwise
+    // a copy of `x' (which takes over the caller's reference).
+    //=========================================================================
+    static node_type* unshare(node_type *x) {
+      if (x->m_refs.load(std::memory_order_acquire) == 1) return x;
+      node_type *copy = new node_type(x->m_key, x->m_value, x->m_rank,
+          acquire(x->m_left), acquire(x->m_right));
+      release(x);
+      return copy;
+    }
+
+    //=========================================================================
+    // Zip-in two subtrees and return the root of the resulting tree,
+    // as in zip_tree::zip(). The nodes on the two spines are unshared
+    // before their children change.
+    //=========================================================================
+    static node_type* zip(node_type *x, node_type *y) {
+      node_type *root = 0, **hook = &root;
+      while (x && y) {
+        if (x->m_rank >= y->m_rank) {
+          x = unshare(x);
+          *hook = x;
+          hook = &(x->m_right);
+          x = x->m_right;
+        } else {
+          y = unshare(y);
+          *hook = y;
+          hook = &(y->m_left);
+          y = y->m_left;
+        }
+      }
+      *hook = (x ? x : y);
+      return root;
+    }
+
+    //=========================================================================
+    // Split the subtree rooted in `x' into two subtrees with keys smaller
+    // and larger than the given `key' and hang them as the left and right
+    // subtree of `z', as in zip_tree::unzip(). The nodes on the search
+    // path are unshared before their children change.
+    //=========================================================================
+    static void unzip(node_type *x, const key_type &key, node_type *z) {
+      node_type **lhook = &(z->m_left), **rhook = &(z->m_right);
+      while (x) {
+        x = unshare(x);
+        if (x->m_key < key) {
+          *lhook = x;
+          lhook = &(x->m_right);
+          x = x->m_right;
+        } else {
+          *rhook = x;
+          rhook = &(x->m_left);
+          x = x->m_left;
+        }
+      }
+      *lhook = 0;
+      *rhook = 0;
+    }
+
+    //=========================================================================
+    // Search for a node with a given `key'.
+    //=========================================================================
+    const node_type* find(const key_type &key) const {
+      const node_type *x = m_root;
+      while (x) {
+        if (key < x->m_key) x = x->m_left;
+        else if (x->m_key < key) x = x->m_right;
+        else return x;
+      }
+      return 0;
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item in the subtree rooted in `x'.
+    //=========================================================================
+    template<typename function_type>
+    static void for_each(const node_type *x, function_type &fn) {
+      while (x) {
+        for_each(x->m_left, fn);
+        fn(x->m_key, x->m_value);
+        x = x->m_right;
+      }
+    }
+
+    //=========================================================================
+    // Check the order of keys, the ranks, and the reference counts in
+    // the subtree rooted in `x', count its nodes. `prev' is the previous
+    // node in inorder.
+    //=========================================================================
+    static void check(
+        const node_type *x,
+        const node_type *&prev,
+        std::uint64_t &count) {
+      if (!x) return;
+      if ((x->m_left && x->m_left->m_rank >= x->m_rank) ||
+          (x->m_right && x->m_right->m_rank > x->m_rank)) {
+        std::cerr << "\nError: check_ranks failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+      if (x->m_refs.load() == 0) {
+        std::cerr << "\nError: check_refs failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+      check(x->m_left, prev, count);
+      if (prev && !(prev->m_key < x->m_key)) {
+        std::cerr << "\nError: check_keys failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+      prev = x;
+      ++count;
+      check(x->m_right, prev, count);
+    }
+};
+
+}  // namespace no_parent_pointer
+
+#endif  // __PERSISTENT_ZIP_TREE_HPP_INCLUDED
@@ -30,34 +30,367 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  **/
 
-#ifndef __ZIP_TREE_HPP_INCLUDED
-#define __ZIP_TREE_HPP_INCLUDED
+#ifndef __NO_PARENT_POINTER_ZIP_TREE_HPP_INCLUDED
+#define __NO_PARENT_POINTER_ZIP_TREE_HPP_INCLUDED
 
 #include <cstdlib>
 #include <cstdint>
 #include <iostream>
+#include <new>
+#include <vector>
+#include <type_traits>
+#include <atomic>
+#include <random>
+#include <functional>
+#include <utility>
 
 
+// The variant with parent pointers (see ../with-parent-pointer) defines
+// the same names, so this one is in its own namespace, and both can be
+// used in one program (as in the speed tests).
+namespace no_parent_pointer {
+
+//=============================================================================
+// Node allocator taking every node from the general-purpose heap. The
+// memory of each node has to be returned individually.
+//=============================================================================
+template<typename T>
+class heap_allocator {
+  private:
+
+    //=========================================================================
+    // Number of objects currently allocated.
+    //=========================================================================
+    std::uint64_t m_n_objects;
+
+  public:
+
+    //=========================================================================
+    // The allocator cannot release all nodes at once.
+    //=========================================================================
+    static const bool k_bulk_release = false;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    heap_allocator() {
+      m_n_objects = 0;
+    }
+
+    //=========================================================================
+    // Return uninitialized memory for a single object of type T.
+    //=========================================================================
+    inline T* allocate() {
+      ++m_n_objects;
+      return static_cast<T*>(::operator new(sizeof(T)));
+    }
+
+    //=========================================================================
+    // Return the memory of the object at `x' to the heap.
+    //=========================================================================
+    inline void deallocate(T *x) {
+      --m_n_objects;
+      ::operator delete(x);
+    }
+
+    //=========================================================================
+    // Nothing to do, all nodes were already deallocated.
+    //=========================================================================
+    void release() {}
+
+    //=========================================================================
+    // Return the number of bytes taken by the allocated objects. The
+    // bookkeeping of the heap itself is not known and not included.
+    //=========================================================================
+    std::uint64_t memory_usage() const {
+      return m_n_objects * sizeof(T);
+    }
+};
+
+//=============================================================================
+// Node allocator carving the nodes out of large chunks of memory.
+// Deallocated nodes are kept on a free list and recycled by subsequent
+// allocations. Chunks grow geometrically up to k_max_chunk_slots nodes,
+// so that small trees stay small. All chunks are released at once by
+// release() or in the destructor, without visiting individual nodes.
+//=============================================================================
+template<typename T>
+class pool_allocator {
+  private:
+
+    //=========================================================================
+    // A slot either holds an object or links to the next free slot.
+    //=========================================================================
+    union slot {
+      slot *m_next;
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type m_data;
+    };
+
+    static const std::uint64_t k_min_chunk_slots = 32;
+    static const std::uint64_t k_max_chunk_slots = (1UL << 16);
+
+    //=========================================================================
+    // All allocated chunks, the total number of slots in them, the head
+    // of the free list, and the range of never used slots in the most
+    // recently allocated chunk.
+    //=========================================================================
+    std::vector<slot*> m_chunks;
+    std::uint64_t m_n_slots;
+    slot *m_free;
+    slot *m_cur;
+    slot *m_end;
+    std::uint64_t m_next_chunk_slots;
+
+  public:
+
+    //=========================================================================
+    // The allocator releases all nodes at once.
+    //=========================================================================
+    static const bool k_bulk_release = true;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    pool_allocator() {
+      m_n_slots = 0;
+      m_free = 0;
+      m_cur = 0;
+      m_end = 0;
+      m_next_chunk_slots = k_min_chunk_slots;
+    }
+
+    //=========================================================================
+    // Destructor.
+    //=========================================================================
+    ~pool_allocator() {
+      release();
+    }
+
+    pool_allocator(const pool_allocator&) = delete;
+    pool_allocator& operator=(const pool_allocator&) = delete;
+
+    //=========================================================================
+    // Return uninitialized memory for a single object of type T.
+    //=========================================================================
+    inline T* allocate() {
+      slot *ret;
+      if (m_free) {
+        ret = m_free;
+        m_free = m_free->m_next;
+      } else {
+        if (m_cur == m_end)
+          add_chunk();
+        ret = m_cur++;
+      }
+      return reinterpret_cast<T*>(ret);
+    }
+
+    //=========================================================================
+    // Put the memory of the object at `x' on the free list.
+    //=========================================================================
+    inline void deallocate(T *x) {
+      slot *s = reinterpret_cast<slot*>(x);
+      s->m_next = m_free;
+      m_free = s;
+    }
+
+    //=========================================================================
+    // Release all chunks. Objects still living in them
+    // are not destroyed, this is the caller's responsibility.
+    //=========================================================================
+    void release() {
+      for (std::uint64_t i = 0; i < m_chunks.size(); ++i)
+        ::operator delete(m_chunks[i]);
+      m_chunks.clear();
+      m_n_slots = 0;
+      m_free = 0;
+      m_cur = 0;
+      m_end = 0;
+      m_next_chunk_slots = k_min_chunk_slots;
+    }
+
+    //=========================================================================
+    // Return the number of bytes of all chunks,
+    // including the free and never used slots.
+    //=========================================================================
+    std::uint64_t memory_usage() const {
+      return m_n_slots * sizeof(slot);
+    }
+
+  private:
+
+    //=========================================================================
+    // Allocate a new chunk and make it the source of never used slots.
+    //=========================================================================
+    void add_chunk() {
+      slot *chunk = static_cast<slot*>(
+          ::operator new(m_next_chunk_slots * sizeof(slot)));
+      m_chunks.push_back(chunk);
+      m_n_slots += m_next_chunk_slots;
+      m_cur = chunk;
+      m_end = chunk + m_next_chunk_slots;
+      if (m_next_chunk_slots < k_max_chunk_slots)
+        m_next_chunk_slots <<= 1;
+    }
+};
+
+//=============================================================================
+// Small and fast pseudo-random number generator (SplitMix64). Every
+// tree owns its generator, so that drawing ranks requires no locking
+// and independent trees do not share any state.
+//=============================================================================
+class random_generator {
+  private:
+
+    //=========================================================================
+    // Current state.
+    //=========================================================================
+    std::uint64_t m_state;
+
+  public:
+
+    //=========================================================================
+    // Constructor. If no seed is given, a unique one is taken from a
+    // global sequence, itself randomly seeded when first used.
+    //=========================================================================
+    random_generator() {
+      static std::atomic<std::uint64_t> seeds(
+          ((std::uint64_t)std::random_device()() << 32) ^
+          (std::uint64_t)std::random_device()());
+      m_state = mix(seeds.fetch_add(0x9e3779b97f4a7c15UL));
+    }
+
+    random_generator(std::uint64_t seed) {
+      m_state = seed;
+    }
+
+    //=========================================================================
+    // Return the next 64-bit pseudo-random number.
+    //=========================================================================
+    inline std::uint64_t operator()() {
+      m_state += 0x9e3779b97f4a7c15UL;
+      return mix(m_state);
+    }
+
+    //=========================================================================
+    // Return a rank drawn from the geometric distribution with p = 1/2,
+    // i.e., the number of trailing zeros of a random 64-bit number. The
+    // top bit is set to keep the result defined; ranks are <= 63.
+    //=========================================================================
+    inline std::uint8_t random_rank() {
+      return __builtin_ctzll((*this)() | (1UL << 63));
+    }
+
+    //=========================================================================
+    // Bijective mixing function (finalizer of SplitMix64).
+    //=========================================================================
+    static inline std::uint64_t mix(std::uint64_t x) {
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+      return x ^ (x >> 31);
+    }
+};
+
+//=============================================================================
+// The rank of a node is either stored in the node (rank_field<true>)
+// or recomputed from the key when needed (rank_field<false>).
+//=============================================================================
+template<bool stored>
+class rank_field {
+  public:
+    std::uint8_t m_rank;
+
+    inline void set_rank(const std::uint8_t rank) {
+      m_rank = rank;
+    }
+};
+
+template<>
+class rank_field<false> {
+  public:
+    inline void set_rank(const std::uint8_t) {}
+};
+
 //=============================================================================
-// Node of a Zip Tree.
+// Rank policy drawing the ranks from the random_generator owned by the
+// tree. Ranks are stored in the nodes.
 //=============================================================================
-template<typename key_type, typename value_type>
-class node {
+class random_ranks {
+  private:
+    random_generator m_random;
+
+  public:
+    static const bool k_stored = true;
+
+    random_ranks() {}
+
+    explicit random_ranks(std::uint64_t seed)
+      : m_random(seed) {}
+
+    //=========================================================================
+    // Return the rank for a new node with a given key.
+    //=========================================================================
+    template<typename key_type>
+    inline std::uint8_t new_rank(const key_type &) {
+      return m_random.random_rank();
+    }
+};
+
+//=============================================================================
+// Rank policy deriving the rank from the key, as the number of trailing
+// zeros of the mixed std::hash of the key (and an optional salt). As
+// long as the hash spreads the keys well, the ranks still follow the
+// geometric distribution, but the shape of the tree is a function of
+// the set of keys only: it does not depend on the order of operations
+// and is the same in every process using the same salt. No state is
+// updated on insertion, and ranks are not stored in the nodes, they
+// are recomputed from the keys.
+//=============================================================================
+class hashed_ranks {
+  private:
+    std::uint64_t m_salt;
+
+  public:
+    static const bool k_stored = false;
+
+    hashed_ranks() {
+      m_salt = 0;
+    }
+
+    explicit hashed_ranks(std::uint64_t salt) {
+      m_salt = salt;
+    }
+
+    //=========================================================================
+    // Return the rank of a node with a given key.
+    //=========================================================================
+    template<typename key_type>
+    inline std::uint8_t new_rank(const key_type &key) const {
+      std::uint64_t h = std::hash<key_type>()(key);
+      h = random_generator::mix(h ^ (m_salt + 0x9e3779b97f4a7c15UL));
+      return __builtin_ctzll(h | (1UL << 63));
+    }
+};
+
+//=============================================================================
+// Node of a Zip Tree. The rank is a member only if `store_rank' is true.
+//=============================================================================
+template<typename key_type, typename value_type, bool store_rank = true>
+class node : public rank_field<store_rank> {
   private:
 
     //=========================================================================
     // Define common aliases.
     //=========================================================================
-    typedef node<key_type, value_type> node_type;
+    typedef node<key_type, value_type, store_rank> node_type;
 
   public:
 
     //=========================================================================
-    // Key, value, rank, and pointers to children.
+    // Key, value, and pointers to children.
     //=========================================================================
     key_type m_key;
     value_type m_value;
-    std::uint8_t m_rank;
     node_type *m_left;
     node_type *m_right;
 
@@ -69,33 +402,68 @@ class node {
         const value_type &value,
         const std::uint8_t rank,
         node_type *left,
-        node_type *right) {
-      m_key = key;
-      m_value = value;
-      m_rank = rank;
-      m_left = left;
-      m_right = right;
+        node_type *right)
+      : m_key(key),
+        m_value(value),
+        m_left(left),
+        m_right(right) {
+      this->set_rank(rank);
+    }
+
+    //=========================================================================
+    // Constructor of a leaf, constructing the key from `key' and the
+    // value from `args' in place.
+    //=========================================================================
+    template<typename key_arg_type, typename... value_arg_types>
+    node(
+        std::piecewise_construct_t,
+        const std::uint8_t rank,
+        key_arg_type &&key,
+        value_arg_types&&... args)
+      : m_key(std::forward<key_arg_type>(key)),
+        m_value(std::forward<value_arg_types>(args)...),
+        m_left(0),
+        m_right(0) {
+      this->set_rank(rank);
     }
 };
 
 //=============================================================================
 // Simple implementation of Zip Tree. It works with any key_type as
 // long as objects of key_type can be compared using "<" operator.
+// The memory for nodes is obtained from allocator_template<node_type>,
+// see heap_allocator and pool_allocator above. The ranks of nodes are
+// given by the rank_policy, see random_ranks and hashed_ranks above.
 //=============================================================================
-template<typename key_type, typename value_type>
+template<
+  typename key_type,
+  typename value_type,
+  template<typename> class allocator_template = pool_allocator,
+  typename rank_policy = random_ranks>
 class zip_tree {
   private:
 
     //=========================================================================
     // Define common aliases.
     //=========================================================================
-    typedef node<key_type, value_type> node_type;
+    typedef node<key_type, value_type, rank_policy::k_stored> node_type;
+    typedef allocator_template<node_type> allocator_type;
 
     //=========================================================================
     // Pointer to the root of the tree.
     //=========================================================================
     node_type *m_root;
 
+    //=========================================================================
+    // Allocator of nodes.
+    //=========================================================================
+    allocator_type m_allocator;
+
+    //=========================================================================
+    // Source of ranks.
+    //=========================================================================
+    rank_policy m_ranks;
+
   public:
 
     //=========================================================================
@@ -105,40 +473,99 @@ class zip_tree {
       m_root = 0;
     }
 
+    //=========================================================================
+    // Constructor with an explicit seed for the rank policy. Two trees
+    // with the same seed and the same sequence of insertions have the
+    // same shape. For hashed_ranks the seed is the salt of the hash.
+    //=========================================================================
+    explicit zip_tree(std::uint64_t seed)
+      : m_ranks(seed) {
+      m_root = 0;
+    }
+
     //=========================================================================
     // Destructor.
     //=========================================================================
     ~zip_tree() {
-      delete_subtree(m_root);
+      clear();
+    }
+
+    //=========================================================================
+    // Remove all nodes from the tree. If the allocator supports it, the
+    // memory is released in whole chunks and the nodes are only visited
+    // if their destructors have to be run.
+    //=========================================================================
+    void clear() {
+      if (allocator_type::k_bulk_release) {
+        if (!std::is_trivially_destructible<node_type>::value)
+          delete_subtree(m_root, false);
+        m_allocator.release();
+      } else delete_subtree(m_root, true);
+      m_root = 0;
+    }
+
+    //=========================================================================
+    // Return the number of bytes reserved for the nodes, see
+    // pool_allocator::memory_usage() and heap_allocator::memory_usage().
+    //=========================================================================
+    std::uint64_t memory_usage() const {
+      return m_allocator.memory_usage();
     }
 
     //=========================================================================
     // Insert a node with a given (key, value) pair into the tree.
     // Return true if the insertion took place and false otherwise (the
     // key was already in the tree). This is an optimized variant of the
-    // insertion which does only a single downward pass in the tree.
+    // insertion which does not use recursion: after locating the place
+    // for the new node, the rest of the search path is traversed once to
+    // check for duplicates and once more to unzip it. The key and the
+    // value are copied into the node, or moved if given as rvalues.
     //=========================================================================
     bool insert(const key_type &key, const value_type &value) {
-      std::uint8_t rank = random_rank();
-      node_type *cur = m_root, **edgeptr = 0;
-      while (cur && cur->m_rank > rank) {
-        if (key < cur->m_key) {
-          edgeptr = &(cur->m_left);
-          cur = cur->m_left;
-        } else if (cur->m_key < key) {
-          edgeptr = &(cur->m_right);
-          cur = cur->m_right;
-        } else return false;
-      }
-      while (cur && cur->m_rank == rank && cur->m_key < key) {
-        edgeptr = &(cur->m_right);
-        cur = cur->m_right;
+      return insert_unique(key, key, value);
+    }
+
+    bool insert(key_type &&key, value_type &&value) {
+      return insert_unique(key, std::move(key), std::move(value));
+    }
+
+    //=========================================================================
+    // Insert an item with a given key and the value constructed in place
+    // from `args', as std::map::try_emplace(). If the key is already in
+    // the tree, return false without constructing the value (and without
+    // moving from `key' and `args').
+    //=========================================================================
+    template<typename... arg_types>
+    bool try_emplace(const key_type &key, arg_types&&... args) {
+      return insert_unique(key, key, std::forward<arg_types>(args)...);
+    }
+
+    template<typename... arg_types>
+    bool try_emplace(key_type &&key, arg_types&&... args) {
+      return insert_unique(key, std::move(key),
+          std::forward<arg_types>(args)...);
+    }
+
+    //=========================================================================
+    // Construct an item in place, the key from `key' and the value from
+    // `args', and insert it unless its key is already in the tree (in
+    // which case it is destroyed again and false is returned). Unlike in
+    // try_emplace(), the key need not be constructed beforehand.
+    //=========================================================================
+    template<typename key_arg_type, typename... value_arg_types>
+    bool emplace(key_arg_type &&key, value_arg_types&&... args) {
+      node_type *newnode = new (m_allocator.allocate())
+        node_type(std::piecewise_construct, 0,
+            std::forward<key_arg_type>(key),
+            std::forward<value_arg_types>(args)...);
+      std::uint8_t rank = m_ranks.new_rank(newnode->m_key);
+      insert_place place;
+      if (!find_insert_place(newnode->m_key, rank, place)) {
+        delete_node(newnode);
+        return false;
       }
-      std::pair<node_type*, node_type*> p = unzip(cur, key);
-      if (cur && !p.first && !p.second) return false;
-      node_type *newnode = new node_type(key, value, rank, p.first, p.second);
-      if (!edgeptr) m_root = newnode;
-      else *edgeptr = newnode;
+      newnode->set_rank(rank);
+      link_new_node(newnode, place);
       return true;
     }
 
@@ -147,12 +574,13 @@ class zip_tree {
     // Return true if the deletion took place.
     //=========================================================================
     bool erase(const key_type &key) {
-      std::pair<node_type*, node_type**> p = find(key);
+      std::pair<node_type*, node_type**> p = find_node(key);
       if (!p.first) return false;
       else {
-        if (!p.second) m_root = zip(p.first->m_left, p.first->m_right);
-        else *(p.second) = zip(p.first->m_left, p.first->m_right);
-        delete p.first;
+        node_type *newroot = zip(p.first->m_left, p.first->m_right);
+        if (!p.second) m_root = newroot;
+        else *(p.second) = newroot;
+        delete_node(p.first);
         return true;
       }
     }
@@ -169,11 +597,33 @@ class zip_tree {
     // Return a pair containing the key and its value.
     //=========================================================================
     std::pair<bool, value_type> search(const key_type &key) const {
-      std::pair<node_type*, node_type**> p = find(key);
+      std::pair<node_type*, node_type**> p = find_node(key);
       if (!p.first) return std::make_pair(false, value_type());
       else return std::make_pair(true, p.first->m_value);
     }
 
+    //=========================================================================
+    // Return a pointer to the value associated with `key', or nullptr if
+    // the key is not in the tree. Unlike search(), this copies nothing.
+    // The pointer is valid until the item is erased.
+    //=========================================================================
+    value_type* lookup(const key_type &key) {
+      node_type *x = find_node(key).first;
+      return x ? &(x->m_value) : nullptr;
+    }
+
+    const value_type* lookup(const key_type &key) const {
+      const node_type *x = find_node(key).first;
+      return x ? &(x->m_value) : nullptr;
+    }
+
+    //=========================================================================
+    // Return true if `key' is in the tree.
+    //=========================================================================
+    bool contains(const key_type &key) const {
+      return find_node(key).first != nullptr;
+    }
+
     //=========================================================================
     // Check if a tree is a correct zip-tree, i.e., if the order of keys
     // is correct, and whether rank[left[v]] < rank[v] and
@@ -186,80 +636,318 @@ class zip_tree {
       }
     }
 
-  private:
+  public:
 
     //=========================================================================
-    // Zip-in two subtrees and return the root of the resulting tree.
-    // We assume that any key in `x' is smaller than any key in `y'.
+    // Simple forward iterator. Without parent pointers, the iterator
+    // keeps the stack of the ancestors of the current node (on top)
+    // whose left subtree contains the current node, i.e., of the nodes
+    // still to be visited after it.
     //=========================================================================
-    node_type* zip(node_type *x, node_type *y) {
-      if (!x) return y;
-      if (!y) return x;
-      if (x->m_rank >= y->m_rank) {
-        node_type *xright = x->m_right;
-        if (xright && xright->m_rank >= y->m_rank)
-          x->m_right = zip(xright, y);
+    class iterator {
+      private:
+        std::vector<node_type*> m_stack;
+
+      public:
+        iterator() {}
+
+        const key_type& key() const {
+          return m_stack.back()->m_key;
+        }
+
+        value_type& value() {
+          return m_stack.back()->m_value;
+        }
+
+        inline iterator& operator++() {
+          if (m_stack.empty()) {
+            std::cerr << "\nError: ++ on NULL iterator\n";
+            std::exit(EXIT_FAILURE);
+          }
+          node_type *x = m_stack.back()->m_right;
+          m_stack.pop_back();
+          push_left_path(x);
+          return *this;
+        }
+
+        inline iterator operator++(int) {
+          iterator ret = *this;
+          ++(*this);
+          return ret;
+        }
+
+        bool operator == (const iterator &it) const {
+          return current() == it.current();
+        }
+
+        bool operator != (const iterator &it) const {
+          return current() != it.current();
+        }
+
+      private:
+        friend class zip_tree;
+
+        inline node_type* current() const {
+          return m_stack.empty() ? nullptr : m_stack.back();
+        }
+
+        inline void push_left_path(node_type *x) {
+          for (; x; x = x->m_left)
+            m_stack.push_back(x);
+        }
+    };
+
+    iterator begin() {
+      iterator ret;
+      ret.push_left_path(m_root);
+      return ret;
+    }
+
+    iterator end() {
+      return iterator();
+    }
+
+    //=========================================================================
+    // Return the iterator to the item with key `key',
+    // or end() if there is no such item.
+    //=========================================================================
+    iterator find(const key_type &key) {
+      iterator ret;
+      for (node_type *x = m_root; x; ) {
+        if (x->m_key < key) x = x->m_right;
         else {
-          x->m_right = y;
-          y->m_left = zip(xright, y->m_left);
+          ret.m_stack.push_back(x);
+          if (!(key < x->m_key)) return ret;
+          x = x->m_left;
         }
-        return x;
-      } else {
-        node_type *yleft = y->m_left;
-        if (yleft && yleft->m_rank >= x->m_rank)
-          y->m_left = zip(x, yleft);
+      }
+      return iterator();
+    }
+
+    //=========================================================================
+    // Return the iterator to the first item with key >= `key',
+    // or end() if there is no such item.
+    //=========================================================================
+    iterator lower_bound(const key_type &key) {
+      iterator ret;
+      for (node_type *x = m_root; x; ) {
+        if (x->m_key < key) x = x->m_right;
         else {
-          y->m_left = x;
-          x->m_right = zip(x->m_right, yleft);
+          ret.m_stack.push_back(x);
+          x = x->m_left;
         }
-        return y;
       }
+      return ret;
     }
 
     //=========================================================================
-    // Split the subtree rooted in `x' into two subtrees with keys smaller
-    // and larger than the given `key'. If `key' occurs in subtree `x' then
-    // function returns a pair (nullptr, nullptr) and tree remains unchanged.
-    // NOTE: Is a more elegant/shorter implementation of this function possible?
+    // Return the iterator to the first item with key > `key',
+    // or end() if there is no such item.
     //=========================================================================
-    std::pair<node_type*, node_type*> unzip(
+    iterator upper_bound(const key_type &key) {
+      iterator ret;
+      for (node_type *x = m_root; x; ) {
+        if (key < x->m_key) {
+          ret.m_stack.push_back(x);
+          x = x->m_left;
+        } else x = x->m_right;
+      }
+      return ret;
+    }
+
+    //=========================================================================
+    // Return the range of items with a given key, i.e., the pair
+    // (lower_bound(key), upper_bound(key)). Since keys are distinct,
+    // the range contains at most one item.
+    //=========================================================================
+    std::pair<iterator, iterator> equal_range(const key_type &key) {
+      iterator lo = lower_bound(key), hi = lo;
+      if (hi != end() && !(key < hi.key())) ++hi;
+      return std::make_pair(lo, hi);
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item with lo <= key < hi, in the
+    // increasing order of keys. The subtrees outside the range are
+    // skipped and no iterator (and hence no stack) is used.
+    //=========================================================================
+    template<typename function_type>
+    void for_each_in_range(
+        const key_type &lo,
+        const key_type &hi,
+        function_type fn) {
+      for_each_in_range(m_root, lo, hi, fn);
+    }
+
+    //=========================================================================
+    // Return the number of items with lo <= key < hi. Runs
+    // in O(log n + k) expected time, where k is the answer.
+    //=========================================================================
+    std::uint64_t count_in_range(const key_type &lo, const key_type &hi) {
+      std::uint64_t ret = 0;
+      for_each_in_range(lo, hi,
+          [&ret](const key_type &, value_type &) { ++ret; });
+      return ret;
+    }
+
+  private:
+
+    //=========================================================================
+    // Call fn(key, value) for every item with lo <= key < hi in the
+    // subtree rooted in `x'. Recursion is only used for left children.
+    //=========================================================================
+    template<typename function_type>
+    static void for_each_in_range(
         node_type *x,
-        const key_type &key) {
-      if (!x) return std::make_pair(nullptr, nullptr);
-      else if (key < x->m_key) {
-        node_type *xleft = x->m_left;
-        if (xleft && xleft->m_key < key) {
-          std::pair<node_type*, node_type*> p = unzip(xleft->m_right, key);
-          if (xleft->m_right && !p.first && !p.second) return p;
-          xleft->m_right = p.first;
-          x->m_left = p.second;
-          return std::make_pair(xleft, x);
+        const key_type &lo,
+        const key_type &hi,
+        function_type &fn) {
+      while (x) {
+        if (x->m_key < lo) x = x->m_right;
+        else if (!(x->m_key < hi)) x = x->m_left;
+        else {
+          for_each_in_range(x->m_left, lo, hi, fn);
+          fn(x->m_key, x->m_value);
+          x = x->m_right;
+        }
+      }
+    }
+
+
+    //=========================================================================
+    // Zip-in two subtrees and return the root of the resulting tree.
+    // We assume that any key in `x' is smaller than any key in `y'.
+    // The merge is done in a single top-down pass along the right spine
+    // of `x' and the left spine of `y', using `hook' as the address of
+    // the pointer to fill next.
+    //=========================================================================
+    node_type* zip(node_type *x, node_type *y) {
+      node_type *root = 0, **hook = &root;
+      while (x && y) {
+        if (get_rank(x) >= get_rank(y)) {
+          *hook = x;
+          hook = &(x->m_right);
+          x = x->m_right;
         } else {
-          std::pair<node_type*, node_type*> p = unzip(xleft, key);
-          if (xleft && !p.first && !p.second) return p;
-          else return std::make_pair(p.first, x);
+          *hook = y;
+          hook = &(y->m_left);
+          y = y->m_left;
         }
-      } else if (x->m_key < key) {
-        node_type *xright = x->m_right;
-        if (xright && key < xright->m_key) {
-          std::pair<node_type*, node_type*> p = unzip(xright->m_left, key);
-          if (xright->m_left && !p.first && !p.second) return p;
-          xright->m_left = p.second;
-          x->m_right = p.first;
-          return std::make_pair(x, xright);
+      }
+      *hook = (x ? x : y);
+      return root;
+    }
+
+    //=========================================================================
+    // Split the subtree rooted in `x' into two subtrees with keys smaller
+    // and larger than the given `key' and hang them as the left and right
+    // subtree of `z'. We assume that `key' does not occur in subtree `x'.
+    // The split is done in a single top-down pass along the search path
+    // of `key', with `lhook' and `rhook' pointing to the next free slot
+    // on the right spine of the smaller part and on the left spine of the
+    // larger part, respectively.
+    //=========================================================================
+    void unzip(node_type *x, const key_type &key, node_type *z) {
+      node_type **lhook = &(z->m_left), **rhook = &(z->m_right);
+      while (x) {
+        if (x->m_key < key) {
+          *lhook = x;
+          lhook = &(x->m_right);
+          x = x->m_right;
         } else {
-          std::pair<node_type*, node_type*> p = unzip(xright, key);
-          if (xright && !p.first && !p.second) return p;
-          else return std::make_pair(x, p.second);
+          *rhook = x;
+          rhook = &(x->m_left);
+          x = x->m_left;
         }
-      } else return std::make_pair(nullptr, nullptr);
+      }
+      *lhook = 0;
+      *rhook = 0;
+    }
+
+    //=========================================================================
+    // Insert a node with key `key' (constructed from `key_arg') and the
+    // value constructed from `args', unless `key' is in the tree. The
+    // new node is only constructed (and `key_arg' is only moved from,
+    // which may be `key' itself) after the place for it has been found.
+    //=========================================================================
+    template<typename key_arg_type, typename... value_arg_types>
+    bool insert_unique(
+        const key_type &key,
+        key_arg_type &&key_arg,
+        value_arg_types&&... args) {
+      std::uint8_t rank = m_ranks.new_rank(key);
+      insert_place place;
+      if (!find_insert_place(key, rank, place))
+        return false;
+      node_type *newnode = new (m_allocator.allocate())
+        node_type(std::piecewise_construct, rank,
+            std::forward<key_arg_type>(key_arg),
+            std::forward<value_arg_types>(args)...);
+      link_new_node(newnode, place);
+      return true;
+    }
+
+    //=========================================================================
+    // The place of a new node in the tree: the topmost node of its search
+    // path which becomes its descendant (`m_cur', or null) and the pointer
+    // to fill with the new node (null for the root).
+    //=========================================================================
+    struct insert_place {
+      node_type *m_cur;
+      node_type **m_edgeptr;
+    };
+
+    //=========================================================================
+    // Find the place for a new node with a given key and rank. Return
+    // false if the key is already in the tree.
+    //=========================================================================
+    bool find_insert_place(
+        const key_type &key,
+        const std::uint8_t rank,
+        insert_place &place) const {
+      node_type *cur = m_root, **edgeptr = 0;
+      while (cur && get_rank(cur) > rank) {
+        if (key < cur->m_key) {
+          edgeptr = &(cur->m_left);
+          cur = cur->m_left;
+        } else if (cur->m_key < key) {
+          edgeptr = &(cur->m_right);
+          cur = cur->m_right;
+        } else return false;
+      }
+      while (cur && get_rank(cur) == rank && cur->m_key < key) {
+        edgeptr = &(cur->m_right);
+        cur = cur->m_right;
+      }
+
+      // The search path below `cur' is exactly the path that
+      // unzip() is going to follow. Walk it once to make sure the
+      // key is not in the tree, so that unzip() never has to undo.
+      for (node_type *x = cur; x; ) {
+        if (key < x->m_key) x = x->m_left;
+        else if (x->m_key < key) x = x->m_right;
+        else return false;
+      }
+      place.m_cur = cur;
+      place.m_edgeptr = edgeptr;
+      return true;
+    }
+
+    //=========================================================================
+    // Link the new node `newnode' into the tree at `place', found by
+    // find_insert_place(), and unzip the search path below it.
+    //=========================================================================
+    void link_new_node(node_type *newnode, const insert_place &place) {
+      if (!place.m_edgeptr) m_root = newnode;
+      else *(place.m_edgeptr) = newnode;
+      unzip(place.m_cur, newnode->m_key, newnode);
     }
 
     //=========================================================================
     // Search for a node with a given `key'. Return a pointer to the node and
     // the address of the pointer of which it is the target.
     //=========================================================================
-    std::pair<node_type*, node_type**> find(const key_type &key) const {
+    std::pair<node_type*, node_type**> find_node(const key_type &key) const {
       node_type *cur = m_root, **edgeptr = 0; 
       while (cur) {
         if (key < cur->m_key) {
@@ -274,22 +962,48 @@ class zip_tree {
     }
 
     //=========================================================================
-    // Return random rank.
+    // Return the rank of node `x'.
+    //=========================================================================
+    inline std::uint8_t get_rank(const node_type *x) const {
+      return get_rank(x,
+          std::integral_constant<bool, rank_policy::k_stored>());
+    }
+
+    inline std::uint8_t get_rank(const node_type *x, std::true_type) const {
+      return x->m_rank;
+    }
+
+    inline std::uint8_t get_rank(const node_type *x, std::false_type) const {
+      return m_ranks.new_rank(x->m_key);
+    }
+
+    //=========================================================================
+    // Destroy the node `x' and return its memory to the allocator.
     //=========================================================================
-    inline std::uint8_t random_rank() const {
-      std::uint64_t rank = 0;
-      while (rand() % 2) ++rank;
-      return rank;
+    inline void delete_node(node_type *x) {
+      x->~node_type();
+      m_allocator.deallocate(x);
     }
 
     //=========================================================================
-    // Delete subtree rooted in `x'.
+    // Destroy all nodes in the subtree rooted in `x' and, if `dealloc' is
+    // true, return their memory to the allocator. To avoid recursion, the
+    // left child of the current node is rotated up until there is none,
+    // and then the node is destroyed and we move to its right child.
     //=========================================================================
-    void delete_subtree(node_type *x) {
-      if (x) {
-        delete_subtree(x->m_left);
-        delete_subtree(x->m_right);
-        delete x;
+    void delete_subtree(node_type *x, bool dealloc) {
+      while (x) {
+        if (x->m_left) {
+          node_type *y = x->m_left;
+          x->m_left = y->m_right;
+          y->m_right = x;
+          x = y;
+        } else {
+          node_type *next = x->m_right;
+          if (dealloc) delete_node(x);
+          else x->~node_type();
+          x = next;
+        }
       }
     }
 
@@ -300,7 +1014,7 @@ class zip_tree {
       if (x) {
         if (x->m_right) print(x->m_right, indent + 4);
         for (std::uint64_t j = 0; j < indent; ++j) std::cout << ' ';
-        std::cout << "(" << x->m_key << ", rank = " << (int)x->m_rank << ")\n ";
+        std::cout << "(" << x->m_key << ", rank = " << (int)get_rank(x) << ")\n ";
         if (x->m_left) print(x->m_left, indent + 4);
       }
     }
@@ -359,7 +1073,7 @@ class zip_tree {
     void check_ranks(const node_type *x) const {
       if (x->m_left) {
         check_ranks(x->m_left);
-        if (x->m_left->m_rank >= x->m_rank) {
+        if (get_rank(x->m_left) >= get_rank(x)) {
           std::cerr << "\nError: check_ranks failed!\n";
           print();
           std::exit(EXIT_FAILURE);
@@ -368,7 +1082,7 @@ class zip_tree {
 
       if (x->m_right) {
         check_ranks(x->m_right);
-        if (x->m_right->m_rank > x->m_rank) {
+        if (get_rank(x->m_right) > get_rank(x)) {
           std::cerr << "\nError: check_ranks failed!\n";
           print();
           std::exit(EXIT_FAILURE);
@@ -377,4 +1091,6 @@ class zip_tree {
     }
 };
 
-#endif  // __ZIP_TREE_HPP_INCLUDED
+}  // namespace no_parent_pointer
+
+#endif  // __NO_PARENT_POINTER_ZIP_TREE_HPP_INCLUDED
@@ -0,0 +1,575 @@
+/**
+ * @file    blocked_zip_tree.hpp
+ * @section LICENCE
+ *
+ * Implementation of the Zip Tree with parent pointer for uint64_t
+ * keys, storing the items of low rank in sorted blocks, v0.1.0
+ * See: https://github.com/dominikkempa/zip-tree
+ *
+ * Copyright (C) 2018-2020
+ *   Dominik Kempa <dominik.kempa (at) gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef __BLOCKED_ZIP_TREE_HPP_INCLUDED
+#define __BLOCKED_ZIP_TREE_HPP_INCLUDED
+
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "zip_tree.hpp"
+
+
+//=============================================================================
+// Sorted block of up to k_capacity items with uint64_t keys. The keys
+// are kept in a separate array, padded with k_empty_key, so that the
+// position of a key is found by comparing it with all keys of the
+// block at once: with four AVX2 compares of four keys if available,
+// and with a branch-free loop otherwise.
+//=============================================================================
+template<typename value_type>
+class leaf_block {
+  public:
+    static const std::uint32_t k_capacity = 16;
+    static const std::uint64_t k_empty_key = ~0UL;
+
+    //=========================================================================
+    // Keys (followed by k_empty_key), values, and the number of items.
+    //=========================================================================
+    std::uint64_t m_keys[k_capacity];
+    value_type m_values[k_capacity];
+    std::uint32_t m_size;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    leaf_block() {
+      for (std::uint32_t i = 0; i < k_capacity; ++i)
+        m_keys[i] = k_empty_key;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Return the number of keys in the block smaller than `key', i.e.,
+    // the position of `key' in the block.
+    //=========================================================================
+    inline std::uint32_t position(const std::uint64_t key) const {
+#ifdef __AVX2__
+
+      // AVX2 only compares signed 64-bit integers, so the
+      // sign bits of both sides are flipped first.
+      const __m256i flip = _mm256_set1_epi64x(1UL << 63);
+      const __m256i x = _mm256_xor_si256(_mm256_set1_epi64x(key), flip);
+      std::uint32_t mask = 0;
+      for (std::uint32_t i = 0; i < k_capacity; i += 4) {
+        __m256i y = _mm256_loadu_si256((const __m256i *)(m_keys + i));
+        __m256i gt = _mm256_cmpgt_epi64(x, _mm256_xor_si256(y, flip));
+        mask |= (std::uint32_t)_mm256_movemask_pd(
+            _mm256_castsi256_pd(gt)) << i;
+      }
+      return __builtin_popcount(mask);
+#else
+      std::uint32_t ret = 0;
+      for (std::uint32_t i = 0; i < k_capacity; ++i)
+        ret += (m_keys[i] < key);
+      return ret;
+#endif
+    }
+
+    //=========================================================================
+    // Return true if the key at position `pos' is `key'.
+    //=========================================================================
+    inline bool has_key_at(
+        const std::uint32_t pos,
+        const std::uint64_t key) const {
+      return pos < m_size && m_keys[pos] == key;
+    }
+
+    //=========================================================================
+    // Insert the item (key, value) at position `pos'.
+    // Requires m_size < k_capacity.
+    //=========================================================================
+    void insert_at(
+        const std::uint32_t pos,
+        const std::uint64_t key,
+        const value_type &value) {
+      std::copy_backward(m_keys + pos, m_keys + m_size,
+          m_keys + m_size + 1);
+      std::move_backward(m_values + pos, m_values + m_size,
+          m_values + m_size + 1);
+      m_keys[pos] = key;
+      m_values[pos] = value;
+      ++m_size;
+    }
+
+    //=========================================================================
+    // Delete the item at position `pos'.
+    //=========================================================================
+    void erase_at(const std::uint32_t pos) {
+      std::copy(m_keys + pos + 1, m_keys + m_size, m_keys + pos);
+      std::move(m_values + pos + 1, m_values + m_size, m_values + pos);
+      --m_size;
+      m_keys[m_size] = k_empty_key;
+      m_values[m_size] = value_type();
+    }
+
+    //=========================================================================
+    // Move the first `n' items to the empty block `dest'. The remaining
+    // items are shifted down once and the freed slots padded.
+    //=========================================================================
+    void move_prefix(const std::uint32_t n, leaf_block &dest) {
+      if (!n) return;
+      std::copy(m_keys, m_keys + n, dest.m_keys);
+      std::move(m_values, m_values + n, dest.m_values);
+      dest.m_size = n;
+      std::copy(m_keys + n, m_keys + m_size, m_keys);
+      std::move(m_values + n, m_values + m_size, m_values);
+      for (std::uint32_t i = m_size - n; i < m_size; ++i) {
+        m_keys[i] = k_empty_key;
+        m_values[i] = value_type();
+      }
+      m_size -= n;
+    }
+
+    //=========================================================================
+    // Move all items of `src', whose keys are smaller than all keys of
+    // this block, to the front of this block. Requires m_size + src.m_size
+    // <= k_capacity.
+    //=========================================================================
+    void prepend(leaf_block &src) {
+      const std::uint32_t n = src.m_size;
+      if (!n) return;
+      std::copy_backward(m_keys, m_keys + m_size, m_keys + m_size + n);
+      std::move_backward(m_values, m_values + m_size,
+          m_values + m_size + n);
+      std::copy(src.m_keys, src.m_keys + n, m_keys);
+      std::move(src.m_values, src.m_values + n, m_values);
+      m_size += n;
+    }
+};
+
+//=============================================================================
+// Zip Tree with uint64_t keys in which only the items of rank at least
+// k_rank_threshold are stored in ordinary zip_tree nodes (the "upper"
+// tree). The remaining items, i.e., 7/8 of them in expectation, are
+// stored in leaf blocks (see leaf_block above): every upper node points
+// to the block of items with keys between the key of its predecessor
+// (among the upper nodes) and its own key, and the items with keys
+// greater than all upper keys are in the tail block of the tree. The
+// blocks are allocated from a pool of their own, so that the upper
+// nodes stay small and the descent touches few cache lines.
+//
+// A search thus descends a tree with 8 times fewer nodes and ends with
+// a single scan of a block, instead of pointer-chasing the last few
+// levels, each likely a cache miss. Insertion and deletion in the
+// upper tree are zip_tree::insert() and zip_tree::erase(), and so use
+// unzip() and zip(). The ranks of the items are only used to choose
+// the upper nodes: the upper tree draws its own ranks, so its shape
+// has the distribution of a zip tree of the upper keys. An item which
+// would go to a full block is made an upper node instead, and when
+// erasing an upper node would make the merged block overflow, the
+// largest item of its block takes its place among the upper nodes.
+//=============================================================================
+template<typename value_type>
+class blocked_zip_tree {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef leaf_block<value_type> block_type;
+
+    //=========================================================================
+    // The value of an upper node: the value of the item and the block of
+    // items with keys between the previous upper key and the upper key.
+    //=========================================================================
+    struct upper_value {
+      value_type m_value;
+      block_type *m_block;
+    };
+
+    typedef zip_tree<std::uint64_t, upper_value> upper_tree_type;
+    typedef typename upper_tree_type::iterator upper_iterator;
+    typedef typename upper_tree_type::const_iterator const_upper_iterator;
+
+    //=========================================================================
+    // Minimal rank of the items stored in upper nodes.
+    //=========================================================================
+    static const std::uint8_t k_rank_threshold = 3;
+
+    //=========================================================================
+    // Position of the iterator end().
+    //=========================================================================
+    static const std::uint32_t k_end_pos = ~0U;
+
+    //=========================================================================
+    // The upper tree, the tail block, and the number of items.
+    //=========================================================================
+    upper_tree_type m_upper;
+    block_type m_tail;
+    std::uint64_t m_size;
+
+    //=========================================================================
+    // Allocator of the blocks of upper nodes.
+    //=========================================================================
+    pool_allocator<block_type> m_blocks;
+
+    //=========================================================================
+    // Source of ranks.
+    //=========================================================================
+    random_ranks m_ranks;
+
+  public:
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    blocked_zip_tree() {
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Constructor with an explicit seed for the generator of ranks.
+    //=========================================================================
+    explicit blocked_zip_tree(std::uint64_t seed)
+      : m_upper(seed),
+        m_ranks(random_generator::mix(seed)) {
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Destructor. The blocks of the upper nodes are released with their
+    // pool, after running their destructors if they have any.
+    //=========================================================================
+    ~blocked_zip_tree() {
+      if (!std::is_trivially_destructible<block_type>::value)
+        for (upper_iterator it = m_upper.begin(); it != m_upper.end(); ++it)
+          it.value().m_block->~block_type();
+    }
+
+    blocked_zip_tree(const blocked_zip_tree&) = delete;
+    blocked_zip_tree& operator=(const blocked_zip_tree&) = delete;
+
+    //=========================================================================
+    // Insert a given (key, value) pair into the tree. Return true if
+    // the insertion took place and false otherwise (the key was
+    // already in the tree).
+    //=========================================================================
+    bool insert(const std::uint64_t key, const value_type &value) {
+      upper_iterator it = m_upper.lower_bound(key);
+      if (it != m_upper.end() && it.key() == key) return false;
+      block_type &block = (it == m_upper.end() ?
+          m_tail : *it.value().m_block);
+      const std::uint32_t pos = block.position(key);
+      if (block.has_key_at(pos, key)) return false;
+      ++m_size;
+      if (m_ranks.new_rank(key) < k_rank_threshold &&
+          block.m_size < block_type::k_capacity) {
+        block.insert_at(pos, key, value);
+        return true;
+      }
+
+      // Make the item an upper node, taking
+      // the smaller items of the block.
+      upper_value u;
+      u.m_value = value;
+      u.m_block = new (m_blocks.allocate()) block_type();
+      block.move_prefix(pos, *u.m_block);
+      std::uint64_t upper_key = key;
+      m_upper.insert(std::move(upper_key), std::move(u));
+      return true;
+    }
+
+    //=========================================================================
+    // Delete the item with a given key from the tree.
+    // Return true if the deletion took place.
+    //=========================================================================
+    bool erase(const std::uint64_t key) {
+      upper_iterator it = m_upper.lower_bound(key);
+      if (it == m_upper.end() || it.key() != key) {
+        block_type &block = (it == m_upper.end() ?
+            m_tail : *it.value().m_block);
+        const std::uint32_t pos = block.position(key);
+        if (!block.has_key_at(pos, key)) return false;
+        block.erase_at(pos);
+        --m_size;
+        return true;
+      }
+
+      // Merge the block of the erased upper
+      // node into the block following it.
+      block_type *block = it.value().m_block;
+      upper_iterator next = it;
+      ++next;
+      block_type &next_block = (next == m_upper.end() ?
+          m_tail : *next.value().m_block);
+      if (block->m_size + next_block.m_size <= block_type::k_capacity) {
+        next_block.prepend(*block);
+        m_upper.erase(key);
+        block->~block_type();
+        m_blocks.deallocate(block);
+      } else {
+
+        // The largest item of the block replaces
+        // the erased upper node and takes its block.
+        upper_value u;
+        std::uint64_t upper_key = block->m_keys[block->m_size - 1];
+        u.m_value = std::move(block->m_values[block->m_size - 1]);
+        block->erase_at(block->m_size - 1);
+        u.m_block = block;
+        m_upper.erase(key);
+        m_upper.insert(std::move(upper_key), std::move(u));
+      }
+      --m_size;
+      return true;
+    }
+
+    //=========================================================================
+    // Search for a given key in the tree.
+    // Return a pair containing the key and its value.
+    //=========================================================================
+    std::pair<bool, value_type> search(const std::uint64_t key) const {
+      const value_type *value = lookup(key);
+      if (!value) return std::make_pair(false, value_type());
+      else return std::make_pair(true, *value);
+    }
+
+    //=========================================================================
+    // Return a pointer to the value associated with `key', or nullptr if
+    // the key is not in the tree. The pointer is valid until the next
+    // insertion or deletion, which may move the items of blocks.
+    //=========================================================================
+    value_type* lookup(const std::uint64_t key) {
+      upper_iterator it = m_upper.lower_bound(key);
+      block_type *block = &m_tail;
+      if (it != m_upper.end()) {
+        upper_value &u = it.value();
+        if (it.key() == key) return &(u.m_value);
+        block = u.m_block;
+      }
+      const std::uint32_t pos = block->position(key);
+      return block->has_key_at(pos, key) ? &(block->m_values[pos]) : nullptr;
+    }
+
+    const value_type* lookup(const std::uint64_t key) const {
+      const_upper_iterator it = m_upper.lower_bound(key);
+      const block_type *block = &m_tail;
+      if (it != m_upper.end()) {
+        const upper_value &u = it.value();
+        if (it.key() == key) return &(u.m_value);
+        block = u.m_block;
+      }
+      const std::uint32_t pos = block->position(key);
+      return block->has_key_at(pos, key) ? &(block->m_values[pos]) : nullptr;
+    }
+
+    //=========================================================================
+    // Return true if `key' is in the tree.
+    //=========================================================================
+    bool contains(const std::uint64_t key) const {
+      return lookup(key) != nullptr;
+    }
+
+    //=========================================================================
+    // Return the number of items in the tree.
+    //=========================================================================
+    std::uint64_t size() const {
+      return m_size;
+    }
+
+    //=========================================================================
+    // Return the number of upper nodes.
+    //=========================================================================
+    std::uint64_t upper_size() const {
+      return m_upper.size();
+    }
+
+    //=========================================================================
+    // Return the number of bytes reserved for the upper nodes, see
+    // zip_tree::memory_usage(), and for the blocks, and taken by the
+    // tree itself.
+    //=========================================================================
+    std::uint64_t memory_usage() const {
+      return m_upper.memory_usage() + m_blocks.memory_usage(0) +
+        sizeof(*this);
+    }
+
+    //=========================================================================
+    // Check if the upper tree is a correct zip-tree, whether the keys of
+    // every block are sorted and lie between the neighbouring upper
+    // keys, and whether the number of items is correct.
+    //=========================================================================
+    void check_correctness() const {
+      m_upper.check_correctness();
+      std::uint64_t n_items = 0;
+      bool first = true;
+      std::uint64_t prev = 0;
+      for (const_upper_iterator it = m_upper.begin();
+          it != m_upper.end(); ++it) {
+        check_block(*it.value().m_block, first, prev, true, it.key());
+        n_items += it.value().m_block->m_size + 1;
+        first = false;
+        prev = it.key();
+      }
+      check_block(m_tail, first, prev, false, 0);
+      n_items += m_tail.m_size;
+      if (n_items != m_size) {
+        std::cerr << "\nError: wrong number of items\n";
+        std::exit(EXIT_FAILURE);
+      }
+    }
+
+    //=========================================================================
+    // Very simple non-const iterator. It visits the items of the block of
+    // every upper node before the upper node itself, and then the items
+    // of the tail block. m_pos is the position in the current block, or
+    // the size of the block for the upper node.
+    //=========================================================================
+    class iterator {
+      private:
+        blocked_zip_tree *m_tree;
+        upper_iterator m_it;
+        std::uint32_t m_pos;
+
+        //=====================================================================
+        // Return the block of the current upper node, or the tail block.
+        //=====================================================================
+        block_type& block() const {
+          if (m_it == m_tree->m_upper.end()) return m_tree->m_tail;
+          else return *m_it.value().m_block;
+        }
+
+        //=====================================================================
+        // Turn the position past the tail block into end().
+        //=====================================================================
+        void normalize() {
+          if (m_it == m_tree->m_upper.end() &&
+              m_pos >= m_tree->m_tail.m_size)
+            m_pos = k_end_pos;
+        }
+
+      public:
+        iterator(
+            blocked_zip_tree *tree,
+            upper_iterator it,
+            std::uint32_t pos)
+          : m_tree(tree), m_it(it), m_pos(pos) {
+          normalize();
+        }
+
+        iterator()
+          : m_tree(nullptr), m_pos(k_end_pos) {}
+
+        const std::uint64_t& key() const {
+          const block_type &b = block();
+          if (m_pos < b.m_size) return b.m_keys[m_pos];
+          else return m_it.key();
+        }
+
+        value_type& value() {
+          block_type &b = block();
+          if (m_pos < b.m_size) return b.m_values[m_pos];
+          else return m_it.value().m_value;
+        }
+
+        inline iterator& operator++() {
+          if (m_pos == k_end_pos) {
+            std::cerr << "\nError: ++ on NULL iterator\n";
+            std::exit(EXIT_FAILURE);
+          }
+          if (m_it == m_tree->m_upper.end() || m_pos < block().m_size)
+            ++m_pos;
+          else {
+            ++m_it;
+            m_pos = 0;
+          }
+          normalize();
+          return *this;
+        }
+
+        inline iterator operator++(int) {
+          iterator ret = *this;
+          ++(*this);
+          return ret;
+        }
+
+        bool operator == (const iterator &it) const {
+          return m_pos == it.m_pos && m_it == it.m_it;
+        }
+
+        bool operator != (const iterator &it) const {
+          return !(*this == it);
+        }
+    };
+
+    iterator begin() {
+      return iterator(this, m_upper.begin(), 0);
+    }
+
+    iterator end() {
+      return iterator(this, m_upper.end(), k_end_pos);
+    }
+
+  private:
+
+    //=========================================================================
+    // Check that the keys of `block' are sorted, greater than `lo' (unless
+    // `first'), smaller than `hi' (if `bounded'), and padded correctly.
+    //=========================================================================
+    void check_block(
+        const block_type &block,
+        const bool first,
+        const std::uint64_t lo,
+        const bool bounded,
+        const std::uint64_t hi) const {
+      if (block.m_size > block_type::k_capacity) {
+        std::cerr << "\nError: block overflow\n";
+        std::exit(EXIT_FAILURE);
+      }
+      for (std::uint32_t i = 0; i < block.m_size; ++i) {
+        const std::uint64_t key = block.m_keys[i];
+        if ((i == 0 && !first && !(lo < key)) ||
+            (i > 0 && !(block.m_keys[i - 1] < key)) ||
+            (bounded && !(key < hi))) {
+          std::cerr << "\nError: keys of a block are not in order\n";
+          std::exit(EXIT_FAILURE);
+        }
+      }
+      for (std::uint32_t i = block.m_size; i < block_type::k_capacity; ++i) {
+        if (block.m_keys[i] != block_type::k_empty_key) {
+          std::cerr << "\nError: wrong padding of a block\n";
+          std::exit(EXIT_FAILURE);
+        }
+      }
+    }
+};
+
+#endif  // __BLOCKED_ZIP_TREE_HPP_INCLUDED
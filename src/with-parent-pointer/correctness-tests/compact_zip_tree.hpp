@@ -0,0 +1,474 @@
+/**
+ * @file    compact_zip_tree.hpp
+ * @section LICENCE
+ *
+ * Implementation of the Zip Tree with parent pointer, using 32-bit
+ * node indices instead of pointers, v0.1.0
+ * See: https://github.com/dominikkempa/zip-tree
+ *
+ * Copyright (C) 2018-2020
+ *   Dominik Kempa <dominik.kempa (at) gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef __COMPACT_ZIP_TREE_HPP_INCLUDED
+#define __COMPACT_ZIP_TREE_HPP_INCLUDED
+
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "zip_tree.hpp"
+
+
+//=============================================================================
+// Node of a compact Zip Tree. Children and parent are 32-bit indices
+// into the arena of the tree, index 0 denotes a missing node. For
+// 8-byte aligned keys/values the rank occupies the bytes which would
+// otherwise be padding after the three indices, e.g., for uint64_t
+// keys and values the node takes 32 bytes instead of 48.
+//=============================================================================
+template<typename key_type, typename value_type>
+class compact_node {
+  public:
+
+    //=========================================================================
+    // Key, value, indices of children and parent, and rank.
+    //=========================================================================
+    key_type m_key;
+    value_type m_value;
+    std::uint32_t m_left;
+    std::uint32_t m_right;
+    std::uint32_t m_par;
+    std::uint8_t m_rank;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    compact_node()
+      : m_key(),
+        m_value() {
+      m_left = 0;
+      m_right = 0;
+      m_par = 0;
+      m_rank = 0;
+    }
+};
+
+//=============================================================================
+// Zip Tree storing all nodes in a single arena (std::vector) and
+// linking them with 32-bit indices. It can hold up to 2^32 - 1 items.
+// Erased nodes are kept on a free list (linked through m_left) and
+// reused by subsequent insertions.
+//=============================================================================
+template<typename key_type, typename value_type>
+class compact_zip_tree {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef compact_node<key_type, value_type> node_type;
+
+    //=========================================================================
+    // Arena of nodes (m_nodes[0] is never used), index
+    // of the root, and the head of the list of free nodes.
+    //=========================================================================
+    std::vector<node_type> m_nodes;
+    std::uint32_t m_root;
+    std::uint32_t m_free;
+
+    //=========================================================================
+    // Generator of random ranks.
+    //=========================================================================
+    random_generator m_random;
+
+  public:
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    compact_zip_tree() {
+      m_nodes.resize(1);
+      m_root = 0;
+      m_free = 0;
+    }
+
+    //=========================================================================
+    // Constructor with an explicit seed for the generator of ranks.
+    //=========================================================================
+    explicit compact_zip_tree(std::uint64_t seed)
+      : m_random(seed) {
+      m_nodes.resize(1);
+      m_root = 0;
+      m_free = 0;
+    }
+
+    //=========================================================================
+    // Insert a node with a given (key, value) pair into the tree.
+    // Return true if the insertion took place and false otherwise (the
+    // key was already in the tree).
+    //=========================================================================
+    bool insert(const key_type &key, const value_type &value) {
+      std::uint8_t rank = random_rank();
+      std::uint32_t cur = m_root, par = 0;
+      bool left = false;
+      while (cur && m_nodes[cur].m_rank > rank) {
+        const node_type &c = m_nodes[cur];
+        par = cur;
+        if (key < c.m_key) {
+          left = true;
+          cur = c.m_left;
+        } else if (c.m_key < key) {
+          left = false;
+          cur = c.m_right;
+        } else return false;
+      }
+      while (cur && m_nodes[cur].m_rank == rank && m_nodes[cur].m_key < key) {
+        par = cur;
+        left = false;
+        cur = m_nodes[cur].m_right;
+      }
+      for (std::uint32_t x = cur; x; ) {
+        if (key < m_nodes[x].m_key) x = m_nodes[x].m_left;
+        else if (m_nodes[x].m_key < key) x = m_nodes[x].m_right;
+        else return false;
+      }
+
+      // The edge to the new node is given by (par, left) rather
+      // than by a pointer, since new_node() may move the arena.
+      std::uint32_t newnode = new_node();
+      if (!par) m_root = newnode;
+      else if (left) m_nodes[par].m_left = newnode;
+      else m_nodes[par].m_right = newnode;
+      node_type &z = m_nodes[newnode];
+      z.m_key = key;
+      z.m_value = value;
+      z.m_rank = rank;
+      z.m_par = par;
+      unzip(cur, key, newnode);
+      return true;
+    }
+
+    //=========================================================================
+    // Delete the node with a given key from the tree.
+    // Return true if the deletion took place.
+    //=========================================================================
+    bool erase(const key_type &key) {
+      std::uint32_t x = find_node(key);
+      if (!x) return false;
+      node_type &n = m_nodes[x];
+      std::uint32_t newroot = zip(n.m_left, n.m_right, n.m_par);
+      if (!n.m_par) m_root = newroot;
+      else if (m_nodes[n.m_par].m_left == x) m_nodes[n.m_par].m_left = newroot;
+      else m_nodes[n.m_par].m_right = newroot;
+      n.m_value = value_type();
+      n.m_left = m_free;
+      m_free = x;
+      return true;
+    }
+
+    //=========================================================================
+    // Search for a given key in the tree.
+    // Return a pair containing the key and its value.
+    //=========================================================================
+    std::pair<bool, value_type> search(const key_type &key) const {
+      std::uint32_t x = find_node(key);
+      if (!x) return std::make_pair(false, value_type());
+      else return std::make_pair(true, m_nodes[x].m_value);
+    }
+
+    //=========================================================================
+    // Return a pointer to the value associated with `key', or nullptr if
+    // the key is not in the tree. Unlike search(), this copies nothing.
+    // The pointer is valid until the next insertion, which may move the
+    // arena, or until the item is erased.
+    //=========================================================================
+    value_type* lookup(const key_type &key) {
+      std::uint32_t x = find_node(key);
+      return x ? &(m_nodes[x].m_value) : nullptr;
+    }
+
+    const value_type* lookup(const key_type &key) const {
+      std::uint32_t x = find_node(key);
+      return x ? &(m_nodes[x].m_value) : nullptr;
+    }
+
+    //=========================================================================
+    // Return true if `key' is in the tree.
+    //=========================================================================
+    bool contains(const key_type &key) const {
+      return find_node(key) != 0;
+    }
+
+    //=========================================================================
+    // Return the number of bytes reserved for the arena, including its
+    // unused capacity, just as zip_tree::memory_usage() includes the
+    // unused slots of the pool.
+    //=========================================================================
+    std::uint64_t memory_usage() const {
+      return m_nodes.capacity() * sizeof(node_type);
+    }
+
+    //=========================================================================
+    // Check if a tree is a correct zip-tree, i.e., if the order of keys
+    // is correct, and whether rank[left[v]] < rank[v] and
+    // rank[right[v]] <= rank[v] conditions hold for every node. Also
+    // check the parent indices.
+    //=========================================================================
+    void check_correctness() const {
+      if (m_root) {
+        if (m_nodes[m_root].m_par != 0) {
+          std::cerr << "\nError: m_root->m_par != 0\n";
+          std::exit(EXIT_FAILURE);
+        }
+        check(m_root, 0, 0);
+      }
+    }
+
+  public:
+
+    //=========================================================================
+    // Very simple non-const iterator.
+    //=========================================================================
+    class iterator {
+      private:
+        compact_zip_tree *m_tree;
+        std::uint32_t m_idx;
+
+      public:
+        iterator(compact_zip_tree *tree, std::uint32_t idx)
+          : m_tree(tree), m_idx(idx) {}
+
+        iterator()
+          : m_tree(nullptr), m_idx(0) {}
+
+        const key_type& key() const {
+          return m_tree->m_nodes[m_idx].m_key;
+        }
+
+        value_type& value() {
+          return m_tree->m_nodes[m_idx].m_value;
+        }
+
+        inline iterator& operator++() {
+          if (!m_idx) {
+            std::cerr << "\nError: ++ on NULL iterator\n";
+            std::exit(EXIT_FAILURE);
+          }
+          m_idx = m_tree->next(m_idx);
+          return *this;
+        }
+
+        inline iterator operator++(int) {
+          iterator ret = *this;
+          ++(*this);
+          return ret;
+        }
+
+        bool operator == (const iterator &it) const {
+          return m_idx == it.m_idx;
+        }
+
+        bool operator != (const iterator &it) const {
+          return m_idx != it.m_idx;
+        }
+    };
+
+    iterator begin() {
+      return iterator(this, min_node(m_root));
+    }
+
+    iterator end() {
+      return iterator(this, 0);
+    }
+
+    //=========================================================================
+    // Return the iterator to the item with key `key',
+    // or end() if there is no such item.
+    //=========================================================================
+    iterator find(const key_type &key) {
+      return iterator(this, find_node(key));
+    }
+
+  private:
+
+    //=========================================================================
+    // Return the index of an unused node, taken from
+    // the free list or appended at the end of the arena.
+    //=========================================================================
+    std::uint32_t new_node() {
+      if (m_free) {
+        std::uint32_t x = m_free;
+        m_free = m_nodes[x].m_left;
+        m_nodes[x].m_left = 0;
+        return x;
+      }
+      if (m_nodes.size() == (1UL << 32) - 1) {
+        std::cerr << "\nError: compact_zip_tree is full\n";
+        std::exit(EXIT_FAILURE);
+      }
+      m_nodes.push_back(node_type());
+      return (std::uint32_t)(m_nodes.size() - 1);
+    }
+
+    //=========================================================================
+    // Zip-in two subtrees and return the root of the resulting tree,
+    // whose parent is set to `par'. See zip_tree::zip().
+    //=========================================================================
+    std::uint32_t zip(std::uint32_t x, std::uint32_t y, std::uint32_t par) {
+      std::uint32_t root = 0, *hook = &root;
+      while (x && y) {
+        if (m_nodes[x].m_rank >= m_nodes[y].m_rank) {
+          *hook = x;
+          m_nodes[x].m_par = par;
+          par = x;
+          hook = &(m_nodes[x].m_right);
+          x = m_nodes[x].m_right;
+        } else {
+          *hook = y;
+          m_nodes[y].m_par = par;
+          par = y;
+          hook = &(m_nodes[y].m_left);
+          y = m_nodes[y].m_left;
+        }
+      }
+      *hook = (x ? x : y);
+      if (*hook)
+        m_nodes[*hook].m_par = par;
+      return root;
+    }
+
+    //=========================================================================
+    // Split the subtree rooted in `x' around `key' (which does not
+    // occur in it) and hang the parts below `z'. See zip_tree::unzip().
+    //=========================================================================
+    void unzip(std::uint32_t x, const key_type &key, std::uint32_t z) {
+      std::uint32_t *lhook = &(m_nodes[z].m_left);
+      std::uint32_t *rhook = &(m_nodes[z].m_right);
+      std::uint32_t lpar = z, rpar = z;
+      while (x) {
+        node_type &n = m_nodes[x];
+        if (n.m_key < key) {
+          *lhook = x;
+          n.m_par = lpar;
+          lpar = x;
+          lhook = &(n.m_right);
+          x = n.m_right;
+        } else {
+          *rhook = x;
+          n.m_par = rpar;
+          rpar = x;
+          rhook = &(n.m_left);
+          x = n.m_left;
+        }
+      }
+      *lhook = 0;
+      *rhook = 0;
+    }
+
+    //=========================================================================
+    // Return the index of the node with a given `key' or 0 if none.
+    //=========================================================================
+    std::uint32_t find_node(const key_type &key) const {
+      std::uint32_t cur = m_root;
+      while (cur) {
+        const node_type &c = m_nodes[cur];
+        if (key < c.m_key) cur = c.m_left;
+        else if (c.m_key < key) cur = c.m_right;
+        else return cur;
+      }
+      return 0;
+    }
+
+    //=========================================================================
+    // Return random rank.
+    //=========================================================================
+    inline std::uint8_t random_rank() {
+      return m_random.random_rank();
+    }
+
+    //=========================================================================
+    // Check keys, ranks and parents in the subtree rooted in `x'. All
+    // keys have to be in the range given by nodes `lo' and `hi' (0 =
+    // unbounded). Uses an explicit stack instead of recursion.
+    //=========================================================================
+    void check(std::uint32_t x, std::uint32_t lo, std::uint32_t hi) const {
+      struct frame { std::uint32_t m_x, m_lo, m_hi; };
+      std::vector<frame> stack;
+      frame f = { x, lo, hi };
+      stack.push_back(f);
+      while (!stack.empty()) {
+        f = stack.back();
+        stack.pop_back();
+        const node_type &n = m_nodes[f.m_x];
+        if ((f.m_lo && !(m_nodes[f.m_lo].m_key < n.m_key)) ||
+            (f.m_hi && !(n.m_key < m_nodes[f.m_hi].m_key))) {
+          std::cerr << "\nError: check_keys failed!\n";
+          std::exit(EXIT_FAILURE);
+        }
+        if ((n.m_left && m_nodes[n.m_left].m_rank >= n.m_rank) ||
+            (n.m_right && m_nodes[n.m_right].m_rank > n.m_rank)) {
+          std::cerr << "\nError: check_ranks failed!\n";
+          std::exit(EXIT_FAILURE);
+        }
+        if ((n.m_left && m_nodes[n.m_left].m_par != f.m_x) ||
+            (n.m_right && m_nodes[n.m_right].m_par != f.m_x)) {
+          std::cerr << "\nError: check_parents failed!\n";
+          std::exit(EXIT_FAILURE);
+        }
+        if (n.m_left) {
+          frame g = { n.m_left, f.m_lo, f.m_x };
+          stack.push_back(g);
+        }
+        if (n.m_right) {
+          frame g = { n.m_right, f.m_x, f.m_hi };
+          stack.push_back(g);
+        }
+      }
+    }
+
+    //=========================================================================
+    // Compute the next node in inorder. We assume x != 0.
+    //=========================================================================
+    std::uint32_t next(std::uint32_t x) const {
+      if (m_nodes[x].m_right)
+        return min_node(m_nodes[x].m_right);
+      while (m_nodes[x].m_par && m_nodes[m_nodes[x].m_par].m_right == x)
+        x = m_nodes[x].m_par;
+      return m_nodes[x].m_par;
+    }
+
+    //=========================================================================
+    // Return the leftmost node in the subtree rooted in `x'.
+    //=========================================================================
+    std::uint32_t min_node(std::uint32_t x) const {
+      if (!x) return 0;
+      while (m_nodes[x].m_left)
+        x = m_nodes[x].m_left;
+      return x;
+    }
+};
+
+#endif  // __COMPACT_ZIP_TREE_HPP_INCLUDED
@@ -0,0 +1,624 @@
+/**
+ * @file    concurrent_zip_tree.hpp
+ * @section LICENCE
+ *
+ * Implementation of the Zip Tree supporting concurrent readers and
+ * writers, v0.1.0
+ * See: https://github.com/dominikkempa/zip-tree
+ *
+ * Copyright (C) 2018-2020
+ *   Dominik Kempa <dominik.kempa (at) gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef __CONCURRENT_ZIP_TREE_HPP_INCLUDED
+#define __CONCURRENT_ZIP_TREE_HPP_INCLUDED
+
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+
+#include "zip_tree.hpp"
+
+
+//=============================================================================
+// Test-and-test-and-set lock, small enough to be put in every node.
+//=============================================================================
+class spin_lock {
+  private:
+    std::atomic<bool> m_locked;
+
+  public:
+    spin_lock()
+      : m_locked(false) {}
+
+    inline void lock() {
+      while (m_locked.exchange(true, std::memory_order_acquire))
+        while (m_locked.load(std::memory_order_relaxed))
+          std::this_thread::yield();
+    }
+
+    inline void unlock() {
+      m_locked.store(false, std::memory_order_release);
+    }
+};
+
+//=============================================================================
+// Small integer identifier of the calling thread, unique among the
+// running threads. Identifiers of finished threads are reused, so they
+// stay below the maximal number of simultaneously running threads.
+//=============================================================================
+class thread_id {
+  private:
+
+    //=========================================================================
+    // Pool of identifiers, shared by all threads.
+    //=========================================================================
+    struct registry {
+      std::mutex m_mutex;
+      std::vector<std::uint64_t> m_free;
+      std::uint64_t m_next;
+
+      registry()
+        : m_next(0) {}
+    };
+
+    static registry& get_registry() {
+      static registry r;
+      return r;
+    }
+
+    //=========================================================================
+    // Identifier of a single thread, returned to the pool on exit.
+    //=========================================================================
+    struct holder {
+      std::uint64_t m_id;
+
+      holder() {
+        registry &r = get_registry();
+        std::lock_guard<std::mutex> guard(r.m_mutex);
+        if (r.m_free.empty()) m_id = r.m_next++;
+        else {
+          m_id = r.m_free.back();
+          r.m_free.pop_back();
+        }
+      }
+
+      ~holder() {
+        registry &r = get_registry();
+        std::lock_guard<std::mutex> guard(r.m_mutex);
+        r.m_free.push_back(m_id);
+      }
+    };
+
+  public:
+
+    //=========================================================================
+    // Return the identifier of the calling thread.
+    //=========================================================================
+    static std::uint64_t get() {
+      static thread_local holder h;
+      return h.m_id;
+    }
+};
+
+//=============================================================================
+// Node of a concurrent Zip Tree. The key, value, and rank never change
+// after the node is published; the children are atomic, since they
+// are read by readers while the writers replace them.
+//=============================================================================
+template<typename key_type, typename value_type>
+class concurrent_node {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef concurrent_node<key_type, value_type> node_type;
+
+  public:
+
+    //=========================================================================
+    // Key, value, children, rank, and the lock held by writers.
+    //=========================================================================
+    const key_type m_key;
+    const value_type m_value;
+    std::atomic<node_type*> m_left;
+    std::atomic<node_type*> m_right;
+    const std::uint8_t m_rank;
+    spin_lock m_lock;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    concurrent_node(
+        const key_type &key,
+        const value_type &value,
+        const std::uint8_t rank)
+      : m_key(key),
+        m_value(value),
+        m_left(nullptr),
+        m_right(nullptr),
+        m_rank(rank) {}
+};
+
+//=============================================================================
+// Zip Tree allowing any number of threads to search and iterate the
+// tree while other threads insert and delete items. There are no
+// parent pointers.
+//
+// Readers take no locks and never wait: search() and for_each() only
+// follow atomic child pointers. Writers never modify a node reachable
+// by readers, except for a single child pointer per operation: the
+// nodes on the unzip path (insert) or on the zip paths (erase) are
+// copied, the new subtree is built from the copies and the untouched
+// subtrees, and then published by one atomic store to the parent. A
+// reader therefore always sees either the old or the new subtree.
+//
+// Writers lock the nodes hand-over-hand on the way down (the child
+// before releasing the parent), and keep the parent of the modified
+// subtree and all the nodes they copy locked until publication, so
+// writers in disjoint subtrees proceed in parallel. Locks are only
+// taken downwards, which precludes deadlocks.
+//
+// The replaced nodes are reclaimed with epoch-based reclamation: each
+// reader announces the global epoch while it is inside the tree, and
+// the nodes retired in epoch e are deleted once the global epoch has
+// reached e + 2, i.e., when no reader can still hold them. At most
+// k_max_threads threads may be running at the same time.
+//=============================================================================
+template<typename key_type, typename value_type>
+class concurrent_zip_tree {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef concurrent_node<key_type, value_type> node_type;
+    typedef std::atomic<node_type*> edge_type;
+
+    static const std::uint64_t k_max_threads = 256;
+    static const std::uint64_t k_inactive = ~0UL;
+    static const std::uint64_t k_reclaim_threshold = 1024;
+
+    //=========================================================================
+    // Epoch announced by a reader, padded to a cache line.
+    //=========================================================================
+    struct epoch_slot {
+      std::atomic<std::uint64_t> m_epoch;
+      char m_padding[64 - sizeof(std::atomic<std::uint64_t>)];
+    };
+
+    //=========================================================================
+    // Root of the tree and the lock guarding it, number of items.
+    //=========================================================================
+    edge_type m_root;
+    spin_lock m_root_lock;
+    std::atomic<std::uint64_t> m_size;
+
+    //=========================================================================
+    // Epoch-based reclamation: the global epoch, the epochs of
+    // active readers, and the retired nodes with their epochs.
+    //=========================================================================
+    std::atomic<std::uint64_t> m_epoch;
+    std::unique_ptr<epoch_slot[]> m_slots;
+    std::mutex m_retired_mutex;
+    std::vector<std::pair<std::uint64_t, node_type*> > m_retired;
+    std::uint64_t m_reclaim_at;
+
+  public:
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    concurrent_zip_tree()
+      : m_root(nullptr),
+        m_size(0),
+        m_epoch(0),
+        m_slots(new epoch_slot[k_max_threads]),
+        m_reclaim_at(k_reclaim_threshold) {
+      for (std::uint64_t i = 0; i < k_max_threads; ++i)
+        m_slots[i].m_epoch.store(k_inactive);
+    }
+
+    concurrent_zip_tree(const concurrent_zip_tree&) = delete;
+    concurrent_zip_tree& operator=(const concurrent_zip_tree&) = delete;
+
+    //=========================================================================
+    // Destructor. No other thread may access the tree.
+    //=========================================================================
+    ~concurrent_zip_tree() {
+      delete_subtree(m_root.load());
+      for (std::uint64_t i = 0; i < m_retired.size(); ++i)
+        delete m_retired[i].second;
+    }
+
+    //=========================================================================
+    // Return the number of items in the tree.
+    //=========================================================================
+    inline std::uint64_t size() const {
+      return m_size.load(std::memory_order_relaxed);
+    }
+
+    //=========================================================================
+    // Insert a node with a given (key, value) pair into the tree.
+    // Return true if the insertion took place and false otherwise (the
+    // key was already in the tree). The rank is drawn from a generator
+    // owned by the calling thread.
+    //=========================================================================
+    bool insert(const key_type &key, const value_type &value) {
+      static thread_local random_generator random;
+      std::uint8_t rank = random.random_rank();
+
+      // Find the place of the new node, locking hand-over-hand.
+      spin_lock *par_lock = &m_root_lock;
+      par_lock->lock();
+      edge_type *edge = &m_root;
+      node_type *cur = edge->load(std::memory_order_relaxed);
+      while (cur && (cur->m_rank > rank ||
+            (cur->m_rank == rank && cur->m_key < key))) {
+        if (!(key < cur->m_key) && !(cur->m_key < key)) {
+          par_lock->unlock();
+          return false;
+        }
+        cur->m_lock.lock();
+        par_lock->unlock();
+        par_lock = &(cur->m_lock);
+        edge = (key < cur->m_key ? &(cur->m_left) : &(cur->m_right));
+        cur = edge->load(std::memory_order_relaxed);
+      }
+
+      // Unzip the subtree of `cur' into copies of the nodes on the
+      // search path, hung below the new node. The originals stay
+      // locked until the new subtree is published.
+      std::vector<node_type*> path, copies;
+      node_type *newnode = new node_type(key, value, rank);
+      edge_type *lhook = &(newnode->m_left), *rhook = &(newnode->m_right);
+      for (node_type *x = cur; x; ) {
+        x->m_lock.lock();
+        path.push_back(x);
+        if (!(key < x->m_key) && !(x->m_key < key)) {
+          unlock_all(path);
+          par_lock->unlock();
+          delete newnode;
+          for (std::uint64_t i = 0; i < copies.size(); ++i)
+            delete copies[i];
+          return false;
+        }
+        node_type *copy = new node_type(x->m_key, x->m_value, x->m_rank);
+        copies.push_back(copy);
+        if (x->m_key < key) {
+          copy->m_left.store(x->m_left.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+          lhook->store(copy, std::memory_order_relaxed);
+          lhook = &(copy->m_right);
+          x = x->m_right.load(std::memory_order_relaxed);
+        } else {
+          copy->m_right.store(x->m_right.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+          rhook->store(copy, std::memory_order_relaxed);
+          rhook = &(copy->m_left);
+          x = x->m_left.load(std::memory_order_relaxed);
+        }
+      }
+      edge->store(newnode, std::memory_order_release);
+      par_lock->unlock();
+      unlock_all(path);
+      m_size.fetch_add(1, std::memory_order_relaxed);
+      retire(path);
+      return true;
+    }
+
+    //=========================================================================
+    // Delete the node with a given key from the tree.
+    // Return true if the deletion took place.
+    //=========================================================================
+    bool erase(const key_type &key) {
+
+      // Find the node, locking hand-over-hand.
+      spin_lock *par_lock = &m_root_lock;
+      par_lock->lock();
+      edge_type *edge = &m_root;
+      node_type *x = edge->load(std::memory_order_relaxed);
+      while (x && (key < x->m_key || x->m_key < key)) {
+        x->m_lock.lock();
+        par_lock->unlock();
+        par_lock = &(x->m_lock);
+        edge = (key < x->m_key ? &(x->m_left) : &(x->m_right));
+        x = edge->load(std::memory_order_relaxed);
+      }
+      if (!x) {
+        par_lock->unlock();
+        return false;
+      }
+
+      // Zip the subtrees of `x' from copies of the nodes on
+      // the right spine of the left subtree and the left spine
+      // of the right subtree.
+      x->m_lock.lock();
+      std::vector<node_type*> path(1, x);
+      node_type *l = x->m_left.load(std::memory_order_relaxed);
+      node_type *r = x->m_right.load(std::memory_order_relaxed);
+      edge_type root(nullptr), *hook = &root;
+      while (l && r) {
+        if (l->m_rank >= r->m_rank) {
+          l->m_lock.lock();
+          path.push_back(l);
+          node_type *copy = new node_type(l->m_key, l->m_value, l->m_rank);
+          copy->m_left.store(l->m_left.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+          hook->store(copy, std::memory_order_relaxed);
+          hook = &(copy->m_right);
+          l = l->m_right.load(std::memory_order_relaxed);
+        } else {
+          r->m_lock.lock();
+          path.push_back(r);
+          node_type *copy = new node_type(r->m_key, r->m_value, r->m_rank);
+          copy->m_right.store(r->m_right.load(std::memory_order_relaxed),
+              std::memory_order_relaxed);
+          hook->store(copy, std::memory_order_relaxed);
+          hook = &(copy->m_left);
+          r = r->m_left.load(std::memory_order_relaxed);
+        }
+      }
+      hook->store(l ? l : r, std::memory_order_relaxed);
+      edge->store(root.load(std::memory_order_relaxed),
+          std::memory_order_release);
+      par_lock->unlock();
+      unlock_all(path);
+      m_size.fetch_sub(1, std::memory_order_relaxed);
+      retire(path);
+      return true;
+    }
+
+    //=========================================================================
+    // Search for a given key in the tree. Return a pair containing
+    // the key and its value. Safe to call concurrently with writers.
+    //=========================================================================
+    std::pair<bool, value_type> search(const key_type &key) const {
+      epoch_guard guard(*this);
+      const node_type *x = m_root.load(std::memory_order_acquire);
+      while (x) {
+        if (key < x->m_key) x = x->m_left.load(std::memory_order_acquire);
+        else if (x->m_key < key)
+          x = x->m_right.load(std::memory_order_acquire);
+        else return std::make_pair(true, x->m_value);
+      }
+      return std::make_pair(false, value_type());
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item with lo <= key < hi, in the
+    // increasing order of keys. Safe to call concurrently with writers:
+    // every item present during the whole traversal is visited exactly
+    // once, items inserted or deleted meanwhile may or may not be. The
+    // nodes retired during the traversal are not reclaimed before it
+    // ends, so long traversals delay the reclamation.
+    //=========================================================================
+    template<typename function_type>
+    void for_each_in_range(
+        const key_type &lo,
+        const key_type &hi,
+        function_type fn) const {
+      epoch_guard guard(*this);
+      for_each_in_range(m_root.load(std::memory_order_acquire), lo, hi, fn);
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item, in the increasing order of
+    // keys. Same guarantees as for_each_in_range().
+    //=========================================================================
+    template<typename function_type>
+    void for_each(function_type fn) const {
+      epoch_guard guard(*this);
+      for_each(m_root.load(std::memory_order_acquire), fn);
+    }
+
+    //=========================================================================
+    // Check if a tree is a correct zip-tree, i.e., if the order of keys
+    // is correct, and whether rank[left[v]] < rank[v] and
+    // rank[right[v]] <= rank[v] conditions hold for every node. No other
+    // thread may modify the tree.
+    //=========================================================================
+    void check_correctness() const {
+      std::uint64_t count = 0;
+      const node_type *prev = 0;
+      check(m_root.load(), prev, count);
+      if (count != size()) {
+        std::cerr << "\nError: check_size failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+    }
+
+  private:
+
+    //=========================================================================
+    // Announces the current epoch of the calling thread for the
+    // lifetime of the object. The epoch is re-read after the
+    // announcement, so that it cannot be advanced by two unnoticed.
+    // Nested guards (e.g., a search() from the function passed to
+    // for_each()) keep the epoch of the outermost one.
+    //=========================================================================
+    class epoch_guard {
+      private:
+        std::atomic<std::uint64_t> *m_slot;
+
+      public:
+        epoch_guard(const concurrent_zip_tree &tree) {
+          std::uint64_t id = thread_id::get();
+          if (id >= k_max_threads) {
+            std::cerr << "\nError: too many threads\n";
+            std::exit(EXIT_FAILURE);
+          }
+          m_slot = &(tree.m_slots[id].m_epoch);
+          if (m_slot->load(std::memory_order_relaxed) != k_inactive) {
+            m_slot = 0;
+            return;
+          }
+          std::uint64_t epoch = tree.m_epoch.load();
+          while (true) {
+            m_slot->store(epoch);
+            std::uint64_t cur = tree.m_epoch.load();
+            if (cur == epoch) break;
+            epoch = cur;
+          }
+        }
+
+        ~epoch_guard() {
+          if (m_slot)
+            m_slot->store(k_inactive, std::memory_order_release);
+        }
+    };
+
+    //=========================================================================
+    // Release the locks of all nodes in `nodes'.
+    //=========================================================================
+    static void unlock_all(const std::vector<node_type*> &nodes) {
+      for (std::uint64_t i = 0; i < nodes.size(); ++i)
+        nodes[i]->m_lock.unlock();
+    }
+
+    //=========================================================================
+    // Schedule the nodes (already unreachable from the root) for
+    // deletion. From time to time try to advance the global epoch
+    // and delete the nodes no reader can hold anymore. If a reader
+    // stays in the tree for long (e.g., is preempted), the nodes
+    // are not freed, and the next attempt is postponed until the
+    // number of retired nodes doubles, so that the cost of the
+    // attempts stays constant per retired node.
+    //=========================================================================
+    void retire(const std::vector<node_type*> &nodes) {
+      std::lock_guard<std::mutex> guard(m_retired_mutex);
+      std::uint64_t epoch = m_epoch.load();
+      for (std::uint64_t i = 0; i < nodes.size(); ++i)
+        m_retired.push_back(std::make_pair(epoch, nodes[i]));
+      if (m_retired.size() >= m_reclaim_at) {
+        reclaim();
+        m_reclaim_at = 2 * m_retired.size();
+        if (m_reclaim_at < k_reclaim_threshold)
+          m_reclaim_at = k_reclaim_threshold;
+      }
+    }
+
+    //=========================================================================
+    // Advance the global epoch if all active readers have announced the
+    // current one, and delete the nodes retired at least two epochs ago.
+    // The caller holds m_retired_mutex.
+    //=========================================================================
+    void reclaim() {
+      std::uint64_t epoch = m_epoch.load();
+      bool advance = true;
+      for (std::uint64_t i = 0; i < k_max_threads && advance; ++i) {
+        std::uint64_t e = m_slots[i].m_epoch.load();
+        if (e != k_inactive && e != epoch)
+          advance = false;
+      }
+      if (advance) m_epoch.store(++epoch);
+      std::uint64_t n_kept = 0;
+      for (std::uint64_t i = 0; i < m_retired.size(); ++i) {
+        if (m_retired[i].first + 2 <= epoch)
+          delete m_retired[i].second;
+        else m_retired[n_kept++] = m_retired[i];
+      }
+      m_retired.resize(n_kept);
+    }
+
+    //=========================================================================
+    // Delete all nodes in the subtree rooted in `x'.
+    //=========================================================================
+    static void delete_subtree(node_type *x) {
+      if (x) {
+        delete_subtree(x->m_left.load());
+        delete_subtree(x->m_right.load());
+        delete x;
+      }
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item with lo <= key < hi in the
+    // subtree rooted in `x'. Recursion is only used for left children.
+    //=========================================================================
+    template<typename function_type>
+    static void for_each_in_range(
+        const node_type *x,
+        const key_type &lo,
+        const key_type &hi,
+        function_type &fn) {
+      while (x) {
+        if (x->m_key < lo) x = x->m_right.load(std::memory_order_acquire);
+        else if (!(x->m_key < hi))
+          x = x->m_left.load(std::memory_order_acquire);
+        else {
+          for_each_in_range(x->m_left.load(std::memory_order_acquire),
+              lo, hi, fn);
+          fn(x->m_key, x->m_value);
+          x = x->m_right.load(std::memory_order_acquire);
+        }
+      }
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item in the subtree rooted in `x'.
+    //=========================================================================
+    template<typename function_type>
+    static void for_each(const node_type *x, function_type &fn) {
+      while (x) {
+        for_each(x->m_left.load(std::memory_order_acquire), fn);
+        fn(x->m_key, x->m_value);
+        x = x->m_right.load(std::memory_order_acquire);
+      }
+    }
+
+    //=========================================================================
+    // Check the order of keys and the ranks in the subtree rooted in `x',
+    // count its nodes. `prev' is the previous node in inorder.
+    //=========================================================================
+    static void check(
+        const node_type *x,
+        const node_type *&prev,
+        std::uint64_t &count) {
+      if (!x) return;
+      const node_type *left = x->m_left.load();
+      const node_type *right = x->m_right.load();
+      if ((left && left->m_rank >= x->m_rank) ||
+          (right && right->m_rank > x->m_rank)) {
+        std::cerr << "\nError: check_ranks failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+      check(left, prev, count);
+      if (prev && !(prev->m_key < x->m_key)) {
+        std::cerr << "\nError: check_keys failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+      prev = x;
+      ++count;
+      check(right, prev, count);
+    }
+};
+
+#endif  // __CONCURRENT_ZIP_TREE_HPP_INCLUDED
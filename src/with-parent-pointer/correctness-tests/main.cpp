@@ -1,15 +1,26 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <cstddef>
 #include <algorithm>
 #include <map>
+#include <functional>
 #include <sstream>
 #include <limits>
 #include <vector>
+#include <memory>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <random>
 #include <ctime>
 #include <unistd.h>
 
 #include "zip_tree.hpp"
+#include "compact_zip_tree.hpp"
+#include "concurrent_zip_tree.hpp"
+#include "mapped_zip_tree.hpp"
+#include "blocked_zip_tree.hpp"
 
 
 std::uint64_t random_int(std::uint64_t p, std::uint64_t r) {
@@ -253,4 +264,1720 @@ int main() {
 
     fprintf(stderr, "\n");
   }
+
+  // Check the tree with the plain heap allocator, and
+  // check that a cleared tree (whose pooled memory was
+  // released at once) can be used again.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type, heap_allocator> heap_tree_type;
+    typedef zip_tree<key_type, value_type, pool_allocator> pool_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      heap_tree_type *heap_tree = new heap_tree_type();
+      pool_tree_type *pool_tree = new pool_tree_type();
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < 200; ++j) {
+        if (j == 100) {
+          pool_tree->clear();
+          s.clear();
+          for (std::uint64_t key = 0; key <= 10; ++key)
+            heap_tree->erase(key);
+        }
+        std::uint64_t op = random_int(0, 1);
+        std::uint64_t key = random_int(0, 10);
+        if (op == 0) {
+          std::string value = random_string();
+          bool res1 = heap_tree->insert(key, value);
+          bool res2 = pool_tree->insert(key, value);
+          bool res = s.insert(std::make_pair(key, value)).second;
+          if (res1 != res || res2 != res) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else {
+          bool res1 = heap_tree->erase(key);
+          bool res2 = pool_tree->erase(key);
+          bool res = (s.erase(key) > 0);
+          if (res1 != res || res2 != res) {
+            fprintf(stderr, "\nError: wrong erase result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        for (std::uint64_t key2 = 0; key2 <= 10; ++key2) {
+          std::pair<bool, value_type> p1 = heap_tree->search(key2);
+          std::pair<bool, value_type> p2 = pool_tree->search(key2);
+          std::map<key_type, value_type>::iterator it = s.find(key2);
+          bool found = (it != s.end());
+          if (p1.first != found || p2.first != found ||
+              (found && (p1.second != it->second ||
+                         p2.second != it->second))) {
+            fprintf(stderr, "\nError: search failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        heap_tree->check_correctness();
+        pool_tree->check_correctness();
+      }
+
+      delete heap_tree;
+      delete pool_tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check the compact (32-bit index) variant against std::map.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef compact_zip_tree<key_type, value_type> zip_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type();
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::uint64_t op = random_int(0, 2);
+        std::uint64_t key = random_int(0, 10);
+        if (op == 0) {
+          std::string value = random_string();
+          bool res = tree->insert(key, value);
+          if (res != s.insert(std::make_pair(key, value)).second) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op == 1) {
+          bool res = tree->erase(key);
+          if (res != (s.erase(key) > 0)) {
+            fprintf(stderr, "\nError: wrong erase result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else {
+          std::pair<bool, value_type> p = tree->search(key);
+          std::map<key_type, value_type>::iterator it = s.find(key);
+          if (p.first != (it != s.end()) ||
+              (p.first && p.second != it->second)) {
+            fprintf(stderr, "\nError: search failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+
+        {
+          std::map<key_type, value_type>::iterator it2 = s.begin();
+          for (zip_tree_type::iterator it = tree->begin(); it != tree->end(); ++it) {
+            if (it2 == s.end() ||
+                it.key() != it2->first ||
+                it.value() != it2->second) {
+              fprintf(stderr, "\nError: zip tree iterators failed\n");
+              std::exit(EXIT_FAILURE);
+            }
+            ++it2;
+          }
+          if (it2 != s.end()) {
+            fprintf(stderr, "\nError: zip tree iterators failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+
+        tree->check_correctness();
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check the tree with ranks derived from hashes of keys.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type,
+            pool_allocator, hashed_ranks> zip_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type(i);
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::uint64_t op = random_int(0, 2);
+        std::uint64_t key = random_int(0, 10);
+        if (op == 0) {
+          std::string value = random_string();
+          bool res = tree->insert(key, value);
+          if (res != s.insert(std::make_pair(key, value)).second) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op == 1) {
+          bool res = tree->erase(key);
+          if (res != (s.erase(key) > 0)) {
+            fprintf(stderr, "\nError: wrong erase result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else {
+          std::pair<bool, value_type> p = tree->search(key);
+          std::map<key_type, value_type>::iterator it = s.find(key);
+          if (p.first != (it != s.end()) ||
+              (p.first && p.second != it->second)) {
+            fprintf(stderr, "\nError: search failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+
+        {
+          std::map<key_type, value_type>::iterator it2 = s.begin();
+          for (zip_tree_type::iterator it = tree->begin(); it != tree->end(); ++it) {
+            if (it2 == s.end() ||
+                it.key() != it2->first ||
+                it.value() != it2->second) {
+              fprintf(stderr, "\nError: zip tree iterators failed\n");
+              std::exit(EXIT_FAILURE);
+            }
+            ++it2;
+          }
+          if (it2 != s.end()) {
+            fprintf(stderr, "\nError: zip tree iterators failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+
+        tree->check_correctness();
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check batched search against std::map.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type();
+      std::map<key_type, value_type> s;
+      std::uint64_t n_items = random_int(0, 50);
+      for (std::uint64_t j = 0; j < n_items; ++j) {
+        std::uint64_t key = random_int(0, 100);
+        std::string value = random_string();
+        tree->insert(key, value);
+        s.insert(std::make_pair(key, value));
+      }
+
+      std::uint64_t n_keys = random_int(0, 100);
+      std::vector<key_type> keys(n_keys);
+      std::vector<const value_type*> results(n_keys);
+      for (std::uint64_t j = 0; j < n_keys; ++j)
+        keys[j] = random_int(0, 100);
+      tree->search_batch(keys.data(), n_keys, results.data());
+      for (std::uint64_t j = 0; j < n_keys; ++j) {
+        std::map<key_type, value_type>::iterator it = s.find(keys[j]);
+        if ((it == s.end()) != (results[j] == nullptr) ||
+            (results[j] && *results[j] != it->second)) {
+          fprintf(stderr, "\nError: search_batch failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check building the tree from a sorted sequence.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+    typedef std::pair<key_type, value_type> pair_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      // Sorted input with duplicate keys.
+      std::uint64_t n_items = random_int(0, 50);
+      std::vector<pair_type> v;
+      for (std::uint64_t j = 0; j < n_items; ++j)
+        v.push_back(std::make_pair(random_int(0, 40), random_string()));
+      std::stable_sort(v.begin(), v.end(),
+          [](const pair_type &a, const pair_type &b) {
+            return a.first < b.first;
+          });
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < v.size(); ++j)
+        s.insert(v[j]);
+
+      zip_tree_type *tree = new zip_tree_type();
+      tree->insert(1000, "x");
+      tree->build_from_sorted(v.begin(), v.end());
+      tree->check_correctness();
+
+      // The tree has to remain usable.
+      for (std::uint64_t j = 0; j < 20; ++j) {
+        std::uint64_t key = random_int(0, 40);
+        if (random_int(0, 1)) {
+          std::string value = random_string();
+          if (tree->insert(key, value) !=
+              s.insert(std::make_pair(key, value)).second) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (tree->erase(key) != (s.erase(key) > 0)) {
+          fprintf(stderr, "\nError: wrong erase result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        tree->check_correctness();
+      }
+
+      std::map<key_type, value_type>::iterator it2 = s.begin();
+      for (zip_tree_type::iterator it = tree->begin(); it != tree->end(); ++it) {
+        if (it2 == s.end() ||
+            it.key() != it2->first ||
+            it.value() != it2->second) {
+          fprintf(stderr, "\nError: build_from_sorted failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+        ++it2;
+      }
+      if (it2 != s.end()) {
+        fprintf(stderr, "\nError: build_from_sorted failed\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check the size-augmented tree, select() and rank().
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type,
+            pool_allocator, random_ranks, true> zip_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type();
+      std::map<key_type, value_type> s;
+      if (random_int(0, 1)) {
+        std::vector<std::pair<key_type, value_type> > v;
+        for (std::uint64_t j = 0; j < 20; ++j)
+          v.push_back(std::make_pair(2 * j, random_string()));
+        tree->build_from_sorted(v.begin(), v.end());
+        s.insert(v.begin(), v.end());
+      }
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::uint64_t key = random_int(0, 40);
+        if (random_int(0, 1)) {
+          std::string value = random_string();
+          if (tree->insert(key, value) !=
+              s.insert(std::make_pair(key, value)).second) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (tree->erase(key) != (s.erase(key) > 0)) {
+          fprintf(stderr, "\nError: wrong erase result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        tree->check_correctness();
+
+        if (tree->size() != s.size()) {
+          fprintf(stderr, "\nError: wrong size\n");
+          std::exit(EXIT_FAILURE);
+        }
+        std::uint64_t k = 0;
+        for (std::map<key_type, value_type>::iterator it = s.begin();
+            it != s.end(); ++it, ++k) {
+          zip_tree_type::iterator it2 = tree->select(k);
+          if (it2 == tree->end() || it2.key() != it->first) {
+            fprintf(stderr, "\nError: select failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        if (tree->select(k) != tree->end()) {
+          fprintf(stderr, "\nError: select failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+        for (std::uint64_t key2 = 0; key2 <= 41; ++key2) {
+          std::uint64_t r = std::distance(s.begin(), s.lower_bound(key2));
+          if (tree->rank(key2) != r) {
+            fprintf(stderr, "\nError: rank failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check range queries (on a size-augmented tree) against std::map.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type,
+            pool_allocator, random_ranks, true> zip_tree_type;
+    typedef std::map<key_type, value_type>::iterator map_iterator;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type();
+      std::map<key_type, value_type> s;
+      std::uint64_t n_items = random_int(0, 30);
+      for (std::uint64_t j = 0; j < n_items; ++j) {
+        std::uint64_t key = random_int(0, 40);
+        std::string value = random_string();
+        tree->insert(key, value);
+        s.insert(std::make_pair(key, value));
+      }
+
+      for (std::uint64_t j = 0; j < 20; ++j) {
+        std::uint64_t lo = random_int(0, 41);
+        std::uint64_t hi = random_int(0, 41);
+
+        // Bounds.
+        zip_tree_type::iterator it = tree->lower_bound(lo);
+        map_iterator it2 = s.lower_bound(lo);
+        if ((it == tree->end()) != (it2 == s.end()) ||
+            (it2 != s.end() && it.key() != it2->first)) {
+          fprintf(stderr, "\nError: lower_bound failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+        it = tree->upper_bound(lo);
+        it2 = s.upper_bound(lo);
+        if ((it == tree->end()) != (it2 == s.end()) ||
+            (it2 != s.end() && it.key() != it2->first)) {
+          fprintf(stderr, "\nError: upper_bound failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+        std::pair<zip_tree_type::iterator, zip_tree_type::iterator> r =
+          tree->equal_range(lo);
+        std::pair<map_iterator, map_iterator> r2 = s.equal_range(lo);
+        if (std::distance(r2.first, r2.second) == 1) {
+          if (r.first == tree->end() || r.first.key() != lo ||
+              ++r.first != r.second) {
+            fprintf(stderr, "\nError: equal_range failed\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (r.first != r.second) {
+          fprintf(stderr, "\nError: equal_range failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+
+        // Scan of [lo, hi) with iterators and with the visitor.
+        std::vector<std::pair<key_type, value_type> > v, v1, v2;
+        for (it2 = s.lower_bound(lo); it2 != s.end() && it2->first < hi; ++it2)
+          v.push_back(*it2);
+        for (it = tree->lower_bound(lo); it != tree->end() && it.key() < hi; ++it)
+          v1.push_back(std::make_pair(it.key(), it.value()));
+        tree->for_each_in_range(lo, hi,
+            [&v2](const key_type &key, value_type &value) {
+              v2.push_back(std::make_pair(key, value));
+            });
+        if (v1 != v || v2 != v || tree->count_in_range(lo, hi) != v.size()) {
+          fprintf(stderr, "\nError: range scan failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+
+        // The same scan through const iterators.
+        const zip_tree_type &ctree = *tree;
+        std::vector<std::pair<key_type, value_type> > v3;
+        zip_tree_type::const_iterator cit = ctree.lower_bound(lo);
+        for (; cit != ctree.end() && cit.key() < hi; ++cit)
+          v3.push_back(std::make_pair(cit.key(), cit.value()));
+        cit = ctree.upper_bound(lo);
+        it2 = s.upper_bound(lo);
+        if (v3 != v || (cit == ctree.end()) != (it2 == s.end()) ||
+            (it2 != s.end() && cit.key() != it2->first) ||
+            (ctree.find(lo) != ctree.end()) != (s.count(lo) > 0)) {
+          fprintf(stderr, "\nError: const iterators failed\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      delete tree;
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check split() and join() against std::map. The halves are
+  // modified and destroyed in random order, and joined with trees
+  // using other pools, to exercise moving nodes between the pools.
+  // Finally, the halves of a large tree are modified concurrently.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+    typedef zip_tree<key_type, value_type,
+            heap_allocator, random_ranks, true> augmented_tree_type;
+    typedef std::map<key_type, value_type> map_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type *tree = new zip_tree_type();
+      augmented_tree_type *atree = new augmented_tree_type();
+      map_type s;
+      std::uint64_t n_items = random_int(0, 30);
+      for (std::uint64_t j = 0; j < n_items; ++j) {
+        std::uint64_t key = random_int(0, 40);
+        std::string value = random_string();
+        tree->insert(key, value);
+        atree->insert(key, value);
+        s.insert(std::make_pair(key, value));
+      }
+
+      // Split.
+      std::uint64_t key = random_int(0, 41);
+      std::pair<zip_tree_type, zip_tree_type> p = tree->split(key);
+      std::pair<augmented_tree_type, augmented_tree_type> ap =
+        atree->split(key);
+      map_type sl(s.begin(), s.lower_bound(key));
+      map_type sr(s.lower_bound(key), s.end());
+      if (random_int(0, 1)) {
+        delete tree;
+        tree = nullptr;
+      }
+      delete atree;
+
+      // Modify both halves.
+      for (std::uint64_t j = 0; j < 10; ++j) {
+        std::uint64_t k = random_int(0, 40);
+        std::string value = random_string();
+        zip_tree_type &t = (k < key ? p.first : p.second);
+        augmented_tree_type &at = (k < key ? ap.first : ap.second);
+        map_type &m = (k < key ? sl : sr);
+        if (random_int(0, 1)) {
+          t.insert(k, value);
+          at.insert(k, value);
+          m.insert(std::make_pair(k, value));
+        } else {
+          t.erase(k);
+          at.erase(k);
+          m.erase(k);
+        }
+      }
+      p.first.check_correctness();
+      p.second.check_correctness();
+      ap.first.check_correctness();
+      ap.second.check_correctness();
+      if (p.first.size() != sl.size() || p.second.size() != sr.size() ||
+          ap.first.size() != sl.size() || ap.second.size() != sr.size() ||
+          (tree && tree->size() != 0)) {
+        fprintf(stderr, "\nError: wrong size after split\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      // Join the right half with a tree of larger keys
+      // (using its own pool), then join both halves back.
+      zip_tree_type extra;
+      for (std::uint64_t j = 0; j < 5; ++j) {
+        std::uint64_t k = random_int(41, 60);
+        std::string value = random_string();
+        extra.insert(k, value);
+        sr.insert(std::make_pair(k, value));
+      }
+      zip_tree_type right = zip_tree_type::join(
+          std::move(p.second), std::move(extra));
+      zip_tree_type joined = zip_tree_type::join(
+          std::move(p.first), std::move(right));
+      augmented_tree_type ajoined = augmented_tree_type::join(
+          std::move(ap.first), std::move(ap.second));
+      delete tree;
+      joined.check_correctness();
+      ajoined.check_correctness();
+      if (joined.size() != sl.size() + sr.size() || p.first.size() != 0 ||
+          p.second.size() != 0 || extra.size() != 0 || right.size() != 0) {
+        fprintf(stderr, "\nError: wrong size after join\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      // Compare the contents. Keys of the augmented tree
+      // are compared using select().
+      sl.insert(sr.begin(), sr.end());
+      zip_tree_type::iterator it = joined.begin();
+      for (map_type::iterator it2 = sl.begin(); it2 != sl.end(); ++it2, ++it) {
+        if (it == joined.end() || it.key() != it2->first ||
+            it.value() != it2->second) {
+          fprintf(stderr, "\nError: wrong contents after join\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+      if (ajoined.size() != (std::uint64_t)std::distance(
+            sl.begin(), sl.lower_bound(41))) {
+        fprintf(stderr, "\nError: wrong size after join\n");
+        std::exit(EXIT_FAILURE);
+      }
+      for (std::uint64_t j = 0; j < ajoined.size(); ++j) {
+        augmented_tree_type::iterator it3 = ajoined.select(j);
+        if (it3 == ajoined.end() || sl.find(it3.key()) == sl.end() ||
+            (j > 0 && !(ajoined.select(j - 1).key() < it3.key()))) {
+          fprintf(stderr, "\nError: wrong contents after join\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      // The joined tree remains usable.
+      for (std::uint64_t j = 0; j < 10; ++j) {
+        std::uint64_t k = random_int(0, 60);
+        if (random_int(0, 1)) joined.insert(k, random_string());
+        else joined.erase(k);
+      }
+      joined.check_correctness();
+    }
+
+    zip_tree_type tree;
+    map_type s;
+    for (std::uint64_t j = 0; j < 200000; ++j) {
+      std::uint64_t key = random_int(0, 1000000);
+      std::string value = random_string();
+      tree.insert(key, value);
+      s.insert(std::make_pair(key, value));
+    }
+    std::uint64_t key = random_int(0, 1000000);
+    std::pair<zip_tree_type, zip_tree_type> p = tree.split(key);
+    map_type sl(s.begin(), s.lower_bound(key));
+    map_type sr(s.lower_bound(key), s.end());
+    auto modify = [](zip_tree_type *t, map_type *m, std::uint64_t lo,
+        std::uint64_t hi, std::uint64_t seed) {
+      std::mt19937_64 gen(seed);
+      for (std::uint64_t j = 0; lo < hi && j < 200000; ++j) {
+        std::uint64_t k = lo + gen() % (hi - lo);
+        if (gen() % 2) {
+          std::string value(1 + gen() % 20, 'a' + gen() % 26);
+          t->insert(k, value);
+          m->insert(std::make_pair(k, value));
+        } else {
+          t->erase(k);
+          m->erase(k);
+        }
+      }
+    };
+    std::thread t(modify, &p.first, &sl, 0, key, random_int(0, 1000000));
+    modify(&p.second, &sr, key, 1000001, random_int(0, 1000000));
+    t.join();
+    p.first.check_correctness();
+    p.second.check_correctness();
+    if (p.first.size() != sl.size() || p.second.size() != sr.size()) {
+      fprintf(stderr, "\nError: wrong size after concurrent updates\n");
+      std::exit(EXIT_FAILURE);
+    }
+    sl.insert(sr.begin(), sr.end());
+    zip_tree_type joined = zip_tree_type::join(
+        std::move(p.first), std::move(p.second));
+    zip_tree_type::iterator it = joined.begin();
+    for (map_type::iterator it2 = sl.begin(); it2 != sl.end(); ++it2, ++it) {
+      if (it.key() != it2->first || it.value() != it2->second) {
+        fprintf(stderr, "\nError: wrong contents after concurrent updates\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check union_with(), intersect_with() and difference_with()
+  // against std::map, on small trees and (to exercise the threads)
+  // on large size-augmented trees.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+    typedef zip_tree<key_type, value_type,
+            pool_allocator, random_ranks, true> augmented_tree_type;
+    typedef std::map<key_type, value_type> map_type;
+
+    static const std::uint64_t n_tests = 20000;
+    static const std::uint64_t n_large_tests = 10;
+    for (std::uint64_t i = 0; i < n_tests + n_large_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r",
+            100.L * (i + 1) / (n_tests + n_large_tests));
+
+      bool large = (i >= n_tests);
+      std::uint64_t max_key = (large ? 300000 : 40);
+      zip_tree_type tree, other;
+      augmented_tree_type atree, aother;
+      map_type s, s2;
+      for (std::uint64_t t = 0; t < 2; ++t) {
+        std::uint64_t n_items = (large ? 200000 : random_int(0, 30));
+        for (std::uint64_t j = 0; j < n_items; ++j) {
+          std::uint64_t key = random_int(0, max_key);
+          std::string value = random_string();
+          if (t == 0) {
+            if (large) atree.insert(key, value);
+            else tree.insert(key, value);
+            s.insert(std::make_pair(key, value));
+          } else {
+            if (large) aother.insert(key, value);
+            else other.insert(key, value);
+            s2.insert(std::make_pair(key, value));
+          }
+        }
+      }
+
+      std::uint64_t op = random_int(0, 2);
+      map_type result;
+      if (op == 0) {
+        result = s;
+        result.insert(s2.begin(), s2.end());
+        if (large) atree.union_with(std::move(aother), 4);
+        else tree.union_with(std::move(other));
+      } else if (op == 1) {
+        for (map_type::iterator it = s.begin(); it != s.end(); ++it)
+          if (s2.find(it->first) != s2.end())
+            result.insert(*it);
+        if (large) atree.intersect_with(std::move(aother), 4);
+        else tree.intersect_with(std::move(other));
+      } else {
+        for (map_type::iterator it = s.begin(); it != s.end(); ++it)
+          if (s2.find(it->first) == s2.end())
+            result.insert(*it);
+        if (large) atree.difference_with(std::move(aother), 4);
+        else tree.difference_with(std::move(other));
+      }
+
+      std::vector<std::pair<key_type, value_type> > v;
+      if (large) {
+        atree.check_correctness();
+        for (augmented_tree_type::iterator it = atree.begin();
+            it != atree.end(); ++it)
+          v.push_back(std::make_pair(it.key(), it.value()));
+      } else {
+        tree.check_correctness();
+        for (zip_tree_type::iterator it = tree.begin();
+            it != tree.end(); ++it)
+          v.push_back(std::make_pair(it.key(), it.value()));
+      }
+      std::uint64_t size = (large ? atree.size() : tree.size());
+      std::uint64_t other_size = (large ? aother.size() : other.size());
+      if (size != result.size() || other_size != 0 || v !=
+          std::vector<std::pair<key_type, value_type> >(
+            result.begin(), result.end())) {
+        fprintf(stderr, "\nError: set operation failed\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      // The result remains usable.
+      for (std::uint64_t j = 0; j < 10; ++j) {
+        std::uint64_t k = random_int(0, max_key);
+        if (random_int(0, 1)) tree.insert(k, random_string());
+        else tree.erase(k);
+      }
+      tree.check_correctness();
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check insert_batch() against std::map, on small trees and
+  // (to exercise the threads) on large trees.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+    typedef std::pair<key_type, value_type> pair_type;
+
+    static const std::uint64_t n_tests = 20000;
+    static const std::uint64_t n_large_tests = 10;
+    for (std::uint64_t i = 0; i < n_tests + n_large_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r",
+            100.L * (i + 1) / (n_tests + n_large_tests));
+
+      bool large = (i >= n_tests);
+      std::uint64_t max_key = (large ? 300000 : 40);
+      zip_tree_type tree;
+      std::map<key_type, value_type> s;
+      std::uint64_t n_items = (large ? 100000 : random_int(0, 30));
+      for (std::uint64_t j = 0; j < n_items; ++j) {
+        std::uint64_t key = random_int(0, max_key);
+        std::string value = random_string();
+        tree.insert(key, value);
+        s.insert(std::make_pair(key, value));
+      }
+      std::uint64_t n_batch = (large ? 200000 : random_int(0, 30));
+      std::vector<pair_type> batch;
+      for (std::uint64_t j = 0; j < n_batch; ++j) {
+        batch.push_back(std::make_pair(random_int(0, max_key),
+              random_string()));
+        s.insert(batch.back());
+      }
+      tree.insert_batch(batch.data(), batch.size(), (large ? 4 : 0));
+      tree.check_correctness();
+
+      std::vector<pair_type> v;
+      for (zip_tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      if (tree.size() != s.size() ||
+          v != std::vector<pair_type>(s.begin(), s.end())) {
+        fprintf(stderr, "\nError: insert_batch failed\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check relayout() against std::map, interleaved with updates, on
+  // a size-augmented tree, on the halves of a split tree (each using
+  // its own pool) and on a tree using the plain heap allocator.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef zip_tree<key_type, value_type,
+            pool_allocator, random_ranks, true> pool_tree_type;
+    typedef zip_tree<key_type, value_type, heap_allocator> heap_tree_type;
+
+    static const std::uint64_t n_tests = 5000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      pool_tree_type pool_tree;
+      heap_tree_type heap_tree;
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < 200; ++j) {
+        std::uint64_t op = random_int(0, 9);
+        std::uint64_t key = random_int(0, 60);
+        if (op < 5) {
+          std::string value = random_string();
+          bool res1 = pool_tree.insert(key, value);
+          bool res2 = heap_tree.insert(key, value);
+          bool res = s.insert(std::make_pair(key, value)).second;
+          if (res1 != res || res2 != res) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op < 8) {
+          bool res1 = pool_tree.erase(key);
+          bool res2 = heap_tree.erase(key);
+          bool res = (s.erase(key) > 0);
+          if (res1 != res || res2 != res) {
+            fprintf(stderr, "\nError: wrong erase result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op == 8) {
+          pool_tree.relayout();
+          heap_tree.relayout();
+        } else {
+          std::pair<pool_tree_type, pool_tree_type> halves =
+            pool_tree.split(key);
+          halves.first.relayout();
+          halves.first.check_correctness();
+          pool_tree = pool_tree_type::join(
+              std::move(halves.first), std::move(halves.second));
+        }
+        pool_tree.check_correctness();
+        heap_tree.check_correctness();
+
+        if (pool_tree.size() != s.size()) {
+          fprintf(stderr, "\nError: wrong size\n");
+          std::exit(EXIT_FAILURE);
+        }
+        pool_tree_type::iterator it1 = pool_tree.begin();
+        heap_tree_type::iterator it2 = heap_tree.begin();
+        for (std::map<key_type, value_type>::iterator it = s.begin();
+            it != s.end(); ++it, ++it1, ++it2) {
+          if (it1 == pool_tree.end() || it2 == heap_tree.end() ||
+              it1.key() != it->first || it1.value() != it->second ||
+              it2.key() != it->first || it2.value() != it->second) {
+            fprintf(stderr, "\nError: wrong contents\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        if (it1 != pool_tree.end() || it2 != heap_tree.end()) {
+          fprintf(stderr, "\nError: wrong contents\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check random sequences of operations on concurrent_zip_tree
+  // (from a single thread) and compare the result to std::map.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef concurrent_zip_tree<key_type, value_type> zip_tree_type;
+
+    static const std::uint64_t n_tests = 20000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      std::map<key_type, value_type> s;
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::uint64_t op = random_int(0, 2);
+        std::uint64_t key = random_int(0, 20);
+        if (op == 0) {
+          std::string value = random_string();
+          bool res = tree.insert(key, value);
+          if (res != s.insert(std::make_pair(key, value)).second) {
+            fprintf(stderr, "\nError: wrong insertion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else if (op == 1) {
+          bool res = tree.erase(key);
+          if (res != (s.erase(key) > 0)) {
+            fprintf(stderr, "\nError: wrong deletion result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        } else {
+          std::pair<bool, value_type> res = tree.search(key);
+          std::map<key_type, value_type>::iterator it = s.find(key);
+          if (res.first != (it != s.end()) ||
+              (res.first && res.second != it->second)) {
+            fprintf(stderr, "\nError: wrong search result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        tree.check_correctness();
+      }
+      std::vector<std::pair<key_type, value_type> > v;
+      tree.for_each([&v](const key_type &key, const value_type &value) {
+        v.push_back(std::make_pair(key, value));
+      });
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check concurrent_zip_tree with two writers and two readers.
+  // Even keys are inserted beforehand and never deleted, so the
+  // readers must always find them. Each writer inserts and deletes
+  // its own set of odd keys, and the final contents are compared
+  // to std::map.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef concurrent_zip_tree<key_type, value_type> zip_tree_type;
+    typedef std::map<key_type, value_type> map_type;
+
+    static const std::uint64_t n_tests = 20;
+    static const std::uint64_t n_keys = 2000;
+    static const std::uint64_t n_writer_ops = 100000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      map_type s;
+      for (std::uint64_t key = 0; key < n_keys; key += 2) {
+        std::stringstream ss;
+        ss << key;
+        tree.insert(key, ss.str());
+        s[key] = ss.str();
+      }
+
+      std::atomic<bool> done(false);
+      std::atomic<bool> failed(false);
+      map_type writer_maps[2];
+      std::vector<std::uint64_t> seeds;
+      for (std::uint64_t t = 0; t < 4; ++t)
+        seeds.push_back(random_int(0, 1000000000));
+      std::vector<std::thread> threads;
+      for (std::uint64_t t = 0; t < 2; ++t) {
+        threads.push_back(std::thread([&, t]() {
+          random_generator random(seeds[t]);
+          for (std::uint64_t j = 0; j < n_writer_ops; ++j) {
+            key_type key = (random() % (n_keys / 4)) * 4 + 1 + 2 * t;
+            std::stringstream ss;
+            ss << random();
+            if (random() % 2) {
+              if (tree.insert(key, ss.str()))
+                writer_maps[t][key] = ss.str();
+            } else if (tree.erase(key))
+              writer_maps[t].erase(key);
+          }
+        }));
+      }
+      for (std::uint64_t t = 2; t < 4; ++t) {
+        threads.push_back(std::thread([&, t]() {
+          random_generator random(seeds[t]);
+          while (!done.load()) {
+            key_type key = (random() % (n_keys / 2)) * 2;
+            std::stringstream ss;
+            ss << key;
+            std::pair<bool, value_type> res = tree.search(key);
+            if (!res.first || res.second != ss.str())
+              failed.store(true);
+            key_type lo = (random() % (n_keys / 2)) * 2;
+            key_type expected = lo;
+            tree.for_each_in_range(lo, lo + 40,
+                [&](const key_type &k, const value_type &) {
+                  if (k % 2 == 0) {
+                    if (k != expected) failed.store(true);
+                    expected += 2;
+                  }
+                });
+            if (expected != std::min(lo + 40, n_keys))
+              failed.store(true);
+          }
+        }));
+      }
+      threads[0].join();
+      threads[1].join();
+      done.store(true);
+      threads[2].join();
+      threads[3].join();
+
+      if (failed.load()) {
+        fprintf(stderr, "\nError: reader saw an inconsistent tree\n");
+        std::exit(EXIT_FAILURE);
+      }
+      tree.check_correctness();
+      s.insert(writer_maps[0].begin(), writer_maps[0].end());
+      s.insert(writer_maps[1].begin(), writer_maps[1].end());
+      std::vector<std::pair<key_type, value_type> > v;
+      tree.for_each([&v](const key_type &key, const value_type &value) {
+        v.push_back(std::make_pair(key, value));
+      });
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check save() and mapped_zip_tree on random trees
+  // and compare the result to std::map.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::uint64_t value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+    typedef mapped_zip_tree<key_type, value_type> mapped_tree_type;
+
+    char path[] = "/tmp/zip_tree_image_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+      fprintf(stderr, "\nError: cannot create a temporary file\n");
+      std::exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      std::map<key_type, value_type> s;
+      std::uint64_t n = random_int(0, 200);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n; ++j) {
+        key_type key = random_int(0, max_key);
+        value_type value = random_int(0, 1000000);
+        tree.insert(key, value);
+        s.insert(std::make_pair(key, value));
+      }
+      if (!tree.save(path)) {
+        fprintf(stderr, "\nError: save failed\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      mapped_tree_type mapped(path);
+      if (!mapped.is_open() || mapped.size() != s.size()) {
+        fprintf(stderr, "\nError: wrong mapped tree\n");
+        std::exit(EXIT_FAILURE);
+      }
+      mapped.check_correctness();
+
+      // Check iteration.
+      std::vector<std::pair<key_type, value_type> > v;
+      for (mapped_tree_type::iterator it = mapped.begin();
+          it != mapped.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      // Check queries.
+      for (std::uint64_t j = 0; j < 50; ++j) {
+        key_type key = random_int(0, max_key + 1);
+        std::pair<bool, value_type> res = mapped.search(key);
+        std::map<key_type, value_type>::iterator it = s.find(key);
+        if (res.first != (it != s.end()) ||
+            (res.first && res.second != it->second)) {
+          fprintf(stderr, "\nError: wrong search result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        mapped_tree_type::iterator lb = mapped.lower_bound(key);
+        it = s.lower_bound(key);
+        if ((lb == mapped.end()) != (it == s.end()) ||
+            (it != s.end() && lb.key() != it->first)) {
+          fprintf(stderr, "\nError: wrong lower_bound result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        key_type hi = key + random_int(0, 100);
+        std::vector<std::pair<key_type, value_type> > r;
+        mapped.for_each_in_range(key, hi,
+            [&r](const key_type &k, const value_type &val) {
+          r.push_back(std::make_pair(k, val));
+        });
+        if (r != std::vector<std::pair<key_type, value_type> >(
+              s.lower_bound(key), s.lower_bound(hi))) {
+          fprintf(stderr, "\nError: wrong range result\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      // An image of different types must be rejected.
+      mapped_zip_tree<std::uint32_t, value_type> wrong(path);
+      if (wrong.is_open()) {
+        fprintf(stderr, "\nError: wrong image accepted\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      // The image of a tree with another comparator ordering
+      // the keys by "<" is searched in the same way.
+      zip_tree<key_type, value_type, pool_allocator, random_ranks,
+        false, no_stats, three_way_less> three_way_tree;
+      for (std::map<key_type, value_type>::iterator it = s.begin();
+          it != s.end(); ++it)
+        three_way_tree.insert(it->first, it->second);
+      if (!three_way_tree.save(path)) {
+        fprintf(stderr, "\nError: save failed\n");
+        std::exit(EXIT_FAILURE);
+      }
+      mapped_tree_type three_way_mapped(path);
+      if (!three_way_mapped.is_open() ||
+          three_way_mapped.size() != s.size()) {
+        fprintf(stderr, "\nError: wrong mapped tree\n");
+        std::exit(EXIT_FAILURE);
+      }
+      three_way_mapped.check_correctness();
+      for (std::map<key_type, value_type>::iterator it = s.begin();
+          it != s.end(); ++it) {
+        std::pair<bool, value_type> res = three_way_mapped.search(it->first);
+        if (!res.first || res.second != it->second) {
+          fprintf(stderr, "\nError: wrong search result\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      // Queries on an image with corrupted positions of children
+      // must stay inside the mapping and terminate.
+      if (!s.empty()) {
+        typedef image_node<key_type, value_type> image_node_type;
+        FILE *f = fopen(path, "r+b");
+        if (!f) {
+          fprintf(stderr, "\nError: cannot open the image\n");
+          std::exit(EXIT_FAILURE);
+        }
+        for (std::uint64_t j = 0; j < 10; ++j) {
+          std::uint32_t pos = random_int(0, 1) ?
+            random_int(0, s.size() + 1) : random_int(0, 0xffffffffu);
+          long offset = k_image_data_offset +
+            random_int(0, s.size() - 1) * sizeof(image_node_type) +
+            (random_int(0, 1) ? offsetof(image_node_type, m_left) :
+             offsetof(image_node_type, m_right));
+          if (fseek(f, offset, SEEK_SET) != 0 ||
+              fwrite(&pos, sizeof(pos), 1, f) != 1) {
+            fprintf(stderr, "\nError: cannot corrupt the image\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+        fclose(f);
+
+        mapped_tree_type corrupted(path);
+        if (!corrupted.is_open()) {
+          fprintf(stderr, "\nError: corrupted image rejected\n");
+          std::exit(EXIT_FAILURE);
+        }
+        for (mapped_tree_type::iterator it = corrupted.begin();
+            it != corrupted.end(); ++it) {}
+        for (std::uint64_t j = 0; j < 50; ++j) {
+          key_type key = random_int(0, max_key + 1);
+          corrupted.search(key);
+          for (mapped_tree_type::iterator it = corrupted.lower_bound(key);
+              it != corrupted.end(); ++it) {}
+          corrupted.for_each_in_range(key, key + random_int(0, 100),
+              [](const key_type &, const value_type &) {});
+        }
+      }
+    }
+    unlink(path);
+    fprintf(stderr, "\n");
+  }
+
+  // Check the operation statistics and the depth
+  // histogram on random sequences of operations.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::uint64_t value_type;
+    typedef zip_tree<key_type, value_type> plain_tree_type;
+    typedef zip_tree<key_type, value_type, pool_allocator,
+            random_ranks, false, operation_stats> stats_tree_type;
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      std::uint64_t seed = random_int(0, 1000000);
+      plain_tree_type plain(seed);
+      stats_tree_type tree(seed);
+      std::map<key_type, value_type> s;
+      std::uint64_t n_inserts = 0, n_inserted = 0;
+      std::uint64_t n_searches = 0, n_erased = 0;
+      std::uint64_t n_ops = random_int(0, 300);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n_ops; ++j) {
+        key_type key = random_int(0, max_key);
+        std::uint64_t op = random_int(0, 2);
+        if (op == 0) {
+          value_type value = random_int(0, 1000000);
+          plain.insert(key, value);
+          ++n_inserts;
+          if (tree.insert(key, value)) ++n_inserted;
+          s.insert(std::make_pair(key, value));
+        } else if (op == 1) {
+          plain.erase(key);
+          ++n_searches;
+          if (tree.erase(key)) ++n_erased;
+          s.erase(key);
+        } else {
+          ++n_searches;
+          if (tree.search(key).first != (s.find(key) != s.end())) {
+            fprintf(stderr, "\nError: wrong search result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+      }
+      tree.check_correctness();
+
+      // The counts of the operations.
+      const operation_stats &stats = tree.stats();
+      std::vector<std::uint64_t> ranks = stats.rank_histogram();
+      std::uint64_t n_ranks = 0;
+      for (std::uint64_t j = 0; j < ranks.size(); ++j)
+        n_ranks += ranks[j];
+      if (n_ranks != n_inserts || stats.unzips().count() != n_inserted ||
+          stats.zips().count() != n_erased ||
+          stats.searches().count() != n_searches ||
+          (ranks.size() > 0 && ranks.back() == 0)) {
+        fprintf(stderr, "\nError: wrong operation counts\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      // The statistics do not change the shape of the tree.
+      std::vector<std::uint64_t> depths = tree.depth_histogram();
+      if (depths != plain.depth_histogram()) {
+        fprintf(stderr, "\nError: wrong depth histogram\n");
+        std::exit(EXIT_FAILURE);
+      }
+
+      // Searching for every key visits the nodes at depth d
+      // exactly d + 1 times in total per node at that depth.
+      std::uint64_t n_nodes = 0, total = 0;
+      for (std::uint64_t d = 0; d < depths.size(); ++d) {
+        n_nodes += depths[d];
+        total += depths[d] * (d + 1);
+      }
+      tree.reset_stats();
+      for (std::map<key_type, value_type>::iterator it = s.begin();
+          it != s.end(); ++it)
+        tree.search(it->first);
+      double expected = (n_nodes ? (double)total / n_nodes : 0.0);
+      if (n_nodes != s.size() || stats.searches().total() != total ||
+          stats.searches().max() != depths.size() ||
+          tree.average_search_depth() != expected ||
+          stats.rank_histogram().size() != 0) {
+        fprintf(stderr, "\nError: wrong search depths\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+
+    // A large union_with() asking for several threads, which the
+    // tree with statistics runs on one, with the same result.
+    {
+      std::uint64_t seed = random_int(0, 1000000);
+      plain_tree_type plain(seed), plain_other(seed + 1);
+      stats_tree_type tree(seed), other(seed + 1);
+      std::map<key_type, value_type> s;
+      for (std::uint64_t t = 0; t < 2; ++t) {
+        for (std::uint64_t j = 0; j < 200000; ++j) {
+          key_type key = random_int(0, 1000000);
+          value_type value = random_int(0, 1000000);
+          if (t == 0) {
+            plain.insert(key, value);
+            tree.insert(key, value);
+          } else {
+            plain_other.insert(key, value);
+            other.insert(key, value);
+          }
+          s.insert(std::make_pair(key, value));
+        }
+      }
+      tree.reset_stats();
+      plain.union_with(std::move(plain_other), 4);
+      tree.union_with(std::move(other), 4);
+      tree.check_correctness();
+      std::vector<std::pair<key_type, value_type> > v;
+      for (stats_tree_type::iterator it = tree.begin();
+          it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end()) ||
+          tree.depth_histogram() != plain.depth_histogram() ||
+          tree.stats().unzips().count() == 0) {
+        fprintf(stderr, "\nError: wrong parallel union with statistics\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check insert() with rvalues, emplace() and try_emplace() with
+  // a move-only value type and compare the result to std::map. An
+  // insertion which does not take place must not move its arguments.
+  {
+    typedef std::string key_type;
+    typedef std::unique_ptr<std::uint64_t> value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      std::map<key_type, std::uint64_t> s;
+      std::uint64_t n_ops = random_int(0, 300);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n_ops; ++j) {
+        key_type key = std::to_string(random_int(0, max_key));
+        std::uint64_t value = random_int(0, 1000000);
+        std::uint64_t op = random_int(0, 3);
+        if (op == 3) {
+          tree.erase(key);
+          s.erase(key);
+          continue;
+        }
+        bool expected = (s.find(key) == s.end());
+        bool res = false, moved = false;
+        value_type ptr(new std::uint64_t(value));
+        if (op == 0) {
+          key_type k = key;
+          res = tree.insert(std::move(k), std::move(ptr));
+          moved = (k != key || !ptr);
+        } else if (op == 1) {
+          res = tree.try_emplace(key, std::move(ptr));
+          moved = !ptr;
+        } else res = tree.emplace(key, new std::uint64_t(value));
+        if (res != expected || (!res && moved)) {
+          fprintf(stderr, "\nError: wrong insertion result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        if (res) s[key] = value;
+      }
+      tree.check_correctness();
+
+      std::vector<std::pair<key_type, std::uint64_t> > v;
+      for (zip_tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), *(it.value())));
+      if (v != std::vector<std::pair<key_type, std::uint64_t> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check find(), lookup() and contains() against std::map.
+  // Values are modified through the returned pointers.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::uint64_t value_type;
+    typedef zip_tree<key_type, value_type> zip_tree_type;
+    typedef compact_zip_tree<key_type, value_type> compact_tree_type;
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      compact_tree_type ctree;
+      std::map<key_type, value_type> s;
+      std::uint64_t n = random_int(0, 200);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n; ++j) {
+        key_type key = random_int(0, max_key);
+        value_type value = random_int(0, 1000000);
+        tree.insert(key, value);
+        ctree.insert(key, value);
+        s.insert(std::make_pair(key, value));
+        if (random_int(0, 3) == 0) {
+          key = random_int(0, max_key);
+          tree.erase(key);
+          ctree.erase(key);
+          s.erase(key);
+        }
+      }
+
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        key_type key = random_int(0, max_key + 1);
+        std::map<key_type, value_type>::iterator it = s.find(key);
+        bool found = (it != s.end());
+        zip_tree_type::iterator f = tree.find(key);
+        value_type *v = tree.lookup(key);
+        const zip_tree_type &const_tree = tree;
+        if (tree.contains(key) != found || (f != tree.end()) != found ||
+            (v != 0) != found || const_tree.lookup(key) != v ||
+            (found && (f.key() != key || &(f.value()) != v ||
+                       *v != it->second))) {
+          fprintf(stderr, "\nError: wrong lookup result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        compact_tree_type::iterator cf = ctree.find(key);
+        value_type *cv = ctree.lookup(key);
+        if (ctree.contains(key) != found || (cf != ctree.end()) != found ||
+            (cv != 0) != found || (found && (cf.key() != key ||
+                &(cf.value()) != cv || *cv != it->second))) {
+          fprintf(stderr, "\nError: wrong compact tree lookup result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        if (found) {
+          ++(*v);
+          ++(*cv);
+          ++(it->second);
+
+          // The iterator returned by find() continues in order.
+          ++f;
+          ++it;
+          if ((f == tree.end()) != (it == s.end()) ||
+              (it != s.end() && f.key() != it->first)) {
+            fprintf(stderr, "\nError: wrong iterator after find\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+      }
+
+      std::vector<std::pair<key_type, value_type> > v;
+      for (zip_tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check a comparator other than std::less and the lookups by
+  // const char* in a tree of std::string keys using transparent_less.
+  {
+    typedef std::string key_type;
+    typedef std::uint64_t value_type;
+    typedef zip_tree<key_type, value_type, pool_allocator, random_ranks,
+            true, no_stats, transparent_less> zip_tree_type;
+    typedef zip_tree<std::uint64_t, value_type, pool_allocator,
+            random_ranks, false, no_stats, std::greater<std::uint64_t> >
+              greater_tree_type;
+    typedef std::map<std::uint64_t, value_type,
+            std::greater<std::uint64_t> > greater_map_type;
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree;
+      greater_tree_type gtree(random_int(0, 1000000),
+          std::greater<std::uint64_t>());
+      std::map<key_type, value_type> s;
+      greater_map_type gs;
+      std::uint64_t n = random_int(0, 200);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n; ++j) {
+        std::uint64_t key = random_int(0, max_key);
+        value_type value = random_int(0, 1000000);
+        std::string skey = std::to_string(key);
+        if (tree.insert(skey, value) !=
+            s.insert(std::make_pair(skey, value)).second ||
+            gtree.insert(key, value) !=
+            gs.insert(std::make_pair(key, value)).second) {
+          fprintf(stderr, "\nError: wrong insert result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        if (random_int(0, 3) == 0) {
+          key = random_int(0, max_key);
+          skey = std::to_string(key);
+          if (tree.erase(skey.c_str()) != (s.erase(skey) > 0) ||
+              gtree.erase(key) != (gs.erase(key) > 0)) {
+            fprintf(stderr, "\nError: wrong erase result\n");
+            std::exit(EXIT_FAILURE);
+          }
+        }
+      }
+
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::string skey = std::to_string(random_int(0, max_key + 1));
+        const char *query = skey.c_str();
+        std::map<key_type, value_type>::iterator it = s.find(skey);
+        bool found = (it != s.end());
+        value_type *v = tree.lookup(query);
+        zip_tree_type::iterator f = tree.find(query);
+        std::pair<bool, value_type> r = tree.search(query);
+        if (tree.contains(query) != found || (v != 0) != found ||
+            (f != tree.end()) != found || r.first != found ||
+            (found && (*v != it->second || f.key() != skey ||
+                       r.second != it->second))) {
+          fprintf(stderr, "\nError: wrong transparent lookup result\n");
+          std::exit(EXIT_FAILURE);
+        }
+
+        std::map<key_type, value_type>::iterator lb = s.lower_bound(skey);
+        std::map<key_type, value_type>::iterator ub = s.upper_bound(skey);
+        zip_tree_type::iterator tlb = tree.lower_bound(query);
+        zip_tree_type::iterator tub = tree.upper_bound(query);
+        std::pair<zip_tree_type::iterator, zip_tree_type::iterator> er =
+          tree.equal_range(query);
+        if ((tlb == tree.end()) != (lb == s.end()) ||
+            (lb != s.end() && tlb.key() != lb->first) ||
+            (tub == tree.end()) != (ub == s.end()) ||
+            (ub != s.end() && tub.key() != ub->first) ||
+            er.first != tlb || er.second != tub ||
+            tree.rank(query) !=
+              (std::uint64_t)std::distance(s.begin(), lb)) {
+          fprintf(stderr, "\nError: wrong transparent bounds\n");
+          std::exit(EXIT_FAILURE);
+        }
+
+        std::string shi = std::to_string(random_int(0, max_key + 1));
+        std::vector<std::pair<key_type, value_type> > in_range;
+        tree.for_each_in_range(query, shi.c_str(),
+            [&in_range](const key_type &key, value_type &value) {
+              in_range.push_back(std::make_pair(key, value));
+            });
+        std::vector<std::pair<key_type, value_type> > expected;
+        if (skey < shi)
+          expected.assign(lb, s.lower_bound(shi));
+        if (in_range != expected ||
+            tree.count_in_range(query, shi.c_str()) != expected.size()) {
+          fprintf(stderr, "\nError: wrong transparent range\n");
+          std::exit(EXIT_FAILURE);
+        }
+
+        std::uint64_t key = random_int(0, max_key + 1);
+        greater_map_type::iterator glb = gs.lower_bound(key);
+        greater_map_type::iterator gub = gs.upper_bound(key);
+        greater_tree_type::iterator tglb = gtree.lower_bound(key);
+        greater_tree_type::iterator tgub = gtree.upper_bound(key);
+        std::uint64_t hi = random_int(0, max_key + 1);
+        std::uint64_t n_expected = (hi < key) ?
+          std::distance(glb, gs.lower_bound(hi)) : 0;
+        if (gtree.contains(key) != (gs.count(key) > 0) ||
+            (tglb == gtree.end()) != (glb == gs.end()) ||
+            (glb != gs.end() && tglb.key() != glb->first) ||
+            (tgub == gtree.end()) != (gub == gs.end()) ||
+            (gub != gs.end() && tgub.key() != gub->first) ||
+            gtree.count_in_range(key, hi) != n_expected) {
+          fprintf(stderr, "\nError: wrong result with std::greater\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      std::vector<std::pair<key_type, value_type> > v;
+      for (zip_tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      std::vector<std::pair<std::uint64_t, value_type> > gv;
+      for (greater_tree_type::iterator it = gtree.begin();
+          it != gtree.end(); ++it)
+        gv.push_back(std::make_pair(it.key(), it.value()));
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end()) ||
+          gv != std::vector<std::pair<std::uint64_t, value_type> >(
+            gs.begin(), gs.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check a tree of std::string keys using three_way_less, which
+  // compares the keys once per level, against std::map.
+  {
+    typedef std::string key_type;
+    typedef std::uint64_t value_type;
+    typedef zip_tree<key_type, value_type, pool_allocator, random_ranks,
+            true, no_stats, three_way_less> zip_tree_type;
+    typedef std::map<key_type, value_type> map_type;
+
+    static const std::uint64_t n_tests = 2000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      zip_tree_type tree, other;
+      map_type s, s2;
+      std::uint64_t n = random_int(0, 200);
+      std::uint64_t max_key = random_int(1, 500);
+      for (std::uint64_t j = 0; j < n; ++j) {
+        std::string key = std::to_string(random_int(0, max_key));
+        value_type value = random_int(0, 1000000);
+        std::uint64_t op = random_int(0, 2);
+        bool ok;
+        if (op == 0)
+          ok = (tree.insert(key, value) ==
+                s.insert(std::make_pair(key, value)).second);
+        else if (op == 1)
+          ok = (tree.erase(key.c_str()) == (s.erase(key) > 0));
+        else
+          ok = (other.insert(key, value) ==
+                s2.insert(std::make_pair(key, value)).second);
+        if (!ok) {
+          fprintf(stderr, "\nError: wrong update result\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+      tree.check_correctness();
+
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        std::string key = std::to_string(random_int(0, max_key + 1));
+        map_type::iterator it = s.find(key);
+        map_type::iterator lb = s.lower_bound(key);
+        const value_type *v = tree.lookup(key.c_str());
+        std::pair<zip_tree_type::iterator, zip_tree_type::iterator> er =
+          tree.equal_range(key);
+        if ((v != 0) != (it != s.end()) ||
+            (v && *v != it->second) ||
+            tree.rank(key) != (std::uint64_t)std::distance(s.begin(), lb) ||
+            er.first != tree.lower_bound(key) ||
+            er.second != tree.upper_bound(key)) {
+          fprintf(stderr, "\nError: wrong three-way lookup result\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      // Split and join the tree, then merge the other tree into it.
+      std::string key = std::to_string(random_int(0, max_key + 1));
+      std::pair<zip_tree_type, zip_tree_type> parts = tree.split(key);
+      if (parts.first.size() !=
+            (std::uint64_t)std::distance(s.begin(), s.lower_bound(key))) {
+        fprintf(stderr, "\nError: wrong three-way split\n");
+        std::exit(EXIT_FAILURE);
+      }
+      tree = zip_tree_type::join(std::move(parts.first),
+          std::move(parts.second));
+      tree.union_with(std::move(other));
+      s.insert(s2.begin(), s2.end());
+      tree.check_correctness();
+
+      std::vector<std::pair<key_type, value_type> > v;
+      for (zip_tree_type::iterator it = tree.begin(); it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      if (v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  // Check blocked_zip_tree against std::map. The small ranges of keys
+  // fill the blocks, so that items are promoted to upper nodes and
+  // the blocks of erased upper nodes overflow when merged. The keys
+  // near 2^64 - 1 test the padding of blocks.
+  {
+    typedef std::uint64_t key_type;
+    typedef std::string value_type;
+    typedef blocked_zip_tree<value_type> blocked_tree_type;
+    typedef std::map<key_type, value_type> map_type;
+
+    static const std::uint64_t n_tests = 5000;
+    for (std::uint64_t i = 0; i < n_tests; ++i) {
+      if ((i + 1) % 100 == 0)
+        fprintf(stderr, "testing: %.2Lf%%\r", 100.L * (i + 1) / n_tests);
+
+      blocked_tree_type tree(random_int(0, 1000000));
+      map_type s;
+      std::uint64_t n = random_int(0, 1000);
+      std::uint64_t max_key = random_int(1, 300);
+      std::uint64_t base = (random_int(0, 3) == 0 ? ~0UL - max_key : 0);
+      for (std::uint64_t j = 0; j < n; ++j) {
+        key_type key = base + random_int(0, max_key);
+        bool ok;
+        if (random_int(0, 2) != 0) {
+          value_type value = random_string();
+          ok = (tree.insert(key, value) ==
+                s.insert(std::make_pair(key, value)).second);
+        } else ok = (tree.erase(key) == (s.erase(key) > 0));
+        if (!ok) {
+          fprintf(stderr, "\nError: wrong update result\n");
+          std::exit(EXIT_FAILURE);
+        }
+        if (random_int(0, 50) == 0)
+          tree.check_correctness();
+      }
+      tree.check_correctness();
+
+      for (std::uint64_t j = 0; j < 100; ++j) {
+        key_type key = base + random_int(0, max_key + 1);
+        map_type::iterator it = s.find(key);
+        value_type *v = tree.lookup(key);
+        std::pair<bool, value_type> r = tree.search(key);
+        bool found = (it != s.end());
+        if ((v != 0) != found || tree.contains(key) != found ||
+            r.first != found ||
+            (found && (*v != it->second || r.second != it->second))) {
+          fprintf(stderr, "\nError: wrong lookup result\n");
+          std::exit(EXIT_FAILURE);
+        }
+      }
+
+      std::vector<std::pair<key_type, value_type> > v;
+      for (blocked_tree_type::iterator it = tree.begin();
+          it != tree.end(); ++it)
+        v.push_back(std::make_pair(it.key(), it.value()));
+      if (tree.size() != s.size() ||
+          v != std::vector<std::pair<key_type, value_type> >(
+            s.begin(), s.end())) {
+        fprintf(stderr, "\nError: wrong contents\n");
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
 }
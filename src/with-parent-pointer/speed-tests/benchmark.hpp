@@ -0,0 +1,1029 @@
+/**
+ * @file    benchmark.hpp
+ * @section LICENCE
+ *
+ * Benchmark harness for the Zip Tree speed tests, v0.1.0
+ * See: https://github.com/dominikkempa/zip-tree
+ *
+ * Copyright (C) 2018-2020
+ *   Dominik Kempa <dominik.kempa (at) gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef __BENCHMARK_HPP_INCLUDED
+#define __BENCHMARK_HPP_INCLUDED
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "zip_tree.hpp"
+
+
+//=============================================================================
+// Options of a benchmark run, parsed from the command line:
+//
+//   --n=LIST              numbers of items, with optional K/M/G suffix
+//   --distributions=LIST  uniform, sorted, reverse, zipf, clustered
+//   --types=LIST          key:value pairs of u64 and string
+//   --repetitions=R       number of runs of every benchmark
+//   --format=F            text, csv or json
+//   --filter=LIST         run only benchmarks whose "benchmark/structure"
+//                         name contains one of the given substrings
+//   --seed=S              seed of the generated keys
+//   --counters=on|off     report the hardware counters per operation
+//   --mode=M              throughput (the time per operation averaged
+//                         over all operations) or latency (percentiles
+//                         of the times of individual operations)
+//
+// For compatibility, the number of items and the seed can also be
+// given as the first two positional arguments, e.g., "./test 1000000 1".
+//=============================================================================
+class benchmark_options {
+  public:
+    std::vector<std::uint64_t> m_sizes;
+    std::vector<std::string> m_distributions;
+    std::vector<std::string> m_types;
+    std::vector<std::string> m_filters;
+    std::uint64_t m_repetitions;
+    std::string m_format;
+    std::uint64_t m_seed;
+    bool m_counters;
+    std::string m_mode;
+
+    //=========================================================================
+    // Constructor. Set the defaults.
+    //=========================================================================
+    benchmark_options() {
+      m_sizes.push_back(1000000);
+      m_distributions.push_back("uniform");
+      m_distributions.push_back("sorted");
+      m_types.push_back("u64:string");
+      m_repetitions = 3;
+      m_format = "text";
+      m_seed = 1;
+      m_counters = true;
+      m_mode = "throughput";
+    }
+
+    //=========================================================================
+    // Parse the command line. Return false (after printing the
+    // reason and the usage) if the command line is not valid.
+    //=========================================================================
+    bool parse(int argc, char **argv) {
+      std::uint64_t n_positional = 0;
+      for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string name = arg, value;
+        std::uint64_t eq = arg.find('=');
+        if (eq != std::string::npos) {
+          name = arg.substr(0, eq);
+          value = arg.substr(eq + 1);
+        }
+        bool ok = true;
+        if (name == "--n") {
+          m_sizes.clear();
+          std::vector<std::string> items = split_list(value);
+          for (std::uint64_t j = 0; ok && j < items.size(); ++j) {
+            std::uint64_t n = 0;
+            ok = parse_size(items[j], n) && n > 0;
+            m_sizes.push_back(n);
+          }
+          ok = ok && !m_sizes.empty();
+        } else if (name == "--distributions") {
+          m_distributions = split_list(value);
+          for (std::uint64_t j = 0; j < m_distributions.size(); ++j)
+            ok = ok && is_distribution(m_distributions[j]);
+          ok = ok && !m_distributions.empty();
+        } else if (name == "--types") {
+          m_types = split_list(value);
+          for (std::uint64_t j = 0; j < m_types.size(); ++j)
+            ok = ok && (m_types[j] == "u64:u64" ||
+                m_types[j] == "u64:string" || m_types[j] == "string:u64");
+          ok = ok && !m_types.empty();
+        } else if (name == "--repetitions") {
+          ok = parse_size(value, m_repetitions) && m_repetitions > 0;
+        } else if (name == "--format") {
+          m_format = value;
+          ok = (value == "text" || value == "csv" || value == "json");
+        } else if (name == "--filter") {
+          m_filters = split_list(value);
+        } else if (name == "--seed") {
+          ok = parse_size(value, m_seed);
+        } else if (name == "--counters") {
+          m_counters = (value == "on");
+          ok = (value == "on" || value == "off");
+        } else if (name == "--mode") {
+          m_mode = value;
+          ok = (value == "throughput" || value == "latency");
+        } else if (name == "--help") {
+          usage(argv[0]);
+          return false;
+        } else if (name[0] != '-' && n_positional < 2) {
+          std::uint64_t x = 0;
+          ok = parse_size(name, x);
+          if (n_positional++ == 0) {
+            ok = ok && x > 0;
+            m_sizes.assign(1, x);
+          } else m_seed = x;
+        } else ok = false;
+        if (!ok) {
+          fprintf(stderr, "Error: invalid argument %s\n\n", argv[i]);
+          usage(argv[0]);
+          return false;
+        }
+      }
+      return true;
+    }
+
+    //=========================================================================
+    // Return true if the given benchmark of the given structure is to be
+    // run, i.e., if no filter was given or "benchmark/structure" contains
+    // one of the filters.
+    //=========================================================================
+    bool selected(
+        const std::string &benchmark,
+        const std::string &structure) const {
+      if (m_filters.empty()) return true;
+      std::string name = benchmark + "/" + structure;
+      for (std::uint64_t i = 0; i < m_filters.size(); ++i)
+        if (name.find(m_filters[i]) != std::string::npos)
+          return true;
+      return false;
+    }
+
+    static bool is_distribution(const std::string &name) {
+      return name == "uniform" || name == "sorted" || name == "reverse" ||
+        name == "zipf" || name == "clustered";
+    }
+
+    static void usage(const char *program) {
+      fprintf(stderr,
+          "Usage: %s [options] [n [seed]]\n"
+          "  --n=LIST              numbers of items (e.g. 1K,1M,100M)\n"
+          "  --distributions=LIST  uniform,sorted,reverse,zipf,clustered\n"
+          "  --types=LIST          u64:u64,u64:string,string:u64\n"
+          "  --repetitions=R       runs of every benchmark (default 3)\n"
+          "  --format=F            text, csv or json (default text)\n"
+          "  --filter=LIST         substrings of benchmark/structure\n"
+          "  --seed=S              seed of the generated keys (default 1)\n"
+          "  --counters=on|off     hardware counters per op (default on)\n"
+          "  --mode=M              throughput or latency (default "
+          "throughput)\n",
+          program);
+    }
+
+  private:
+    static std::vector<std::string> split_list(const std::string &s) {
+      std::vector<std::string> ret;
+      std::uint64_t beg = 0;
+      while (beg <= s.size()) {
+        std::uint64_t end = s.find(',', beg);
+        if (end == std::string::npos) end = s.size();
+        if (end > beg) ret.push_back(s.substr(beg, end - beg));
+        beg = end + 1;
+      }
+      return ret;
+    }
+
+    static bool parse_size(const std::string &s, std::uint64_t &ret) {
+      if (s.empty() || s[0] < '0' || s[0] > '9') return false;
+      char *end = 0;
+      ret = std::strtoull(s.c_str(), &end, 10);
+      std::string suffix(end);
+      if (suffix == "K" || suffix == "k") ret *= 1000UL;
+      else if (suffix == "M" || suffix == "m") ret *= 1000000UL;
+      else if (suffix == "G" || suffix == "g") ret *= 1000000000UL;
+      else if (!suffix.empty()) return false;
+      return true;
+    }
+};
+
+//=============================================================================
+// Generator of numbers with the Zipf distribution on [0, n): number i
+// is drawn with probability proportional to 1 / (i + 1)^theta. Uses
+// the method of Gray et al. ("Quickly generating billion-record
+// synthetic databases", SIGMOD 1994), as YCSB does. The constructor
+// takes O(n) time, every number is then drawn in O(1) time.
+//=============================================================================
+class zipf_generator {
+  private:
+    std::uint64_t m_n;
+    double m_theta;
+    double m_zetan;
+    double m_alpha;
+    double m_eta;
+
+  public:
+    zipf_generator(std::uint64_t n, double theta = 0.99) {
+      m_n = n;
+      m_theta = theta;
+      m_zetan = 0.0;
+      for (std::uint64_t i = 1; i <= n; ++i)
+        m_zetan += 1.0 / std::pow((double)i, theta);
+      double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+      m_alpha = 1.0 / (1.0 - theta);
+      m_eta = (n > 2) ? (1.0 - std::pow(2.0 / n, 1.0 - theta)) /
+        (1.0 - zeta2 / m_zetan) : 0.0;
+    }
+
+    inline std::uint64_t operator()(random_generator &random) {
+      double u = (random() >> 11) / 9007199254740992.0;
+      double uz = u * m_zetan;
+      if (uz < 1.0) return 0;
+      if (uz < 1.0 + std::pow(0.5, m_theta)) return 1;
+      std::uint64_t ret = (std::uint64_t)(m_n *
+          std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+      return std::min(ret, m_n - 1);
+    }
+};
+
+//=============================================================================
+// Generator of the 64-bit keys used by the benchmarks. All keys are
+// taken from the universe mix(i + salt), where mix() is the bijective
+// finalizer of SplitMix64, so that distinct i give distinct keys in
+// no particular order. The sequence of n keys to insert is:
+//
+//   uniform   - the keys for i = 0, 1, ..., n - 1,
+//   sorted    - the same keys in increasing order,
+//   reverse   - the same keys in decreasing order,
+//   zipf      - the keys for n values of i drawn from the Zipf
+//               distribution on [0, n), hence with repetitions,
+//   clustered - runs of k_cluster_size consecutive integers, starting
+//               at random multiples of k_cluster_size, so the keys are
+//               sorted within every run but the runs are in random order.
+//
+// The lookups are a random permutation of the inserted keys, except
+// for zipf, where they are another n draws from the same distribution.
+//=============================================================================
+class key_generator {
+  private:
+    static const std::uint64_t k_cluster_size = 64;
+
+    std::string m_distribution;
+    std::uint64_t m_n;
+    random_generator m_random;
+    std::uint64_t m_salt;
+
+  public:
+    key_generator(
+        const std::string &distribution,
+        std::uint64_t n,
+        std::uint64_t seed)
+      : m_distribution(distribution),
+        m_n(n),
+        m_random(seed) {
+      m_salt = m_random();
+    }
+
+    std::vector<std::uint64_t> insertions() {
+      std::vector<std::uint64_t> ret(m_n);
+      if (m_distribution == "zipf") {
+        zipf_generator zipf(m_n);
+        for (std::uint64_t i = 0; i < m_n; ++i)
+          ret[i] = key(zipf(m_random));
+      } else if (m_distribution == "clustered") {
+        for (std::uint64_t i = 0; i < m_n; ++i) {
+          std::uint64_t base = key(i / k_cluster_size) & ~(k_cluster_size - 1);
+          ret[i] = base + i % k_cluster_size;
+        }
+      } else {
+        for (std::uint64_t i = 0; i < m_n; ++i)
+          ret[i] = key(i);
+        if (m_distribution == "sorted")
+          std::sort(ret.begin(), ret.end());
+        else if (m_distribution == "reverse")
+          std::sort(ret.rbegin(), ret.rend());
+      }
+      return ret;
+    }
+
+    std::vector<std::uint64_t> lookups(
+        const std::vector<std::uint64_t> &inserted) {
+      std::vector<std::uint64_t> ret;
+      if (m_distribution == "zipf") {
+        zipf_generator zipf(m_n);
+        ret.resize(m_n);
+        for (std::uint64_t i = 0; i < m_n; ++i)
+          ret[i] = key(zipf(m_random));
+      } else {
+        ret = inserted;
+        shuffle(ret);
+      }
+      return ret;
+    }
+
+    //=========================================================================
+    // Random permutation of `v' (Fisher-Yates).
+    //=========================================================================
+    template<typename T>
+    void shuffle(std::vector<T> &v) {
+      for (std::uint64_t i = v.size(); i > 1; --i)
+        std::swap(v[i - 1], v[m_random() % i]);
+    }
+
+  private:
+    inline std::uint64_t key(std::uint64_t i) const {
+      return random_generator::mix(i + m_salt);
+    }
+};
+
+//=============================================================================
+// Conversion of the generated 64-bit numbers to keys and values. String
+// keys are zero-padded to 20 digits, so that they compare as the numbers
+// they were made from. String values are the decimal representation of
+// a mixed number (as random strings in the earlier versions of the speed
+// tests), long enough not to fit into the std::string object itself.
+//=============================================================================
+template<typename T>
+struct benchmark_type;
+
+template<>
+struct benchmark_type<std::uint64_t> {
+  static const char* name() {
+    return "u64";
+  }
+
+  static std::uint64_t key(std::uint64_t x) {
+    return x;
+  }
+
+  static std::uint64_t value(std::uint64_t x) {
+    return x;
+  }
+
+  static std::uint64_t checksum(std::uint64_t x) {
+    return x;
+  }
+};
+
+template<>
+struct benchmark_type<std::string> {
+  static const char* name() {
+    return "string";
+  }
+
+  static std::string key(std::uint64_t x) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%020lu", x);
+    return std::string(buf);
+  }
+
+  static std::string value(std::uint64_t x) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lu", random_generator::mix(x));
+    return std::string(buf);
+  }
+
+  static std::uint64_t checksum(const std::string &x) {
+    return x.empty() ? 0 : (std::uint64_t)x[0];
+  }
+};
+
+//=============================================================================
+// Hardware performance counters of the calling thread (and the threads
+// it creates later), read with perf_event_open(2): instructions, cache
+// misses (of the last level cache), branch misses and dTLB load misses.
+// Only user-space events are counted. The counters are opened on the
+// first reset() and run from then on. Counters which cannot be opened
+// (e.g., without a PMU in a virtual machine, or if forbidden by
+// /proc/sys/kernel/perf_event_paranoid) are reported as missing.
+//=============================================================================
+class perf_counters {
+  public:
+    static const std::uint64_t k_events = 4;
+
+    //=========================================================================
+    // Values of the counters (per operation, once divided), or
+    // negative values for the counters which are not available.
+    //=========================================================================
+    struct values {
+      long double m_values[k_events];
+    };
+
+  private:
+    int m_fds[k_events];
+    bool m_enabled;
+    bool m_opened;
+
+    perf_counters() {
+      for (std::uint64_t i = 0; i < k_events; ++i)
+        m_fds[i] = -1;
+      m_enabled = true;
+      m_opened = false;
+    }
+
+    void open() {
+      static const std::uint32_t types[k_events] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+      static const std::uint64_t configs[k_events] = {
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_DTLB |
+          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) };
+      m_opened = true;
+      bool any = false;
+      int error = 0;
+      for (std::uint64_t i = 0; i < k_events; ++i) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+          PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (m_fds[i] >= 0) any = true;
+        else error = errno;
+      }
+      if (!any)
+        fprintf(stderr, "Note: hardware counters are not available "
+            "(perf_event_open: %s)\n", std::strerror(error));
+    }
+
+  public:
+    ~perf_counters() {
+      for (std::uint64_t i = 0; i < k_events; ++i)
+        if (m_fds[i] >= 0) close(m_fds[i]);
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    //=========================================================================
+    // Return the (only) instance.
+    //=========================================================================
+    static perf_counters& instance() {
+      static perf_counters counters;
+      return counters;
+    }
+
+    static const char* name(std::uint64_t i) {
+      static const char *names[k_events] =
+        { "instructions", "cache-misses", "branch-misses", "dTLB-misses" };
+      return names[i];
+    }
+
+    //=========================================================================
+    // Counting can be switched off (e.g., with --counters=off) before
+    // the first reset(), in which case the counters are never opened
+    // and all of them are reported as missing.
+    //=========================================================================
+    void set_enabled(bool enabled) {
+      m_enabled = enabled;
+    }
+
+    bool available() const {
+      if (!m_enabled) return false;
+      for (std::uint64_t i = 0; i < k_events; ++i)
+        if (m_fds[i] >= 0) return true;
+      return false;
+    }
+
+    void reset() {
+      if (!m_enabled) return;
+      if (!m_opened) open();
+      for (std::uint64_t i = 0; i < k_events; ++i)
+        if (m_fds[i] >= 0) ioctl(m_fds[i], PERF_EVENT_IOC_RESET, 0);
+    }
+
+    //=========================================================================
+    // Return the counts since the last reset(), divided by `n_ops'.
+    // If the kernel multiplexed the counters, the counts are scaled
+    // by the fraction of the time they were running.
+    //=========================================================================
+    values read(std::uint64_t n_ops) const {
+      values ret;
+      for (std::uint64_t i = 0; i < k_events; ++i) {
+        ret.m_values[i] = -1.L;
+        std::uint64_t buf[3];
+        if (!m_enabled || m_fds[i] < 0 ||
+            ::read(m_fds[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+          continue;
+        ret.m_values[i] = ((long double)buf[0] * buf[1] / buf[2]) /
+          std::max(n_ops, (std::uint64_t)1);
+      }
+      return ret;
+    }
+};
+
+//=============================================================================
+// Wall-clock timer, started on construction. It also resets the
+// hardware counters, see perf_counters above.
+//=============================================================================
+class benchmark_timer {
+  private:
+    std::chrono::steady_clock::time_point m_start;
+
+  public:
+    benchmark_timer() {
+      reset();
+    }
+
+    void reset() {
+      perf_counters::instance().reset();
+      m_start = std::chrono::steady_clock::now();
+    }
+
+    //=========================================================================
+    // Return the time elapsed since the start in seconds.
+    //=========================================================================
+    long double elapsed() const {
+      return std::chrono::duration<long double>(
+          std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    //=========================================================================
+    // Return the time elapsed since the start in nanoseconds per
+    // one of the `n_ops' operations.
+    //=========================================================================
+    long double ns_per_op(std::uint64_t n_ops) const {
+      return (1000000000.L * elapsed()) / std::max(n_ops, (std::uint64_t)1);
+    }
+};
+
+//=============================================================================
+// Clock for timing individual operations. On x86 it reads the time
+// stamp counter (rdtscp waits until the preceding instructions have
+// executed, so the timed operation is complete), which takes a few
+// nanoseconds, and converts ticks to nanoseconds with the rate measured
+// against std::chrono::steady_clock on construction. This assumes an
+// invariant TSC (constant_tsc in /proc/cpuinfo), as on all recent
+// x86 CPUs. Elsewhere it reads steady_clock, in nanoseconds. The
+// smallest time between two consecutive readings is subtracted from
+// every measured time.
+//=============================================================================
+class latency_clock {
+  private:
+    long double m_ns_per_tick;
+    std::uint64_t m_overhead;
+
+  public:
+    latency_clock() {
+      m_ns_per_tick = 1.L;
+      m_overhead = 0;
+#if defined(__x86_64__) || defined(__i386__)
+      std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+      std::uint64_t start_ticks = ticks();
+      while (std::chrono::steady_clock::now() - start <
+          std::chrono::milliseconds(50));
+      std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now();
+      std::uint64_t end_ticks = ticks();
+      m_ns_per_tick =
+        (long double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            end - start).count() / std::max(end_ticks - start_ticks, 1UL);
+#endif
+      m_overhead = ~0UL;
+      for (std::uint64_t i = 0; i < 1000; ++i) {
+        std::uint64_t t = ticks();
+        m_overhead = std::min(m_overhead, ticks() - t);
+      }
+    }
+
+    static inline std::uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+      unsigned aux;
+      return __rdtscp(&aux);
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    //=========================================================================
+    // Return the ticks between the readings `start' and `end', less the
+    // overhead of reading the clock.
+    //=========================================================================
+    inline std::uint64_t elapsed(std::uint64_t start, std::uint64_t end) const {
+      std::uint64_t t = end - start;
+      return t > m_overhead ? t - m_overhead : 0;
+    }
+
+    long double ns(std::uint64_t ticks) const {
+      return m_ns_per_tick * ticks;
+    }
+};
+
+//=============================================================================
+// Histogram of non-negative integers (here latencies, in ticks of
+// latency_clock), in the style of HdrHistogram: the values below
+// 2 * k_sub_buckets have a bucket each, and every larger range
+// [2^e, 2^(e+1)) is split into k_sub_buckets buckets of equal width.
+// Thus every value is known up to a relative error of
+// 1 / k_sub_buckets (< 1%), in 58 * k_sub_buckets buckets for all
+// 64-bit values, and recording a value takes O(1) time.
+//=============================================================================
+class latency_histogram {
+  private:
+    static const std::uint64_t k_precision_bits = 7;
+    static const std::uint64_t k_sub_buckets = (1UL << k_precision_bits);
+
+    std::vector<std::uint64_t> m_counts;
+    std::uint64_t m_count;
+    std::uint64_t m_max;
+
+  public:
+    latency_histogram()
+      : m_counts((65 - k_precision_bits) * k_sub_buckets, 0) {
+      m_count = 0;
+      m_max = 0;
+    }
+
+    inline void record(std::uint64_t value) {
+      ++m_counts[bucket(value)];
+      ++m_count;
+      m_max = std::max(m_max, value);
+    }
+
+    std::uint64_t count() const {
+      return m_count;
+    }
+
+    std::uint64_t max() const {
+      return m_max;
+    }
+
+    //=========================================================================
+    // Return the p-th percentile (0 < p <= 1) of the recorded values,
+    // i.e., the smallest value v such that at least p of the values are
+    // <= v, rounded up to the largest value of its bucket (but not above
+    // the maximum). Return 0 if no value was recorded.
+    //=========================================================================
+    std::uint64_t percentile(long double p) const {
+      if (!m_count) return 0;
+      std::uint64_t target = std::max((std::uint64_t)std::ceil(p * m_count),
+          (std::uint64_t)1);
+      std::uint64_t seen = 0;
+      for (std::uint64_t i = 0; i < m_counts.size(); ++i) {
+        seen += m_counts[i];
+        if (seen >= target)
+          return std::min(largest(i), m_max);
+      }
+      return m_max;
+    }
+
+  private:
+    static inline std::uint64_t bucket(std::uint64_t value) {
+      if (value < 2 * k_sub_buckets) return value;
+      std::uint64_t shift = 63 - __builtin_clzll(value) - k_precision_bits;
+      return shift * k_sub_buckets + (value >> shift);
+    }
+
+    static std::uint64_t largest(std::uint64_t i) {
+      if (i < 2 * k_sub_buckets) return i;
+      std::uint64_t shift = i / k_sub_buckets - 1;
+      std::uint64_t top = i - shift * k_sub_buckets;
+      return ((top + 1) << shift) - 1;
+    }
+};
+
+//=============================================================================
+// Parameters shared by all benchmarks of one configuration.
+//=============================================================================
+struct benchmark_case {
+  std::uint64_t m_n;
+  std::string m_distribution;
+  std::string m_key_type;
+  std::string m_value_type;
+  std::uint64_t m_repetitions;
+};
+
+//=============================================================================
+// The results of all repetitions of the benchmarks of one configuration.
+// Every (benchmark, structure, unit) triple collects one sample per
+// repetition. The checksum of the last repetition is kept to check that
+// the structures agree (and to keep the measured work from being
+// optimized away). Timings added with add_timing() also collect the
+// hardware counters per operation, when available.
+//=============================================================================
+class benchmark_samples {
+  public:
+    struct entry {
+      std::string m_benchmark;
+      std::string m_structure;
+      std::string m_unit;
+      std::vector<long double> m_values;
+      std::vector<long double> m_counters[perf_counters::k_events];
+      std::uint64_t m_checksum;
+    };
+
+  private:
+    const benchmark_options &m_options;
+    std::vector<entry> m_entries;
+
+  public:
+    benchmark_samples(const benchmark_options &options)
+      : m_options(options) {}
+
+    bool selected(
+        const std::string &benchmark,
+        const std::string &structure) const {
+      return m_options.selected(benchmark, structure);
+    }
+
+    void add(
+        const std::string &benchmark,
+        const std::string &structure,
+        const std::string &unit,
+        long double value,
+        std::uint64_t checksum = 0) {
+      if (!selected(benchmark, structure)) return;
+      entry &e = find(benchmark, structure, unit);
+      e.m_values.push_back(value);
+      e.m_checksum = checksum;
+    }
+
+    //=========================================================================
+    // Add the time per operation measured by `timer' (in ns, `unit' is
+    // e.g. "ns/op" or "ns/item") for `n_ops' operations, together with
+    // the hardware counters per operation. Call immediately after the
+    // measured code.
+    //=========================================================================
+    void add_timing(
+        const std::string &benchmark,
+        const std::string &structure,
+        const std::string &unit,
+        const benchmark_timer &timer,
+        std::uint64_t n_ops,
+        std::uint64_t checksum = 0) {
+      long double ns = timer.ns_per_op(n_ops);
+      perf_counters::values counters =
+        perf_counters::instance().read(n_ops);
+      if (!selected(benchmark, structure)) return;
+      entry &e = find(benchmark, structure, unit);
+      e.m_values.push_back(ns);
+      for (std::uint64_t j = 0; j < perf_counters::k_events; ++j)
+        if (counters.m_values[j] >= 0.L)
+          e.m_counters[j].push_back(counters.m_values[j]);
+      e.m_checksum = checksum;
+    }
+
+    //=========================================================================
+    // Add the 50th, 99th and 99.9th percentiles and the maximum of the
+    // latencies recorded in `histogram' (in ticks of `clock'), in ns.
+    //=========================================================================
+    void add_latency(
+        const std::string &benchmark,
+        const std::string &structure,
+        const latency_histogram &histogram,
+        const latency_clock &clock,
+        std::uint64_t checksum = 0) {
+      add(benchmark, structure, "ns (p50)",
+          clock.ns(histogram.percentile(0.5L)), checksum);
+      add(benchmark, structure, "ns (p99)",
+          clock.ns(histogram.percentile(0.99L)));
+      add(benchmark, structure, "ns (p99.9)",
+          clock.ns(histogram.percentile(0.999L)));
+      add(benchmark, structure, "ns (max)", clock.ns(histogram.max()));
+    }
+
+    //=========================================================================
+    // Return the entries grouped by benchmark, in the order in which
+    // the benchmarks and the structures were first run.
+    //=========================================================================
+    std::vector<entry> grouped() const {
+      std::vector<entry> ret;
+      std::vector<bool> done(m_entries.size(), false);
+      for (std::uint64_t i = 0; i < m_entries.size(); ++i) {
+        if (done[i]) continue;
+        for (std::uint64_t j = i; j < m_entries.size(); ++j) {
+          if (!done[j] && m_entries[j].m_benchmark == m_entries[i].m_benchmark) {
+            ret.push_back(m_entries[j]);
+            done[j] = true;
+          }
+        }
+      }
+      return ret;
+    }
+
+  private:
+    entry& find(
+        const std::string &benchmark,
+        const std::string &structure,
+        const std::string &unit) {
+      std::uint64_t i = 0;
+      while (i < m_entries.size() && (m_entries[i].m_benchmark != benchmark ||
+            m_entries[i].m_structure != structure ||
+            m_entries[i].m_unit != unit))
+        ++i;
+      if (i == m_entries.size()) {
+        m_entries.push_back(entry());
+        m_entries[i].m_benchmark = benchmark;
+        m_entries[i].m_structure = structure;
+        m_entries[i].m_unit = unit;
+      }
+      return m_entries[i];
+    }
+};
+
+//=============================================================================
+// Summary of the samples of one entry.
+//=============================================================================
+struct benchmark_statistics {
+  long double m_mean;
+  long double m_median;
+  long double m_p10;
+  long double m_p90;
+  long double m_min;
+  long double m_max;
+
+  benchmark_statistics(std::vector<long double> v) {
+    std::sort(v.begin(), v.end());
+    m_mean = 0.L;
+    for (std::uint64_t i = 0; i < v.size(); ++i)
+      m_mean += v[i];
+    m_mean /= v.size();
+    m_median = percentile(v, 0.5L);
+    m_p10 = percentile(v, 0.1L);
+    m_p90 = percentile(v, 0.9L);
+    m_min = v.front();
+    m_max = v.back();
+  }
+
+  //===========================================================================
+  // Return the p-th percentile of the sorted samples `v', linearly
+  // interpolated between the closest ranks.
+  //===========================================================================
+  static long double percentile(const std::vector<long double> &v,
+      long double p) {
+    long double pos = p * (v.size() - 1);
+    std::uint64_t lo = (std::uint64_t)pos;
+    std::uint64_t hi = std::min(lo + 1, (std::uint64_t)v.size() - 1);
+    return v[lo] + (pos - lo) * (v[hi] - v[lo]);
+  }
+};
+
+//=============================================================================
+// Writer of the results, as human-readable text (one section per
+// benchmark, as in the earlier versions of the speed tests), CSV (one
+// row per entry, with a header) or JSON (an array of objects). The
+// hardware counters are reported as the medians over the repetitions,
+// and are left empty (null in JSON) if they were not collected.
+//=============================================================================
+class benchmark_reporter {
+  private:
+    std::string m_format;
+    std::FILE *m_out;
+    bool m_first;
+
+  public:
+    benchmark_reporter(const std::string &format, std::FILE *out)
+      : m_format(format),
+        m_out(out),
+        m_first(true) {}
+
+    void begin() {
+      if (m_format == "csv")
+        fprintf(m_out, "benchmark,structure,n,distribution,key_type,"
+            "value_type,repetitions,unit,mean,median,p10,p90,min,max,"
+            "checksum,instructions,cache_misses,branch_misses,"
+            "dtlb_misses\n");
+      else if (m_format == "json")
+        fprintf(m_out, "[");
+    }
+
+    void report(const benchmark_case &c, const benchmark_samples &samples) {
+      std::vector<benchmark_samples::entry> entries = samples.grouped();
+      if (m_format == "text")
+        fprintf(m_out, "n = %lu, distribution = %s, key = %s, value = %s, "
+            "repetitions = %lu\n", c.m_n, c.m_distribution.c_str(),
+            c.m_key_type.c_str(), c.m_value_type.c_str(), c.m_repetitions);
+      for (std::uint64_t i = 0; i < entries.size(); ++i) {
+        const benchmark_samples::entry &e = entries[i];
+        benchmark_statistics s(e.m_values);
+        if (m_format == "text") {
+          if (i == 0 || entries[i - 1].m_benchmark != e.m_benchmark)
+            fprintf(m_out, "%s:\n", e.m_benchmark.c_str());
+          fprintf(m_out, "\t%s: %.2Lf %s", e.m_structure.c_str(),
+              s.m_median, e.m_unit.c_str());
+          if (e.m_values.size() > 1)
+            fprintf(m_out, " (min %.2Lf, p90 %.2Lf, max %.2Lf)",
+                s.m_min, s.m_p90, s.m_max);
+          if (e.m_checksum)
+            fprintf(m_out, " (checksum = %lu)", e.m_checksum);
+          std::string sep = " [";
+          for (std::uint64_t j = 0; j < perf_counters::k_events; ++j) {
+            if (e.m_counters[j].empty()) continue;
+            fprintf(m_out, "%s%s %.2Lf", sep.c_str(), perf_counters::name(j),
+                benchmark_statistics(e.m_counters[j]).m_median);
+            sep = ", ";
+          }
+          if (sep != " [")
+            fprintf(m_out, " per op]");
+          fprintf(m_out, "\n");
+        } else if (m_format == "csv") {
+          fprintf(m_out, "%s,%s,%lu,%s,%s,%s,%lu,%s,"
+              "%.2Lf,%.2Lf,%.2Lf,%.2Lf,%.2Lf,%.2Lf,%lu",
+              csv(e.m_benchmark).c_str(), csv(e.m_structure).c_str(), c.m_n,
+              c.m_distribution.c_str(), c.m_key_type.c_str(),
+              c.m_value_type.c_str(), c.m_repetitions, csv(e.m_unit).c_str(),
+              s.m_mean, s.m_median, s.m_p10, s.m_p90, s.m_min, s.m_max,
+              e.m_checksum);
+          for (std::uint64_t j = 0; j < perf_counters::k_events; ++j)
+            fprintf(m_out, ",%s", counter(e, j, "").c_str());
+          fprintf(m_out, "\n");
+        } else {
+          fprintf(m_out, "%s\n  {\"benchmark\": %s, \"structure\": %s, "
+              "\"n\": %lu, \"distribution\": %s, \"key_type\": %s, "
+              "\"value_type\": %s, \"repetitions\": %lu, \"unit\": %s, "
+              "\"mean\": %.2Lf, \"median\": %.2Lf, \"p10\": %.2Lf, "
+              "\"p90\": %.2Lf, \"min\": %.2Lf, \"max\": %.2Lf, "
+              "\"checksum\": %lu, \"instructions\": %s, "
+              "\"cache_misses\": %s, \"branch_misses\": %s, "
+              "\"dtlb_misses\": %s}", m_first ? "" : ",",
+              json(e.m_benchmark).c_str(), json(e.m_structure).c_str(),
+              c.m_n, json(c.m_distribution).c_str(),
+              json(c.m_key_type).c_str(), json(c.m_value_type).c_str(),
+              c.m_repetitions, json(e.m_unit).c_str(), s.m_mean, s.m_median,
+              s.m_p10, s.m_p90, s.m_min, s.m_max, e.m_checksum,
+              counter(e, 0, "null").c_str(), counter(e, 1, "null").c_str(),
+              counter(e, 2, "null").c_str(), counter(e, 3, "null").c_str());
+          m_first = false;
+        }
+      }
+      std::fflush(m_out);
+    }
+
+    void end() {
+      if (m_format == "json")
+        fprintf(m_out, "\n]\n");
+    }
+
+  private:
+    //=========================================================================
+    // Return the median of the j-th counter of `e', or `missing' if the
+    // counter was not collected.
+    //=========================================================================
+    static std::string counter(const benchmark_samples::entry &e,
+        std::uint64_t j, const std::string &missing) {
+      if (e.m_counters[j].empty()) return missing;
+      char buf[64];
+      std::snprintf(buf, sizeof(buf), "%.2Lf",
+          benchmark_statistics(e.m_counters[j]).m_median);
+      return buf;
+    }
+
+    static std::string csv(const std::string &s) {
+      if (s.find_first_of(",\"") == std::string::npos) return s;
+      std::string ret = "\"";
+      for (std::uint64_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"') ret += '"';
+        ret += s[i];
+      }
+      return ret + "\"";
+    }
+
+    static std::string json(const std::string &s) {
+      std::string ret = "\"";
+      for (std::uint64_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"' || s[i] == '\\') ret += '\\';
+        ret += s[i];
+      }
+      return ret + "\"";
+    }
+};
+
+#endif  // __BENCHMARK_HPP_INCLUDED
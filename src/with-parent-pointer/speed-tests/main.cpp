@@ -3,273 +3,1024 @@
 #include <cstdint>
 #include <algorithm>
 #include <map>
-#include <sstream>
-#include <limits>
+#include <set>
+#include <string>
 #include <vector>
-#include <ctime>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <type_traits>
 #include <unistd.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/stat.h>
 
 #include "zip_tree.hpp"
+#include "compact_zip_tree.hpp"
+#include "concurrent_zip_tree.hpp"
+#include "mapped_zip_tree.hpp"
+#include "blocked_zip_tree.hpp"
+#include "benchmark.hpp"
+#include "no-parent-pointer/zip_tree.hpp"
+#include "no-parent-pointer/persistent_zip_tree.hpp"
 
 
-long double wallclock() {
-  timeval tim;
-  gettimeofday(&tim, NULL);
-  return tim.tv_sec + (tim.tv_usec / 1000000.0L);
-}
+//=============================================================================
+// The test data of one configuration: the items in the order of
+// insertion (which is also the order of deletion), the keys to look
+// up, and the distinct keys in increasing order.
+//=============================================================================
+template<typename key_type, typename value_type>
+struct workload {
+  typedef std::pair<key_type, value_type> pair_type;
+  std::string m_distribution;
+  std::vector<pair_type> m_items;
+  std::vector<key_type> m_lookups;
+  std::vector<key_type> m_sorted;
 
-std::uint64_t random_int(std::uint64_t p, std::uint64_t r) {
-  std::uint64_t r30 = RAND_MAX * rand() + rand();
-  std::uint64_t s30 = RAND_MAX * rand() + rand();
-  std::uint64_t t4  = rand() & 0xf;
-  std::uint64_t r64 = (r30 << 34) + (s30 << 4) + t4;
-  return p + r64 % (r - p + 1);
-}
+  workload(
+      const std::string &distribution,
+      std::uint64_t n,
+      std::uint64_t seed)
+    : m_distribution(distribution) {
+    key_generator generator(distribution, n, seed);
+    std::vector<std::uint64_t> keys = generator.insertions();
+    std::vector<std::uint64_t> lookups = generator.lookups(keys);
+    m_items.resize(n);
+    m_lookups.resize(n);
+    for (std::uint64_t i = 0; i < n; ++i) {
+      m_items[i].first = benchmark_type<key_type>::key(keys[i]);
+      m_items[i].second = benchmark_type<value_type>::value(i);
+      m_lookups[i] = benchmark_type<key_type>::key(lookups[i]);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    m_sorted.resize(keys.size());
+    for (std::uint64_t i = 0; i < keys.size(); ++i)
+      m_sorted[i] = benchmark_type<key_type>::key(keys[i]);
+  }
+};
 
-std::string random_string() {
-  uint64_t hash = random_int(0,
-      std::numeric_limits<std::uint64_t>::max() - 1);
-  std::stringstream ss;
-  ss << hash;
-  return ss.str();
-}
+//=============================================================================
+// Adapters giving the compared structures a common interface. The
+// search() of every adapter finds the value without copying it (with
+// std::map::find() or zip_tree::lookup()), and returns its checksum
+// (or 0 if the key is not found). Also iterate() reads every value in
+// place.
+//=============================================================================
+template<typename key_type, typename value_type>
+class map_adapter {
+  private:
+    typedef std::map<key_type, value_type> map_type;
+    map_type m_map;
 
-int main() {
-  srand(time(0) + getpid());
+  public:
+    inline void insert(const key_type &key, const value_type &value) {
+      m_map.insert(std::make_pair(key, value));
+    }
 
-  // Try different sequences of operations
-  // and compare the timing results to
-  // red-black trees (std::map class)
-  // from c++ standard library.
-  {
-    typedef std::uint64_t key_type;
-    typedef std::string value_type;
+    inline void erase(const key_type &key) {
+      m_map.erase(key);
+    }
 
-    // Allocate test data.
-    static const std::uint64_t n_items = 4000000;
-    typedef std::pair<key_type, value_type> pair_type;
-    pair_type *data = new pair_type[n_items];
-    for (std::uint64_t i = 0; i < n_items; ++i) {
-      key_type key =
-        random_int(0, std::numeric_limits<std::uint64_t>::max() - 1);
-      value_type value = random_string();
-      data[i] = std::make_pair(key, value);
+    inline std::uint64_t search(const key_type &key) const {
+      typename map_type::const_iterator it = m_map.find(key);
+      if (it == m_map.end()) return 0;
+      return benchmark_type<value_type>::checksum(it->second);
     }
 
-    // Test random insertions.
-    fprintf(stderr, "insert(random):\n");
+    std::uint64_t iterate() const {
+      std::uint64_t checksum = 0;
+      for (typename map_type::const_iterator it = m_map.begin();
+          it != m_map.end(); ++it)
+        checksum += benchmark_type<value_type>::checksum(it->second);
+      return checksum;
+    }
 
-    // Test red-black tree.
-    {
-      typedef std::map<key_type, value_type> map_type;
-      map_type m;
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m[data[i].first] = data[i].second;
-      long double elapsed = wallclock() - start;
-      fprintf(stderr, "\tredblack: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
+    long double bytes_per_item(std::uint64_t) const {
+      return 0.L;
     }
+};
 
-    // Test zip-tree.
-    {
-      typedef zip_tree<key_type, value_type> zip_tree_type;
-      zip_tree_type *tree = new zip_tree_type();
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->insert(data[i].first, data[i].second);
-      long double elapsed = wallclock() - start;
-      fprintf(stderr, "\tzip-tree: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
-      delete tree;
+//=============================================================================
+// std::set holds only the keys, which shows the cost of the values.
+// Its checksums count the keys found.
+//=============================================================================
+template<typename key_type, typename value_type>
+class set_adapter {
+  private:
+    typedef std::set<key_type> set_type;
+    set_type m_set;
+
+  public:
+    inline void insert(const key_type &key, const value_type &) {
+      m_set.insert(key);
     }
 
-    // Test random insertions.
-    fprintf(stderr, "insert(sorted):\n");
-    std::sort(data, data + n_items);
+    inline void erase(const key_type &key) {
+      m_set.erase(key);
+    }
 
-    // Test red-black tree.
-    {
-      typedef std::map<key_type, value_type> map_type;
-      map_type m;
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m[data[i].first] = data[i].second;
-      long double elapsed = wallclock() - start;
-      fprintf(stderr, "\tredblack: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
+    inline std::uint64_t search(const key_type &key) const {
+      return m_set.find(key) != m_set.end();
     }
 
-    // Test zip-tree.
-    {
-      typedef zip_tree<key_type, value_type> zip_tree_type;
-      zip_tree_type *tree = new zip_tree_type();
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->insert(data[i].first, data[i].second);
-      long double elapsed = wallclock() - start;
-      fprintf(stderr, "\tzip-tree: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
-      delete tree;
+    std::uint64_t iterate() const {
+      std::uint64_t checksum = 0;
+      for (typename set_type::const_iterator it = m_set.begin();
+          it != m_set.end(); ++it)
+        ++checksum;
+      return checksum;
     }
 
-    fprintf(stderr, "delete(random)\n");
-    std::random_shuffle(data, data + n_items);
+    long double bytes_per_item(std::uint64_t) const {
+      return 0.L;
+    }
+};
 
-    // Test red-black tree.
-    {
-      typedef std::map<key_type, value_type> map_type;
-      map_type m;
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m[data[i].first] = data[i].second;
+//=============================================================================
+// Adapter of the zip tree variants. The memory per item is the memory
+// reserved by the tree: the chunks of the pool, including the free and
+// never used slots, for the pointer-based trees, and the capacity of
+// the arena for the index-based tree.
+//=============================================================================
+template<
+  typename key_type,
+  typename value_type,
+  typename tree_type>
+class tree_adapter {
+  private:
+    tree_type m_tree;
 
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m.erase(data[i].first);
-      long double elapsed = wallclock() - start;
+  public:
+    inline void insert(const key_type &key, const value_type &value) {
+      m_tree.insert(key, value);
+    }
 
-      fprintf(stderr, "\tredblack: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
+    inline void erase(const key_type &key) {
+      m_tree.erase(key);
     }
 
-    // Test zip-tree.
-    {
-      typedef zip_tree<key_type, value_type> zip_tree_type;
-      zip_tree_type *tree = new zip_tree_type();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->insert(data[i].first, data[i].second);
-
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->erase(data[i].first);
-      long double elapsed = wallclock() - start;
-
-      fprintf(stderr, "\tzip-tree: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
-      delete tree;
+    inline std::uint64_t search(const key_type &key) const {
+      const value_type *value = m_tree.lookup(key);
+      return value ? benchmark_type<value_type>::checksum(*value) : 0;
     }
 
-    fprintf(stderr, "delete(sorted)\n");
-    std::sort(data, data + n_items);
+    std::uint64_t iterate() {
+      std::uint64_t checksum = 0;
+      for (typename tree_type::iterator it = m_tree.begin();
+          it != m_tree.end(); ++it)
+        checksum += benchmark_type<value_type>::checksum(it.value());
+      return checksum;
+    }
 
-    // Test red-black tree.
-    {
-      typedef std::map<key_type, value_type> map_type;
-      map_type m;
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m[data[i].first] = data[i].second;
+    long double bytes_per_item(std::uint64_t n_items) const {
+      return (long double)m_tree.memory_usage() / std::max(n_items, 1UL);
+    }
+};
 
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m.erase(data[i].first);
-      long double elapsed = wallclock() - start;
+//=============================================================================
+// The basic operations: insert all items (in the order given by the
+// distribution), search for all lookup keys, iterate over all items
+// and delete all items (in the order of insertion).
+//=============================================================================
+template<typename structure_type, typename key_type, typename value_type>
+void run_basic(
+    const std::string &name,
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples) {
+  static const char *benchmarks[5] =
+    { "insert", "memory", "search", "iterate", "erase" };
+  bool any = false;
+  for (std::uint64_t t = 0; t < 5; ++t)
+    any |= samples.selected(benchmarks[t], name);
+  if (!any) return;
 
-      fprintf(stderr, "\tredblack: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
-    }
+  std::uint64_t n_items = w.m_items.size();
+  std::uint64_t n_distinct = w.m_sorted.size();
+  structure_type *s = new structure_type();
+  benchmark_timer timer;
+  for (std::uint64_t i = 0; i < n_items; ++i)
+    s->insert(w.m_items[i].first, w.m_items[i].second);
+  samples.add_timing("insert", name, "ns/op", timer, n_items);
+  long double bytes = s->bytes_per_item(n_distinct);
+  if (bytes > 0.L)
+    samples.add("memory", name, "bytes/item", bytes);
 
-    // Test zip-tree.
-    {
-      typedef zip_tree<key_type, value_type> zip_tree_type;
-      zip_tree_type *tree = new zip_tree_type();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->insert(data[i].first, data[i].second);
-
-      long double start = wallclock();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->erase(data[i].first);
-      long double elapsed = wallclock() - start;
-
-      fprintf(stderr, "\tzip-tree: %.2Lf ns/op\n",
-          (1000000000.L * elapsed) / n_items);
-      delete tree;
+  timer.reset();
+  std::uint64_t checksum = 0;
+  for (std::uint64_t i = 0; i < n_items; ++i)
+    checksum += s->search(w.m_lookups[i]);
+  samples.add_timing("search", name, "ns/op", timer, n_items, checksum);
+
+  timer.reset();
+  checksum = s->iterate();
+  samples.add_timing("iterate", name, "ns/item", timer, n_distinct,
+      checksum);
+
+  timer.reset();
+  for (std::uint64_t i = 0; i < n_items; ++i)
+    s->erase(w.m_items[i].first);
+  samples.add_timing("erase", name, "ns/op", timer, n_items);
+  delete s;
+}
+
+//=============================================================================
+// The latencies of the basic operations (--mode=latency): the same
+// insertions, searches and deletions as in run_basic(), but each of
+// them timed on its own, which shows the tails of the distribution of
+// their times hidden by the averages, e.g., the long zip and unzip
+// paths of zip trees, or the rebalancing of Red-Black trees.
+//=============================================================================
+template<typename structure_type, typename key_type, typename value_type>
+void run_latency(
+    const std::string &name,
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples,
+    const latency_clock &clock) {
+  static const char *benchmarks[3] =
+    { "insert latency", "search latency", "erase latency" };
+  bool any = false;
+  for (std::uint64_t t = 0; t < 3; ++t)
+    any |= samples.selected(benchmarks[t], name);
+  if (!any) return;
+
+  std::uint64_t n_items = w.m_items.size();
+  latency_histogram histograms[3];
+  structure_type *s = new structure_type();
+  for (std::uint64_t i = 0; i < n_items; ++i) {
+    std::uint64_t start = latency_clock::ticks();
+    s->insert(w.m_items[i].first, w.m_items[i].second);
+    histograms[0].record(clock.elapsed(start, latency_clock::ticks()));
+  }
+
+  std::uint64_t checksum = 0;
+  for (std::uint64_t i = 0; i < n_items; ++i) {
+    std::uint64_t start = latency_clock::ticks();
+    checksum += s->search(w.m_lookups[i]);
+    histograms[1].record(clock.elapsed(start, latency_clock::ticks()));
+  }
+
+  for (std::uint64_t i = 0; i < n_items; ++i) {
+    std::uint64_t start = latency_clock::ticks();
+    s->erase(w.m_items[i].first);
+    histograms[2].record(clock.elapsed(start, latency_clock::ticks()));
+  }
+  delete s;
+
+  for (std::uint64_t t = 0; t < 3; ++t)
+    samples.add_latency(benchmarks[t], name, histograms[t], clock,
+        t == 1 ? checksum : 0);
+}
+
+//=============================================================================
+// Alternatives to the basic operations offered by zip_tree: inserting
+// all items with a single call of insert_batch() (which sorts the batch
+// and merges it into the tree with union_with(), both on all hardware
+// threads), building the tree from sorted items in one pass with
+// build_from_sorted(), searching with search_batch() (which advances
+// 16 lookups in lock-step and prefetches the next node of each), and
+// searching and iterating after relayout() (which moves the nodes into
+// one contiguous block in the van Emde Boas order). The average number
+// of nodes visited by a search for a key in the tree is also reported.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_zip_tree_variants(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples) {
+  typedef zip_tree<key_type, value_type> zip_tree_type;
+  std::uint64_t n_items = w.m_items.size();
+  std::uint64_t n_distinct = w.m_sorted.size();
+
+  if (samples.selected("insert", "zip-tree (insert_batch)")) {
+    zip_tree_type tree;
+    benchmark_timer timer;
+    tree.insert_batch(w.m_items.data(), n_items);
+    samples.add_timing("insert", "zip-tree (insert_batch)", "ns/op", timer,
+        n_items);
+  }
+
+  if (w.m_distribution == "sorted" &&
+      samples.selected("insert", "zip-tree (build_from_sorted)")) {
+    zip_tree_type tree;
+    benchmark_timer timer;
+    tree.build_from_sorted(w.m_items.begin(), w.m_items.end());
+    samples.add_timing("insert", "zip-tree (build_from_sorted)", "ns/op",
+        timer, n_items);
+  }
+
+  if (samples.selected("search", "zip-tree (batched)") ||
+      samples.selected("search depth", "zip-tree") ||
+      samples.selected("relayout", "zip-tree") ||
+      samples.selected("search", "zip-tree (relayout)") ||
+      samples.selected("iterate", "zip-tree (relayout)")) {
+    zip_tree_type tree;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      tree.insert(w.m_items[i].first, w.m_items[i].second);
+    samples.add("search depth", "zip-tree", "nodes",
+        tree.average_search_depth());
+
+    std::vector<const value_type*> results(n_items);
+    benchmark_timer timer;
+    tree.search_batch(w.m_lookups.data(), n_items, results.data());
+    std::uint64_t checksum = 0;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      if (results[i])
+        checksum += benchmark_type<value_type>::checksum(*results[i]);
+    samples.add_timing("search", "zip-tree (batched)", "ns/op", timer,
+        n_items, checksum);
+
+    timer.reset();
+    tree.relayout();
+    samples.add_timing("relayout", "zip-tree", "ns/item", timer, n_distinct);
+
+    timer.reset();
+    checksum = 0;
+    for (std::uint64_t i = 0; i < n_items; ++i) {
+      const value_type *value = tree.lookup(w.m_lookups[i]);
+      if (value) checksum += benchmark_type<value_type>::checksum(*value);
     }
+    samples.add_timing("search", "zip-tree (relayout)", "ns/op", timer,
+        n_items, checksum);
+
+    timer.reset();
+    checksum = 0;
+    for (typename zip_tree_type::iterator it = tree.begin();
+        it != tree.end(); ++it)
+      checksum += benchmark_type<value_type>::checksum(it.value());
+    samples.add_timing("iterate", "zip-tree (relayout)", "ns/item", timer,
+        n_distinct, checksum);
+  }
+}
 
-    fprintf(stderr, "search(random):\n");
-    std::random_shuffle(data, data + n_items);
+//=============================================================================
+// rank() of the size-augmented tree for all lookup keys.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_rank(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples) {
+  typedef zip_tree<key_type, value_type,
+          pool_allocator, random_ranks, true> zip_tree_type;
+  if (!samples.selected("rank", "zip-tree (size-augmented)")) return;
+  std::uint64_t n_items = w.m_items.size();
+  zip_tree_type tree;
+  for (std::uint64_t i = 0; i < n_items; ++i)
+    tree.insert(w.m_items[i].first, w.m_items[i].second);
+  benchmark_timer timer;
+  std::uint64_t checksum = 0;
+  for (std::uint64_t i = 0; i < n_items; ++i)
+    checksum += tree.rank(w.m_lookups[i]);
+  samples.add("rank", "zip-tree (size-augmented)", "ns/op",
+      timer.ns_per_op(n_items), checksum);
+}
+
+//=============================================================================
+// Range scans: for random ranges containing `len' items, visit all
+// items with lo <= key < hi. For zip-tree we both iterate from
+// lower_bound() and use for_each_in_range().
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_range_scans(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples,
+    random_generator &random) {
+  typedef std::map<key_type, value_type> map_type;
+  typedef zip_tree<key_type, value_type> zip_tree_type;
+  typedef benchmark_type<value_type> value_traits;
+  static const char *names[3] =
+    { "std::map", "zip-tree", "zip-tree (for_each_in_range)" };
+  static const std::uint64_t lengths[2] = { 10, 10000 };
+  static const std::uint64_t n_queries[2] = { 100000, 1000 };
+  const std::vector<key_type> &keys = w.m_sorted;
+  if (keys.size() < 2) return;
+  std::string benchmarks[2];
+  bool any = false;
+  for (std::uint64_t t = 0; t < 2; ++t) {
+    benchmarks[t] = "range-scan(" +
+      std::to_string(std::min(lengths[t], keys.size() - 1)) + " items)";
+    for (std::uint64_t k = 0; k < 3; ++k)
+      any |= samples.selected(benchmarks[t], names[k]);
+  }
+  if (!any) return;
+  map_type m;
+  zip_tree_type tree;
+  for (std::uint64_t i = 0; i < w.m_items.size(); ++i) {
+    m.insert(w.m_items[i]);
+    tree.insert(w.m_items[i].first, w.m_items[i].second);
+  }
+
+  for (std::uint64_t t = 0; t < 2; ++t) {
+    std::uint64_t len = std::min(lengths[t], keys.size() - 1);
+    std::vector<std::uint64_t> starts(n_queries[t]);
+    for (std::uint64_t i = 0; i < n_queries[t]; ++i)
+      starts[i] = random() % (keys.size() - len);
+    const std::string &name = benchmarks[t];
 
     // Test red-black tree.
     {
-      typedef std::map<key_type, value_type> map_type;
-      map_type m;
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m[data[i].first] = data[i].second;
-      long double start = wallclock();
+      benchmark_timer timer;
       std::uint64_t checksum = 0;
-      for (std::uint64_t i = 0; i < n_items; ++i) {
-        value_type value = m[data[i].first];
-        checksum += (std::uint64_t)value[0];
+      for (std::uint64_t i = 0; i < n_queries[t]; ++i) {
+        const key_type &lo = keys[starts[i]];
+        const key_type &hi = keys[starts[i] + len];
+        for (typename map_type::iterator it = m.lower_bound(lo);
+            it != m.end() && it->first < hi; ++it)
+          checksum += value_traits::checksum(it->second);
       }
-      long double elapsed = wallclock() - start;
-
-      fprintf(stderr, "\tredblack: %.2Lf ns/op (checksum = %lu)\n",
-          (1000000000.L * elapsed) / n_items, checksum);
+      samples.add(name, names[0], "ns/query",
+          timer.ns_per_op(n_queries[t]), checksum);
     }
 
     // Test zip-tree.
     {
-      typedef zip_tree<key_type, value_type> zip_tree_type;
-      zip_tree_type *tree = new zip_tree_type();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->insert(data[i].first, data[i].second);
+      benchmark_timer timer;
+      std::uint64_t checksum = 0;
+      for (std::uint64_t i = 0; i < n_queries[t]; ++i) {
+        const key_type &lo = keys[starts[i]];
+        const key_type &hi = keys[starts[i] + len];
+        for (typename zip_tree_type::iterator it = tree.lower_bound(lo);
+            it != tree.end() && it.key() < hi; ++it)
+          checksum += value_traits::checksum(it.value());
+      }
+      samples.add(name, names[1], "ns/query",
+          timer.ns_per_op(n_queries[t]), checksum);
+    }
 
-      long double start = wallclock();
+    // Test zip-tree visitor.
+    {
+      benchmark_timer timer;
       std::uint64_t checksum = 0;
-      for (std::uint64_t i = 0; i < n_items; ++i) {
-        std::pair<bool, value_type> ret = tree->search(data[i].first);
-        checksum += (std::uint64_t)ret.second[0];
+      for (std::uint64_t i = 0; i < n_queries[t]; ++i) {
+        const key_type &lo = keys[starts[i]];
+        const key_type &hi = keys[starts[i] + len];
+        tree.for_each_in_range(lo, hi,
+            [&checksum](const key_type &, value_type &value) {
+              checksum += value_traits::checksum(value);
+            });
       }
-      long double elapsed = wallclock() - start;
+      samples.add(name, names[2], "ns/query",
+          timer.ns_per_op(n_queries[t]), checksum);
+    }
+  }
+}
+
+//=============================================================================
+// Repartitioning: move all items with keys >= a random key into
+// a separate tree and then merge the two trees back. For red-black
+// tree, the items are moved one by one (which is done only once, as
+// it takes time linear in the number of items), for zip-tree we use
+// split() and join().
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_split_join(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples) {
+  typedef std::map<key_type, value_type> map_type;
+  typedef zip_tree<key_type, value_type> zip_tree_type;
+  std::uint64_t n_items = w.m_items.size();
+
+  // Test red-black tree.
+  if (samples.selected("split+join", "std::map")) {
+    map_type m(w.m_items.begin(), w.m_items.end());
+    benchmark_timer timer;
+    typename map_type::iterator it = m.lower_bound(w.m_items[0].first);
+    map_type right(it, m.end());
+    m.erase(it, m.end());
+    m.insert(right.begin(), right.end());
+    samples.add("split+join", "std::map", "ns/op", timer.ns_per_op(1),
+        m.size());
+  }
 
-      fprintf(stderr, "\tzip-tree: %.2Lf ns/op (checksum = %lu)\n",
-          (1000000000.L * elapsed) / n_items, checksum);
-      delete tree;
+  // Test zip-tree.
+  if (samples.selected("split+join", "zip-tree")) {
+    zip_tree_type tree;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      tree.insert(w.m_items[i].first, w.m_items[i].second);
+    static const std::uint64_t n_repartitions = 100000;
+    benchmark_timer timer;
+    for (std::uint64_t i = 0; i < n_repartitions; ++i) {
+      std::pair<zip_tree_type, zip_tree_type> p =
+        tree.split(w.m_items[i % n_items].first);
+      tree = zip_tree_type::join(std::move(p.first), std::move(p.second));
     }
+    samples.add("split+join", "zip-tree", "ns/op",
+        timer.ns_per_op(n_repartitions), tree.size());
+  }
+}
 
-    fprintf(stderr, "iterate-all:\n");
+//=============================================================================
+// Set operations on two trees, containing the first and the last
+// two thirds of the items respectively. For red-black trees we use
+// std::set_union() (etc.) over std::map iterators, inserting the
+// result at the end of a new std::map. For zip-tree we also show the
+// insertion of all items of one tree into the other, which is how the
+// union would be computed otherwise. Times are given per item (of all
+// items in both trees).
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_set_operations(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples) {
+  typedef std::map<key_type, value_type> map_type;
+  typedef zip_tree<key_type, value_type> zip_tree_type;
+  static const char *names[3] =
+    { "set-union", "set-intersection", "set-difference" };
+  const std::vector<std::pair<key_type, value_type> > &items = w.m_items;
+  std::uint64_t n_items = items.size();
+  std::uint64_t n_first = (2 * n_items) / 3;
+  std::uint64_t n_second_beg = n_items / 3;
+  map_type m1(items.begin(), items.begin() + n_first);
+  map_type m2(items.begin() + n_second_beg, items.end());
+  for (std::uint64_t t = 0; t < 3; ++t) {
 
     // Test red-black tree.
-    {
-      typedef std::map<key_type, value_type> map_type;
-      map_type m;
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        m[data[i].first] = data[i].second;
-      long double start = wallclock();
-      std::uint64_t checksum = 0;
-      for (map_type::iterator it = m.begin(); it != m.end(); ++it) {
-        value_type value = it->second;
-        checksum += (std::uint64_t)value[0];
-      }
-      long double elapsed = wallclock() - start;
+    if (samples.selected(names[t], "std::map")) {
+      map_type result;
+      benchmark_timer timer;
+      if (t == 0)
+        std::set_union(m1.begin(), m1.end(), m2.begin(), m2.end(),
+            std::inserter(result, result.end()), m1.value_comp());
+      else if (t == 1)
+        std::set_intersection(m1.begin(), m1.end(), m2.begin(), m2.end(),
+            std::inserter(result, result.end()), m1.value_comp());
+      else
+        std::set_difference(m1.begin(), m1.end(), m2.begin(), m2.end(),
+            std::inserter(result, result.end()), m1.value_comp());
+      samples.add(names[t], "std::map", "ns/item",
+          timer.ns_per_op(n_items), result.size());
+    }
 
-      fprintf(stderr, "\tredblack: %.2Lf ns/op (checksum = %lu)\n",
-          (1000000000.L * elapsed) / n_items, checksum);
+    // Test zip-tree, inserting one tree into the other.
+    if (t == 0 && samples.selected(names[t], "zip-tree (insert)")) {
+      zip_tree_type tree1, tree2;
+      for (std::uint64_t i = 0; i < n_first; ++i)
+        tree1.insert(items[i].first, items[i].second);
+      for (std::uint64_t i = n_second_beg; i < n_items; ++i)
+        tree2.insert(items[i].first, items[i].second);
+      benchmark_timer timer;
+      for (typename zip_tree_type::iterator it = tree2.begin();
+          it != tree2.end(); ++it)
+        tree1.insert(it.key(), it.value());
+      samples.add(names[t], "zip-tree (insert)", "ns/item",
+          timer.ns_per_op(n_items), tree1.size());
     }
 
     // Test zip-tree.
-    {
-      typedef zip_tree<key_type, value_type> zip_tree_type;
-      zip_tree_type *tree = new zip_tree_type();
-      for (std::uint64_t i = 0; i < n_items; ++i)
-        tree->insert(data[i].first, data[i].second);
+    if (samples.selected(names[t], "zip-tree")) {
+      zip_tree_type tree1, tree2;
+      for (std::uint64_t i = 0; i < n_first; ++i)
+        tree1.insert(items[i].first, items[i].second);
+      for (std::uint64_t i = n_second_beg; i < n_items; ++i)
+        tree2.insert(items[i].first, items[i].second);
+      benchmark_timer timer;
+      if (t == 0) tree1.union_with(std::move(tree2));
+      else if (t == 1) tree1.intersect_with(std::move(tree2));
+      else tree1.difference_with(std::move(tree2));
+      samples.add(names[t], "zip-tree", "ns/item",
+          timer.ns_per_op(n_items), tree1.size());
+    }
+  }
+}
 
-      long double start = wallclock();
-      std::uint64_t checksum = 0;
-      for (zip_tree_type::iterator it = tree->begin(); it != tree->end(); ++it) {
-        value_type value = it.value();
-        checksum += (std::uint64_t)value[0];
+//=============================================================================
+// Read/write mix: `n_readers' threads search for keys while one writer
+// thread inserts and deletes keys, for one second. The structure
+// initially holds half of the items, the writer alternates insertions
+// and deletions of the other half. std::map and zip_tree are guarded by
+// a global mutex, and concurrent_zip_tree is used without any external
+// locking. The checksums count the keys found by the readers.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_read_write_mix(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples) {
+  typedef std::map<key_type, value_type> map_type;
+  typedef zip_tree<key_type, value_type> zip_tree_type;
+  typedef concurrent_zip_tree<key_type, value_type> concurrent_zip_tree_type;
+  static const char *names[3] =
+    { "std::map + mutex", "zip-tree + mutex", "concurrent zip-tree" };
+  static const std::uint64_t n_readers[3] = { 1, 2, 4 };
+  const std::vector<std::pair<key_type, value_type> > &items = w.m_items;
+  std::uint64_t n_items = items.size();
+  std::uint64_t n_half = n_items / 2;
+  for (std::uint64_t r = 0; r < 3; ++r) {
+    std::string benchmark = "read/write mix (" +
+      std::to_string(n_readers[r]) + " readers, 1 writer)";
+    for (std::uint64_t t = 0; t < 3; ++t) {
+      if (!samples.selected(benchmark, names[t])) continue;
+      map_type m;
+      zip_tree_type tree;
+      concurrent_zip_tree_type ctree;
+      for (std::uint64_t i = 0; i < n_half; ++i) {
+        if (t == 0) m.insert(items[i]);
+        else if (t == 1) tree.insert(items[i].first, items[i].second);
+        else ctree.insert(items[i].first, items[i].second);
+      }
+      std::mutex mutex;
+      std::atomic<bool> done(false);
+      std::atomic<std::uint64_t> n_reads(0), n_writes(0), checksum(0);
+      auto read = [&](const key_type &key) {
+        if (t == 0) {
+          std::lock_guard<std::mutex> guard(mutex);
+          return m.find(key) != m.end();
+        } else if (t == 1) {
+          std::lock_guard<std::mutex> guard(mutex);
+          return tree.contains(key);
+        } else return ctree.search(key).first;
+      };
+      auto write = [&](const std::pair<key_type, value_type> &item,
+          bool ins) {
+        if (t == 0) {
+          std::lock_guard<std::mutex> guard(mutex);
+          if (ins) m.insert(item);
+          else m.erase(item.first);
+        } else if (t == 1) {
+          std::lock_guard<std::mutex> guard(mutex);
+          if (ins) tree.insert(item.first, item.second);
+          else tree.erase(item.first);
+        } else {
+          if (ins) ctree.insert(item.first, item.second);
+          else ctree.erase(item.first);
+        }
+      };
+      std::vector<std::thread> threads;
+      for (std::uint64_t j = 0; j < n_readers[r]; ++j) {
+        threads.push_back(std::thread([&, j]() {
+          std::uint64_t count = 0, found = 0;
+          for (std::uint64_t i = j % n_items;
+              !done.load(std::memory_order_relaxed);
+              i = (i + 7919) % n_items, ++count)
+            found += read(items[i].first);
+          n_reads.fetch_add(count);
+          checksum.fetch_add(found);
+        }));
+      }
+      threads.push_back(std::thread([&]() {
+        std::uint64_t count = 0;
+        for (std::uint64_t i = 0; !done.load(std::memory_order_relaxed);
+            ++i, ++count)
+          write(items[n_half + (i / 2) % (n_items - n_half)], i % 2 == 0);
+        n_writes.fetch_add(count);
+      }));
+      benchmark_timer timer;
+      while (timer.elapsed() < 1.0L)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      done.store(true);
+      for (std::uint64_t j = 0; j < threads.size(); ++j)
+        threads[j].join();
+      long double elapsed = timer.elapsed();
+      samples.add(benchmark, names[t], "Mops/s (reads)",
+          n_reads.load() / elapsed / 1000000.L, checksum.load());
+      samples.add(benchmark, names[t], "Mops/s (writes)",
+          n_writes.load() / elapsed / 1000000.L);
+    }
+  }
+}
+
+//=============================================================================
+// Snapshots: 100 rounds, each taking a snapshot of the tree (released
+// in the next round) and then deleting and reinserting 1000 random
+// items. For red-black tree the snapshot is a full copy, for
+// persistent_zip_tree (see no-parent-pointer/persistent_zip_tree.hpp)
+// it takes O(1) time, and the following updates copy the nodes shared
+// with the snapshot.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_snapshots(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples,
+    random_generator &random) {
+  typedef std::map<key_type, value_type> map_type;
+  typedef no_parent_pointer::persistent_zip_tree<key_type, value_type>
+    zip_tree_type;
+  static const std::uint64_t n_rounds = 100;
+  static const std::uint64_t n_updates = 1000;
+  static const char *benchmark = "snapshot + 1000 updates";
+  const std::vector<std::pair<key_type, value_type> > &items = w.m_items;
+  std::uint64_t n_items = items.size();
+  std::vector<std::uint64_t> updates(n_rounds * n_updates);
+  for (std::uint64_t i = 0; i < updates.size(); ++i)
+    updates[i] = random() % n_items;
+
+  // Test red-black tree.
+  if (samples.selected(benchmark, "std::map (copy)")) {
+    map_type m(items.begin(), items.end());
+    benchmark_timer timer;
+    map_type snapshot;
+    std::uint64_t checksum = 0;
+    for (std::uint64_t r = 0; r < n_rounds; ++r) {
+      snapshot = m;
+      checksum += snapshot.size();
+      for (std::uint64_t i = 0; i < n_updates; ++i) {
+        const std::pair<key_type, value_type> &p =
+          items[updates[r * n_updates + i]];
+        m.erase(p.first);
+        m.insert(p);
       }
-      long double elapsed = wallclock() - start;
+    }
+    samples.add(benchmark, "std::map (copy)", "ns/round",
+        timer.ns_per_op(n_rounds), checksum);
+  }
+
+  // Test persistent zip-tree.
+  if (samples.selected(benchmark, "persistent zip-tree")) {
+    zip_tree_type tree;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      tree.insert(items[i].first, items[i].second);
+    benchmark_timer timer;
+    zip_tree_type snapshot;
+    std::uint64_t checksum = 0;
+    for (std::uint64_t r = 0; r < n_rounds; ++r) {
+      snapshot = tree.snapshot();
+      checksum += snapshot.size();
+      for (std::uint64_t i = 0; i < n_updates; ++i) {
+        const std::pair<key_type, value_type> &p =
+          items[updates[r * n_updates + i]];
+        tree.erase(p.first);
+        tree.insert(p.first, p.second);
+      }
+    }
+    samples.add(benchmark, "persistent zip-tree", "ns/round",
+        timer.ns_per_op(n_rounds), checksum);
+  }
+}
+
+//=============================================================================
+// Loading a saved tree with uint64_t values: rebuilding it from the
+// sorted items (build_from_sorted) is compared to mapping its image
+// written by save(), see mapped_zip_tree.hpp. The image is served in
+// place, so the cost of loading it is moved to the page faults during
+// the first searches, which are included. Images need trivially
+// copyable keys, so for other keys there is nothing to do.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_load(
+    const workload<key_type, value_type> &,
+    benchmark_samples &,
+    std::false_type) {}
+
+template<typename key_type, typename value_type>
+void run_load(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples,
+    std::true_type) {
+  typedef zip_tree<key_type, std::uint64_t> zip_tree_type;
+  typedef mapped_zip_tree<key_type, std::uint64_t> mapped_tree_type;
+  if (!samples.selected("load", "zip-tree (rebuild)") &&
+      !samples.selected("load", "zip-tree (mmap)") &&
+      !samples.selected("search after load", "zip-tree (rebuild)") &&
+      !samples.selected("search after load", "zip-tree (mmap)")) return;
+  std::uint64_t n_items = w.m_items.size();
+  std::vector<std::pair<key_type, std::uint64_t> > items(n_items);
+  for (std::uint64_t i = 0; i < n_items; ++i)
+    items[i] = std::make_pair(w.m_items[i].first, i);
+  std::sort(items.begin(), items.end());
+  char path[] = "/tmp/zip_tree_image_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) return;
+  close(fd);
+  {
+    zip_tree_type tree;
+    tree.build_from_sorted(items.begin(), items.end());
+    tree.save(path);
+  }
+
+  // Test zip-tree.
+  {
+    benchmark_timer timer;
+    zip_tree_type tree;
+    tree.build_from_sorted(items.begin(), items.end());
+    samples.add("load", "zip-tree (rebuild)", "ms",
+        1000.L * timer.elapsed());
+    timer.reset();
+    std::uint64_t checksum = 0;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      checksum += tree.search(w.m_lookups[i]).second;
+    samples.add("search after load", "zip-tree (rebuild)", "ns/op",
+        timer.ns_per_op(n_items), checksum);
+  }
+
+  // Test mapped zip-tree.
+  {
+    benchmark_timer timer;
+    mapped_tree_type tree(path);
+    samples.add("load", "zip-tree (mmap)", "ms", 1000.L * timer.elapsed());
+    timer.reset();
+    std::uint64_t checksum = 0;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      checksum += tree.search(w.m_lookups[i]).second;
+    samples.add("search after load", "zip-tree (mmap)", "ns/op",
+        timer.ns_per_op(n_items), checksum);
+  }
+  unlink(path);
+}
+
+//=============================================================================
+// The basic operations of a zip_tree of std::string keys compared with
+// three_way_less, which calls std::string::compare() once per level of
+// the descent instead of "<" in both directions. For other keys there
+// is nothing to do.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_three_way(
+    const workload<key_type, value_type> &,
+    benchmark_samples &,
+    std::false_type) {}
+
+template<typename key_type, typename value_type>
+void run_three_way(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples,
+    std::true_type) {
+  typedef zip_tree<key_type, value_type, pool_allocator, random_ranks,
+          false, no_stats, three_way_less> three_way_zip_tree_type;
+  run_basic<tree_adapter<key_type, value_type, three_way_zip_tree_type> >(
+      "zip-tree (three-way)", w, samples);
+}
+
+//=============================================================================
+// The basic operations of blocked_zip_tree, which stores the items of
+// rank below 3 in sorted blocks of up to 16 uint64_t keys, searched
+// with AVX2 compares, instead of in the last levels of the tree. It is
+// only defined for uint64_t keys, so for other keys there is nothing
+// to do.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_leaf_blocks(
+    const workload<key_type, value_type> &,
+    benchmark_samples &,
+    std::false_type) {}
+
+template<typename key_type, typename value_type>
+void run_leaf_blocks(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples,
+    std::true_type) {
+  run_basic<tree_adapter<key_type, value_type,
+    blocked_zip_tree<value_type> > >("zip-tree (leaf blocks)", w, samples);
+}
 
-      fprintf(stderr, "\tzip-tree: %.2Lf ns/op (checksum = %lu)\n",
-          (1000000000.L * elapsed) / n_items, checksum);
-      delete tree;
+//=============================================================================
+// Searching a tree of std::string keys for C strings: with the default
+// comparator, every lookup first converts its query to a std::string
+// (which allocates for all but the shortest strings), while
+// transparent_less compares the query with the keys as it is. For
+// other keys there is nothing to do.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_c_string_search(
+    const workload<key_type, value_type> &,
+    benchmark_samples &,
+    std::false_type) {}
+
+template<typename key_type, typename value_type>
+void run_c_string_search(
+    const workload<key_type, value_type> &w,
+    benchmark_samples &samples,
+    std::true_type) {
+  typedef zip_tree<key_type, value_type> zip_tree_type;
+  typedef zip_tree<key_type, value_type, pool_allocator, random_ranks,
+          false, no_stats, transparent_less> transparent_zip_tree_type;
+  if (!samples.selected("search (const char*)", "zip-tree") &&
+      !samples.selected("search (const char*)", "zip-tree (transparent)"))
+    return;
+  std::uint64_t n_items = w.m_items.size();
+  std::vector<const char*> queries(n_items);
+  for (std::uint64_t i = 0; i < n_items; ++i)
+    queries[i] = w.m_lookups[i].c_str();
+
+  // Test zip-tree.
+  {
+    zip_tree_type tree;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      tree.insert(w.m_items[i].first, w.m_items[i].second);
+    benchmark_timer timer;
+    std::uint64_t checksum = 0;
+    for (std::uint64_t i = 0; i < n_items; ++i) {
+      const value_type *value = tree.lookup(queries[i]);
+      if (value) checksum += benchmark_type<value_type>::checksum(*value);
+    }
+    samples.add_timing("search (const char*)", "zip-tree", "ns/op", timer,
+        n_items, checksum);
+  }
+
+  // Test zip-tree with transparent_less.
+  {
+    transparent_zip_tree_type tree;
+    for (std::uint64_t i = 0; i < n_items; ++i)
+      tree.insert(w.m_items[i].first, w.m_items[i].second);
+    benchmark_timer timer;
+    std::uint64_t checksum = 0;
+    for (std::uint64_t i = 0; i < n_items; ++i) {
+      const value_type *value = tree.lookup(queries[i]);
+      if (value) checksum += benchmark_type<value_type>::checksum(*value);
     }
+    samples.add_timing("search (const char*)", "zip-tree (transparent)",
+        "ns/op", timer, n_items, checksum);
+  }
+}
+
+//=============================================================================
+// Run all benchmarks for the given key and value types, for every
+// number of items and distribution of keys. The basic operations and
+// the zip_tree alternatives to them run for every distribution, the
+// remaining benchmarks only for the uniform distribution. With
+// --mode=latency, only the latencies of the basic operations of
+// std::map and zip_tree are measured.
+//=============================================================================
+template<typename key_type, typename value_type>
+void run_benchmarks(
+    const benchmark_options &options,
+    const latency_clock &clock,
+    benchmark_reporter &reporter) {
+  typedef zip_tree<key_type, value_type> zip_tree_type;
+  typedef zip_tree<key_type, value_type,
+          pool_allocator, hashed_ranks> hashed_zip_tree_type;
+  typedef zip_tree<key_type, value_type,
+          pool_allocator, random_ranks, true> augmented_zip_tree_type;
+  typedef no_parent_pointer::zip_tree<key_type, value_type>
+    no_parent_zip_tree_type;
+  typedef compact_zip_tree<key_type, value_type> compact_zip_tree_type;
+  typedef std::integral_constant<bool,
+          std::is_trivially_copyable<key_type>::value> loadable;
+  typedef std::integral_constant<bool,
+          std::is_same<key_type, std::string>::value> string_keys;
+  typedef std::integral_constant<bool,
+          std::is_same<key_type, std::uint64_t>::value> u64_keys;
+
+  for (std::uint64_t i = 0; i < options.m_sizes.size(); ++i) {
+    for (std::uint64_t j = 0; j < options.m_distributions.size(); ++j) {
+      const std::string &distribution = options.m_distributions[j];
+      workload<key_type, value_type> w(distribution,
+          options.m_sizes[i], options.m_seed);
+      benchmark_case c;
+      c.m_n = options.m_sizes[i];
+      c.m_distribution = distribution;
+      c.m_key_type = benchmark_type<key_type>::name();
+      c.m_value_type = benchmark_type<value_type>::name();
+      c.m_repetitions = options.m_repetitions;
+      benchmark_samples samples(options);
+      random_generator random(options.m_seed);
+      for (std::uint64_t rep = 0; rep < options.m_repetitions; ++rep) {
+        if (options.m_mode == "latency") {
+          run_latency<map_adapter<key_type, value_type> >(
+              "std::map", w, samples, clock);
+          run_latency<tree_adapter<key_type, value_type, zip_tree_type> >(
+              "zip-tree", w, samples, clock);
+          continue;
+        }
+        run_basic<map_adapter<key_type, value_type> >(
+            "std::map", w, samples);
+        run_basic<set_adapter<key_type, value_type> >(
+            "std::set", w, samples);
+        run_basic<tree_adapter<key_type, value_type, zip_tree_type> >(
+            "zip-tree", w, samples);
+        run_basic<tree_adapter<key_type, value_type, hashed_zip_tree_type> >(
+            "zip-tree (hashed ranks)", w, samples);
+        run_basic<tree_adapter<key_type, value_type,
+          augmented_zip_tree_type> >(
+            "zip-tree (size-augmented)", w, samples);
+        run_basic<tree_adapter<key_type, value_type,
+          no_parent_zip_tree_type> >(
+            "zip-tree (no parent)", w, samples);
+        run_basic<tree_adapter<key_type, value_type,
+          compact_zip_tree_type> >(
+            "compact zip-tree", w, samples);
+        run_three_way(w, samples, string_keys());
+        run_leaf_blocks(w, samples, u64_keys());
+        run_zip_tree_variants(w, samples);
+        if (distribution == "uniform") {
+          run_rank(w, samples);
+          run_range_scans(w, samples, random);
+          run_split_join(w, samples);
+          run_set_operations(w, samples);
+          run_read_write_mix(w, samples);
+          run_snapshots(w, samples, random);
+          run_load(w, samples, loadable());
+          run_c_string_search(w, samples, string_keys());
+        }
+      }
+      reporter.report(c, samples);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  benchmark_options options;
+  if (!options.parse(argc, argv))
+    return EXIT_FAILURE;
 
-    // Clean up.
-    delete[] data;
+  perf_counters::instance().set_enabled(options.m_counters);
+  latency_clock clock;
+  benchmark_reporter reporter(options.m_format, stdout);
+  reporter.begin();
+  for (std::uint64_t i = 0; i < options.m_types.size(); ++i) {
+    const std::string &types = options.m_types[i];
+    if (types == "u64:u64")
+      run_benchmarks<std::uint64_t, std::uint64_t>(options, clock, reporter);
+    else if (types == "u64:string")
+      run_benchmarks<std::uint64_t, std::string>(options, clock, reporter);
+    else run_benchmarks<std::string, std::uint64_t>(options, clock, reporter);
   }
+  reporter.end();
 }
@@ -0,0 +1,364 @@
+/**
+ * @file    mapped_zip_tree.hpp
+ * @section LICENCE
+ *
+ * Implementation of the read-only Zip Tree served from a memory
+ * mapped image, v0.1.0
+ * See: https://github.com/dominikkempa/zip-tree
+ *
+ * Copyright (C) 2018-2020
+ *   Dominik Kempa <dominik.kempa (at) gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ **/
+
+#ifndef __MAPPED_ZIP_TREE_HPP_INCLUDED
+#define __MAPPED_ZIP_TREE_HPP_INCLUDED
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zip_tree.hpp"
+
+
+//=============================================================================
+// Read-only Zip Tree served directly from the image written by
+// zip_tree::save(), see image_header in zip_tree.hpp. The file is
+// mapped into memory and the nodes are accessed in place, so opening
+// the tree takes O(1) time regardless of its size and the pages are
+// only read from disk when first touched. The key_type and value_type
+// must be the same as those of the saved tree. Only the header is
+// validated when opening, but the positions of children are checked
+// by every query, so a corrupted image gives wrong answers rather
+// than reads outside the mapping.
+//=============================================================================
+template<
+  typename key_type,
+  typename value_type>
+class mapped_zip_tree {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef image_node<key_type, value_type> node_type;
+
+    //=========================================================================
+    // The mapping and its length. Node at position i (counting from 1)
+    // is m_nodes[i - 1]. The root, if any, is at position 1.
+    //=========================================================================
+    void *m_map;
+    std::uint64_t m_length;
+    const node_type *m_nodes;
+    std::uint64_t m_size;
+
+  public:
+
+    //=========================================================================
+    // Constructor. Map the image from file `path'. If the file cannot be
+    // mapped or is not a valid image for key_type and value_type, the
+    // tree is empty and is_open() returns false.
+    //=========================================================================
+    explicit mapped_zip_tree(const std::string &path) {
+      m_map = 0;
+      m_length = 0;
+      m_nodes = 0;
+      m_size = 0;
+      open(path);
+    }
+
+    //=========================================================================
+    // Copying is disabled, since the tree owns the mapping.
+    //=========================================================================
+    mapped_zip_tree(const mapped_zip_tree&) = delete;
+    mapped_zip_tree& operator=(const mapped_zip_tree&) = delete;
+
+    //=========================================================================
+    // Destructor.
+    //=========================================================================
+    ~mapped_zip_tree() {
+      if (m_map)
+        munmap(m_map, m_length);
+    }
+
+    //=========================================================================
+    // Return true if the image was mapped successfully.
+    //=========================================================================
+    bool is_open() const {
+      return m_map != 0;
+    }
+
+    //=========================================================================
+    // Return the number of items in the tree.
+    //=========================================================================
+    std::uint64_t size() const {
+      return m_size;
+    }
+
+    //=========================================================================
+    // Search for a given key in the tree.
+    // Return a pair containing the key and its value.
+    //=========================================================================
+    std::pair<bool, value_type> search(const key_type &key) const {
+      std::uint32_t i = root();
+      while (i) {
+        const node_type &x = get(i);
+        if (key < x.m_key) i = child(i, x.m_left);
+        else if (x.m_key < key) i = child(i, x.m_right);
+        else return std::make_pair(true, x.m_value);
+      }
+      return std::make_pair(false, value_type());
+    }
+
+    //=========================================================================
+    // Simple forward iterator. As in the tree without parent pointers,
+    // the iterator keeps the stack of the ancestors of the current node
+    // (on top) whose left subtree contains the current node.
+    //=========================================================================
+    class iterator {
+      private:
+        const mapped_zip_tree *m_tree;
+        std::vector<std::uint32_t> m_stack;
+
+      public:
+        iterator()
+          : m_tree(0) {}
+
+        const key_type& key() const {
+          return m_tree->get(m_stack.back()).m_key;
+        }
+
+        const value_type& value() const {
+          return m_tree->get(m_stack.back()).m_value;
+        }
+
+        inline iterator& operator++() {
+          if (m_stack.empty()) {
+            std::cerr << "\nError: ++ on NULL iterator\n";
+            std::exit(EXIT_FAILURE);
+          }
+          std::uint32_t i = m_stack.back();
+          i = m_tree->child(i, m_tree->get(i).m_right);
+          m_stack.pop_back();
+          push_left_path(i);
+          return *this;
+        }
+
+        inline iterator operator++(int) {
+          iterator ret = *this;
+          ++(*this);
+          return ret;
+        }
+
+        bool operator == (const iterator &it) const {
+          return current() == it.current();
+        }
+
+        bool operator != (const iterator &it) const {
+          return current() != it.current();
+        }
+
+      private:
+        friend class mapped_zip_tree;
+
+        iterator(const mapped_zip_tree *tree)
+          : m_tree(tree) {}
+
+        inline std::uint32_t current() const {
+          return m_stack.empty() ? 0 : m_stack.back();
+        }
+
+        inline void push_left_path(std::uint32_t i) {
+          for (; i; i = m_tree->child(i, m_tree->get(i).m_left))
+            m_stack.push_back(i);
+        }
+    };
+
+    iterator begin() const {
+      iterator ret(this);
+      ret.push_left_path(root());
+      return ret;
+    }
+
+    iterator end() const {
+      return iterator(this);
+    }
+
+    //=========================================================================
+    // Return the iterator to the first item with key >= `key',
+    // or end() if there is no such item.
+    //=========================================================================
+    iterator lower_bound(const key_type &key) const {
+      iterator ret(this);
+      for (std::uint32_t i = root(); i; ) {
+        const node_type &x = get(i);
+        if (x.m_key < key) i = child(i, x.m_right);
+        else {
+          ret.m_stack.push_back(i);
+          i = child(i, x.m_left);
+        }
+      }
+      return ret;
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item with lo <= key < hi, in the
+    // increasing order of keys. The subtrees outside the range are
+    // skipped and no iterator (and hence no stack) is used.
+    //=========================================================================
+    template<typename function_type>
+    void for_each_in_range(
+        const key_type &lo,
+        const key_type &hi,
+        function_type fn) const {
+      for_each_in_range(root(), lo, hi, fn);
+    }
+
+    //=========================================================================
+    // Check if the image is a correct zip-tree stored in BFS order,
+    // i.e., if the children positions are assigned consecutively, the
+    // order of keys is correct, and whether rank[left[v]] < rank[v]
+    // and rank[right[v]] <= rank[v] conditions hold for every node.
+    //=========================================================================
+    void check_correctness() const {
+      std::uint64_t next = (m_size > 0) ? 2 : 1;
+      for (std::uint64_t i = 1; i <= m_size; ++i) {
+        const node_type &x = get(i);
+        if ((x.m_left && (x.m_left != next++ || x.m_left > m_size)) ||
+            (x.m_right && (x.m_right != next++ || x.m_right > m_size))) {
+          std::cerr << "\nError: check_layout failed!\n";
+          std::exit(EXIT_FAILURE);
+        }
+        if ((x.m_left && get(x.m_left).m_rank >= x.m_rank) ||
+            (x.m_right && get(x.m_right).m_rank > x.m_rank)) {
+          std::cerr << "\nError: check_ranks failed!\n";
+          std::exit(EXIT_FAILURE);
+        }
+      }
+      if (next != m_size + 1) {
+        std::cerr << "\nError: check_layout failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+      iterator it = begin();
+      if (it != end()) {
+        key_type prev = it.key();
+        for (++it; it != end(); ++it) {
+          if (!(prev < it.key())) {
+            std::cerr << "\nError: check_keys failed!\n";
+            std::exit(EXIT_FAILURE);
+          }
+          prev = it.key();
+        }
+      }
+    }
+
+  private:
+
+    //=========================================================================
+    // Map the file and validate the header. Nothing is read beyond
+    // the header, the nodes are only touched by queries.
+    //=========================================================================
+    void open(const std::string &path) {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) return;
+      struct stat st;
+      if (fstat(fd, &st) != 0 ||
+          (std::uint64_t)st.st_size < k_image_data_offset) {
+        close(fd);
+        return;
+      }
+      std::uint64_t length = st.st_size;
+      void *map = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (map == MAP_FAILED) return;
+      image_header header;
+      std::memcpy(&header, map, sizeof(header));
+      if (std::memcmp(header.m_magic, k_image_magic,
+            sizeof(header.m_magic)) != 0 ||
+          header.m_key_size != sizeof(key_type) ||
+          header.m_value_size != sizeof(value_type) ||
+          header.m_node_size != sizeof(node_type) ||
+          length != k_image_data_offset +
+            header.m_size * sizeof(node_type)) {
+        munmap(map, length);
+        return;
+      }
+      m_map = map;
+      m_length = length;
+      m_nodes = (const node_type *)((const char *)map + k_image_data_offset);
+      m_size = header.m_size;
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item with lo <= key < hi in the
+    // subtree rooted in position `i'. Recursion is only used for left
+    // children.
+    //=========================================================================
+    template<typename function_type>
+    void for_each_in_range(
+        std::uint32_t i,
+        const key_type &lo,
+        const key_type &hi,
+        function_type &fn) const {
+      while (i) {
+        const node_type &x = get(i);
+        if (x.m_key < lo) i = child(i, x.m_right);
+        else if (!(x.m_key < hi)) i = child(i, x.m_left);
+        else {
+          for_each_in_range(child(i, x.m_left), lo, hi, fn);
+          fn(x.m_key, x.m_value);
+          i = child(i, x.m_right);
+        }
+      }
+    }
+
+    inline std::uint32_t root() const {
+      return m_size ? 1 : 0;
+    }
+
+    inline const node_type& get(std::uint64_t i) const {
+      return m_nodes[i - 1];
+    }
+
+    //=========================================================================
+    // Return `pos', the position of a child of the node at position `i',
+    // if it is valid, and 0 (no child) otherwise. In BFS order children
+    // follow their parents, so valid positions are in (i, m_size]. The
+    // positions are read from the file, which may be corrupted; this
+    // keeps every descent inside the mapping and makes it terminate.
+    //=========================================================================
+    inline std::uint32_t child(std::uint32_t i, std::uint32_t pos) const {
+      return (pos > i && pos <= m_size) ? pos : 0;
+    }
+};
+
+#endif  // __MAPPED_ZIP_TREE_HPP_INCLUDED
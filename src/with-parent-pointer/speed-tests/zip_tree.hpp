@@ -36,381 +36,2415 @@
 #include <cstdlib>
 #include <cstdint>
 #include <iostream>
+#include <new>
+#include <vector>
+#include <type_traits>
+#include <atomic>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <iterator>
+#include <utility>
+#include <string>
+#include <cstdio>
+#include <cstring>
 
 
 //=============================================================================
-// Node of a Zip Tree.
+// Node allocator taking every node from the general-purpose heap. The
+// memory of each node has to be returned individually.
 //=============================================================================
+template<typename T>
+class heap_allocator {
+  public:
+
+    //=========================================================================
+    // The allocator cannot release all nodes at once.
+    //=========================================================================
+    static const bool k_bulk_release = false;
+
+    //=========================================================================
+    // Return uninitialized memory for a single object of type T.
+    //=========================================================================
+    inline T* allocate() {
+      return static_cast<T*>(::operator new(sizeof(T)));
+    }
+
+    //=========================================================================
+    // Return the memory of the object at `x' to the heap.
+    //=========================================================================
+    inline void deallocate(T *x) {
+      ::operator delete(x);
+    }
+
+    //=========================================================================
+    // Objects carved out of a larger block could not be returned to the
+    // heap individually, so no block is provided (see pool_allocator::
+    // allocate_block()) and the caller has to allocate them one by one.
+    //=========================================================================
+    inline T* allocate_block(std::uint64_t) {
+      return 0;
+    }
+
+    //=========================================================================
+    // Nothing to do, all nodes were already deallocated.
+    //=========================================================================
+    void release() {}
+
+    //=========================================================================
+    // Return the number of bytes taken by `n_objects' objects. The
+    // bookkeeping of the heap itself is not known and not included.
+    //=========================================================================
+    std::uint64_t memory_usage(std::uint64_t n_objects) const {
+      return n_objects * sizeof(T);
+    }
+};
+
+//=============================================================================
+// Node allocator carving the nodes out of large chunks of memory.
+// Deallocated nodes are kept on a free list and recycled by subsequent
+// allocations. Chunks grow geometrically up to k_max_chunk_slots nodes,
+// so that small trees stay small. All chunks are released at once by
+// release() or in the destructor, without visiting individual nodes.
+//=============================================================================
+template<typename T>
+class pool_allocator {
+  private:
+
+    //=========================================================================
+    // A slot either holds an object or links to the next free slot.
+    //=========================================================================
+    union slot {
+      slot *m_next;
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type m_data;
+    };
+
+    static const std::uint64_t k_min_chunk_slots = 32;
+    static const std::uint64_t k_max_chunk_slots = (1UL << 16);
+
+    //=========================================================================
+    // All allocated chunks, the total number of slots in them, the head
+    // of the free list, and the range of never used slots in the most
+    // recently allocated chunk.
+    //=========================================================================
+    std::vector<slot*> m_chunks;
+    std::uint64_t m_n_slots;
+    slot *m_free;
+    slot *m_cur;
+    slot *m_end;
+    std::uint64_t m_next_chunk_slots;
+
+  public:
+
+    //=========================================================================
+    // The allocator releases all nodes at once.
+    //=========================================================================
+    static const bool k_bulk_release = true;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    pool_allocator() {
+      m_n_slots = 0;
+      m_free = 0;
+      m_cur = 0;
+      m_end = 0;
+      m_next_chunk_slots = k_min_chunk_slots;
+    }
+
+    //=========================================================================
+    // Destructor.
+    //=========================================================================
+    ~pool_allocator() {
+      release();
+    }
+
+    pool_allocator(const pool_allocator&) = delete;
+    pool_allocator& operator=(const pool_allocator&) = delete;
+
+    //=========================================================================
+    // Return uninitialized memory for a single object of type T.
+    //=========================================================================
+    inline T* allocate() {
+      slot *ret;
+      if (m_free) {
+        ret = m_free;
+        m_free = m_free->m_next;
+      } else {
+        if (m_cur == m_end)
+          add_chunk();
+        ret = m_cur++;
+      }
+      return reinterpret_cast<T*>(ret);
+    }
+
+    //=========================================================================
+    // Put the memory of the object at `x' on the free list.
+    //=========================================================================
+    inline void deallocate(T *x) {
+      slot *s = reinterpret_cast<slot*>(x);
+      s->m_next = m_free;
+      m_free = s;
+    }
+
+    //=========================================================================
+    // Return uninitialized memory for `n' consecutive objects of type T,
+    // taken from a new chunk of exactly that size. The objects can be
+    // deallocated individually, as if returned by allocate().
+    //=========================================================================
+    T* allocate_block(std::uint64_t n) {
+      slot *chunk = static_cast<slot*>(::operator new(n * sizeof(slot)));
+      m_chunks.push_back(chunk);
+      m_n_slots += n;
+      return reinterpret_cast<T*>(chunk);
+    }
+
+    //=========================================================================
+    // Release all chunks. Objects still living in them
+    // are not destroyed, this is the caller's responsibility.
+    //=========================================================================
+    void release() {
+      for (std::uint64_t i = 0; i < m_chunks.size(); ++i)
+        ::operator delete(m_chunks[i]);
+      m_chunks.clear();
+      m_n_slots = 0;
+      m_free = 0;
+      m_cur = 0;
+      m_end = 0;
+      m_next_chunk_slots = k_min_chunk_slots;
+    }
+
+    //=========================================================================
+    // Return the number of bytes of all chunks, including the free and
+    // never used slots. The number of objects is not needed.
+    //=========================================================================
+    std::uint64_t memory_usage(std::uint64_t) const {
+      return m_n_slots * sizeof(slot);
+    }
+
+  private:
+
+    //=========================================================================
+    // Allocate a new chunk and make it the source of never used slots.
+    //=========================================================================
+    void add_chunk() {
+      slot *chunk = static_cast<slot*>(
+          ::operator new(m_next_chunk_slots * sizeof(slot)));
+      m_chunks.push_back(chunk);
+      m_n_slots += m_next_chunk_slots;
+      m_cur = chunk;
+      m_end = chunk + m_next_chunk_slots;
+      if (m_next_chunk_slots < k_max_chunk_slots)
+        m_next_chunk_slots <<= 1;
+    }
+};
+
+//=============================================================================
+// Small and fast pseudo-random number generator (SplitMix64). Every
+// tree owns its generator, so that drawing ranks requires no locking
+// and independent trees do not share any state.
+//=============================================================================
+class random_generator {
+  private:
+
+    //=========================================================================
+    // Current state.
+    //=========================================================================
+    std::uint64_t m_state;
+
+  public:
+
+    //=========================================================================
+    // Constructor. If no seed is given, a unique one is taken from a
+    // global sequence, itself randomly seeded when first used.
+    //=========================================================================
+    random_generator() {
+      static std::atomic<std::uint64_t> seeds(
+          ((std::uint64_t)std::random_device()() << 32) ^
+          (std::uint64_t)std::random_device()());
+      m_state = mix(seeds.fetch_add(0x9e3779b97f4a7c15UL));
+    }
+
+    random_generator(std::uint64_t seed) {
+      m_state = seed;
+    }
+
+    //=========================================================================
+    // Return the next 64-bit pseudo-random number.
+    //=========================================================================
+    inline std::uint64_t operator()() {
+      m_state += 0x9e3779b97f4a7c15UL;
+      return mix(m_state);
+    }
+
+    //=========================================================================
+    // Return a rank drawn from the geometric distribution with p = 1/2,
+    // i.e., the number of trailing zeros of a random 64-bit number. The
+    // top bit is set to keep the result defined; ranks are <= 63.
+    //=========================================================================
+    inline std::uint8_t random_rank() {
+      return __builtin_ctzll((*this)() | (1UL << 63));
+    }
+
+    //=========================================================================
+    // Bijective mixing function (finalizer of SplitMix64).
+    //=========================================================================
+    static inline std::uint64_t mix(std::uint64_t x) {
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+      return x ^ (x >> 31);
+    }
+};
+
+//=============================================================================
+// The rank of a node is either stored in the node (rank_field<true>)
+// or recomputed from the key when needed (rank_field<false>).
+//=============================================================================
+template<bool stored>
+class rank_field {
+  public:
+    std::uint8_t m_rank;
+
+    inline void set_rank(const std::uint8_t rank) {
+      m_rank = rank;
+    }
+};
+
+template<>
+class rank_field<false> {
+  public:
+    inline void set_rank(const std::uint8_t) {}
+};
+
+//=============================================================================
+// Rank policy drawing the ranks from the random_generator owned by the
+// tree. Ranks are stored in the nodes.
+//=============================================================================
+class random_ranks {
+  private:
+    random_generator m_random;
+
+  public:
+    static const bool k_stored = true;
+
+    random_ranks() {}
+
+    explicit random_ranks(std::uint64_t seed)
+      : m_random(seed) {}
+
+    //=========================================================================
+    // Return the policy for a tree split off from this one. It draws
+    // ranks independently of this policy.
+    //=========================================================================
+    random_ranks fork() {
+      return random_ranks(m_random());
+    }
+
+    //=========================================================================
+    // Return the rank for a new node with a given key.
+    //=========================================================================
+    template<typename key_type>
+    inline std::uint8_t new_rank(const key_type &) {
+      return m_random.random_rank();
+    }
+};
+
+//=============================================================================
+// Rank policy deriving the rank from the key, as the number of trailing
+// zeros of the mixed std::hash of the key (and an optional salt). As
+// long as the hash spreads the keys well, the ranks still follow the
+// geometric distribution, but the shape of the tree is a function of
+// the set of keys only: it does not depend on the order of operations
+// and is the same in every process using the same salt. No state is
+// updated on insertion, and ranks are not stored in the nodes, they
+// are recomputed from the keys.
+//=============================================================================
+class hashed_ranks {
+  private:
+    std::uint64_t m_salt;
+
+  public:
+    static const bool k_stored = false;
+
+    hashed_ranks() {
+      m_salt = 0;
+    }
+
+    explicit hashed_ranks(std::uint64_t salt) {
+      m_salt = salt;
+    }
+
+    //=========================================================================
+    // Return the policy for a tree split off from this one. The
+    // salt must stay the same, since ranks are not stored.
+    //=========================================================================
+    hashed_ranks fork() const {
+      return *this;
+    }
+
+    //=========================================================================
+    // Return the rank of a node with a given key.
+    //=========================================================================
+    template<typename key_type>
+    inline std::uint8_t new_rank(const key_type &key) const {
+      std::uint64_t h = std::hash<key_type>()(key);
+      h = random_generator::mix(h ^ (m_salt + 0x9e3779b97f4a7c15UL));
+      return __builtin_ctzll(h | (1UL << 63));
+    }
+};
+
+//=============================================================================
+// Statistics policy recording nothing (the default). All its methods
+// are empty and inlined, and the lengths passed to them are not used,
+// so a tree without statistics compiles to the same code as before.
+//=============================================================================
+class no_stats {
+  public:
+    static const bool k_enabled = false;
+
+    inline void record_search(const std::uint64_t) {}
+    inline void record_zip(const std::uint64_t) {}
+    inline void record_unzip(const std::uint64_t) {}
+    inline void record_rank(const std::uint8_t) {}
+    inline void reset() {}
+};
+
+//=============================================================================
+// Statistics policy counting the operations of the tree: the number of
+// nodes visited by every search (find), the number of nodes on the
+// paths merged by zip() and split by unzip(), and the distribution of
+// the ranks of the inserted nodes, which for a good source of ranks is
+// geometric: about half of the nodes have rank 0, a quarter rank 1,
+// and so on. The counters are updated by const operations too, so
+// a tree with statistics must not be searched concurrently, and its
+// set operations (and insert_batch()) run on a single thread.
+//=============================================================================
+class operation_stats {
+  public:
+    static const bool k_enabled = true;
+    static const std::uint64_t k_ranks = 64;
+
+    //=========================================================================
+    // Number, total and maximum length of the recorded paths.
+    //=========================================================================
+    class path_counter {
+      private:
+        std::uint64_t m_count;
+        std::uint64_t m_total;
+        std::uint64_t m_max;
+
+      public:
+        path_counter() {
+          reset();
+        }
+
+        inline void record(const std::uint64_t length) {
+          ++m_count;
+          m_total += length;
+          m_max = std::max(m_max, length);
+        }
+
+        void reset() {
+          m_count = 0;
+          m_total = 0;
+          m_max = 0;
+        }
+
+        std::uint64_t count() const { return m_count; }
+        std::uint64_t total() const { return m_total; }
+        std::uint64_t max() const { return m_max; }
+
+        double average() const {
+          return m_count ? (double)m_total / m_count : 0.0;
+        }
+    };
+
+  private:
+    path_counter m_searches;
+    path_counter m_zips;
+    path_counter m_unzips;
+    std::uint64_t m_rank_counts[k_ranks];
+
+  public:
+    operation_stats() {
+      reset();
+    }
+
+    inline void record_search(const std::uint64_t n_visited) {
+      m_searches.record(n_visited);
+    }
+
+    inline void record_zip(const std::uint64_t length) {
+      m_zips.record(length);
+    }
+
+    inline void record_unzip(const std::uint64_t length) {
+      m_unzips.record(length);
+    }
+
+    inline void record_rank(const std::uint8_t rank) {
+      ++m_rank_counts[std::min((std::uint64_t)rank, k_ranks - 1)];
+    }
+
+    void reset() {
+      m_searches.reset();
+      m_zips.reset();
+      m_unzips.reset();
+      std::fill(m_rank_counts, m_rank_counts + k_ranks, 0);
+    }
+
+    //=========================================================================
+    // Nodes visited per search, i.e., per call of find_node() (by
+    // search(), lookup(), contains(), find() and erase()), including the
+    // node with the key, if found.
+    //=========================================================================
+    const path_counter& searches() const {
+      return m_searches;
+    }
+
+    //=========================================================================
+    // Nodes on the right spine of the left subtree and the left spine of
+    // the right subtree merged by one zip() (in erase(), join() and the
+    // set operations).
+    //=========================================================================
+    const path_counter& zips() const {
+      return m_zips;
+    }
+
+    //=========================================================================
+    // Nodes on the search path split by one unzip() (in insert(),
+    // split() and the set operations).
+    //=========================================================================
+    const path_counter& unzips() const {
+      return m_unzips;
+    }
+
+    //=========================================================================
+    // Return the number of inserted nodes of every rank, up to the
+    // largest rank seen. Ranks >= k_ranks - 1 are counted together.
+    //=========================================================================
+    std::vector<std::uint64_t> rank_histogram() const {
+      std::uint64_t len = k_ranks;
+      while (len > 0 && !m_rank_counts[len - 1])
+        --len;
+      return std::vector<std::uint64_t>(m_rank_counts, m_rank_counts + len);
+    }
+};
+
+//=============================================================================
+// Subtree size of a node, present only in trees augmented for order
+// statistics (size_field<true>).
+//=============================================================================
+template<bool stored>
+class size_field {
+  public:
+    std::uint64_t m_size;
+
+    inline void set_size(const std::uint64_t size) {
+      m_size = size;
+    }
+};
+
+template<>
+class size_field<false> {
+  public:
+    inline void set_size(const std::uint64_t) {}
+};
+
+//=============================================================================
+// Node of a Zip Tree. The rank is a member only if `store_rank' is true
+// and the subtree size is a member only if `store_size' is true.
+//=============================================================================
+template<
+  typename key_type,
+  typename value_type,
+  bool store_rank = true,
+  bool store_size = false>
+class node
+  : public rank_field<store_rank>,
+    public size_field<store_size> {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef node<key_type, value_type, store_rank, store_size> node_type;
+
+  public:
+
+    //=========================================================================
+    // Key, value, and pointers.
+    //=========================================================================
+    key_type m_key;
+    value_type m_value;
+    node_type *m_left;
+    node_type *m_right;
+    node_type *m_par;
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    node(
+        const key_type &key,
+        const value_type &value,
+        const std::uint8_t rank,
+        node_type *left,
+        node_type *right,
+        node_type *par)
+      : m_key(key),
+        m_value(value),
+        m_left(left),
+        m_right(right),
+        m_par(par) {
+      this->set_rank(rank);
+      this->set_size(1);
+    }
+
+    //=========================================================================
+    // Constructor of a leaf with parent `par', constructing the key from
+    // `key' and the value from `args' in place.
+    //=========================================================================
+    template<typename key_arg_type, typename... value_arg_types>
+    node(
+        std::piecewise_construct_t,
+        const std::uint8_t rank,
+        node_type *par,
+        key_arg_type &&key,
+        value_arg_types&&... args)
+      : m_key(std::forward<key_arg_type>(key)),
+        m_value(std::forward<value_arg_types>(args)...),
+        m_left(0),
+        m_right(0),
+        m_par(par) {
+      this->set_rank(rank);
+      this->set_size(1);
+    }
+};
+
+//=============================================================================
+// Layout of the image written by zip_tree::save() and read by
+// mapped_zip_tree. The header, padded to k_image_data_offset bytes,
+// is followed by the nodes in BFS order. Children are referred to by
+// their positions in that order, counting from 1, and 0 denotes a
+// missing child. The image contains no pointers, so it can be used
+// at any address it is mapped to.
+//=============================================================================
+static const std::uint64_t k_image_data_offset = 64;
+static const char k_image_magic[8] = {'Z', 'I', 'P', 'T', 'R', 'E', 'E', '1'};
+
+struct image_header {
+  char m_magic[8];
+  std::uint64_t m_size;
+  std::uint64_t m_key_size;
+  std::uint64_t m_value_size;
+  std::uint64_t m_node_size;
+};
+
 template<typename key_type, typename value_type>
-class node {
+struct image_node {
+  key_type m_key;
+  value_type m_value;
+  std::uint32_t m_left;
+  std::uint32_t m_right;
+  std::uint8_t m_rank;
+};
+
+//=============================================================================
+// Comparator applying "<" to objects of any types, as std::less<void>
+// (which is not available before C++14). It is transparent, so a
+// zip_tree using it can be searched for objects of any type comparable
+// with its keys, e.g., for a const char* in a tree of std::string keys,
+// without converting them to key_type.
+//=============================================================================
+struct transparent_less {
+  typedef void is_transparent;
+
+  template<typename lhs_type, typename rhs_type>
+  inline bool operator()(const lhs_type &lhs, const rhs_type &rhs) const {
+    return lhs < rhs;
+  }
+};
+
+//=============================================================================
+// Three-way comparison of objects of any types: return a negative
+// number, zero or a positive number if `lhs' is smaller than, equal to
+// or greater than `rhs', respectively. Strings are compared in a single
+// pass with std::string::compare() (i.e., memcmp), other types with
+// up to two "<" comparisons.
+//=============================================================================
+template<typename lhs_type, typename rhs_type>
+inline int three_way_compare(const lhs_type &lhs, const rhs_type &rhs) {
+  return (lhs < rhs) ? -1 : (rhs < lhs);
+}
+
+inline int three_way_compare(const std::string &lhs, const std::string &rhs) {
+  return lhs.compare(rhs);
+}
+
+inline int three_way_compare(const std::string &lhs, const char *rhs) {
+  return lhs.compare(rhs);
+}
+
+inline int three_way_compare(const char *lhs, const std::string &rhs) {
+  const int ret = rhs.compare(lhs);
+  return (ret > 0) ? -1 : (ret < 0);
+}
+
+//=============================================================================
+// Transparent comparator which also compares objects three ways with
+// three_way_compare() above. A comparator defining is_three_way and
+// compare() is used by zip_tree to descend the tree with a single
+// comparison per level instead of "<" in both directions, which halves
+// the work for keys that are expensive to compare, such as strings.
+//=============================================================================
+struct three_way_less {
+  typedef void is_transparent;
+  typedef void is_three_way;
+
+  template<typename lhs_type, typename rhs_type>
+  inline bool operator()(const lhs_type &lhs, const rhs_type &rhs) const {
+    return three_way_compare(lhs, rhs) < 0;
+  }
+
+  template<typename lhs_type, typename rhs_type>
+  inline int compare(const lhs_type &lhs, const rhs_type &rhs) const {
+    return three_way_compare(lhs, rhs);
+  }
+};
+
+//=============================================================================
+// Whether compare_type defines is_three_way, see three_way_less above.
+//=============================================================================
+template<typename compare_type, typename = void>
+struct is_three_way_compare : std::false_type {};
+
+template<typename compare_type>
+struct is_three_way_compare<compare_type,
+  typename compare_type::is_three_way> : std::true_type {};
+
+//=============================================================================
+// Simple implementation of Zip Tree. The keys are ordered by
+// compare_type, by default by the "<" operator of key_type.
+// The memory for nodes is obtained from allocator_template<node_type>,
+// see heap_allocator and pool_allocator above. The ranks of nodes are
+// given by the rank_policy, see random_ranks and hashed_ranks above.
+// If `size_augmented' is true, every node stores the size of its
+// subtree, which enables select() and rank() in O(log n) expected time
+// at the cost of updating the sizes along the zip/unzip paths and on
+// the path to the root in every insertion and deletion. With
+// stats_policy = operation_stats, the tree counts the nodes visited by
+// its operations, see stats(). If compare_type is transparent (defines
+// is_transparent, e.g., transparent_less above), the functions looking
+// up keys (search, lookup, contains, find, erase, rank, lower_bound,
+// upper_bound, equal_range, for_each_in_range and count_in_range) also
+// accept any type that compare_type compares with key_type. If
+// compare_type is three-way (e.g., three_way_less above), the searches
+// compare the key with every node on their path only once.
+//=============================================================================
+template<
+  typename key_type,
+  typename value_type,
+  template<typename> class allocator_template = pool_allocator,
+  typename rank_policy = random_ranks,
+  bool size_augmented = false,
+  typename stats_policy = no_stats,
+  typename compare_type = std::less<key_type> >
+class zip_tree {
+  private:
+
+    //=========================================================================
+    // Define common aliases.
+    //=========================================================================
+    typedef node<key_type, value_type,
+            rank_policy::k_stored, size_augmented> node_type;
+    typedef allocator_template<node_type> allocator_type;
+    typedef std::integral_constant<bool, size_augmented> size_tag;
+    typedef is_three_way_compare<compare_type> three_way_tag;
+
+    //=========================================================================
+    // Pointer to the root of the tree and the number of nodes.
+    //=========================================================================
+    node_type *m_root;
+    std::uint64_t m_size;
+
+    //=========================================================================
+    // Allocator of nodes. Every tree has its own (the batch built by
+    // insert_batch() only borrows it), so that different trees can be
+    // modified by different threads. Nodes passed between trees with
+    // different pools are moved, see take_allocator().
+    //=========================================================================
+    std::shared_ptr<allocator_type> m_allocator;
+
+    //=========================================================================
+    // Source of ranks.
+    //=========================================================================
+    rank_policy m_ranks;
+
+    //=========================================================================
+    // Operation statistics, see no_stats and operation_stats above.
+    //=========================================================================
+    mutable stats_policy m_stats;
+
+    //=========================================================================
+    // Order of keys.
+    //=========================================================================
+    compare_type m_compare;
+
+  public:
+
+    //=========================================================================
+    // Constructor.
+    //=========================================================================
+    zip_tree()
+      : m_allocator(std::make_shared<allocator_type>()) {
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Constructor with an explicit seed for the rank policy. Two trees
+    // with the same seed and the same sequence of insertions have the
+    // same shape. For hashed_ranks the seed is the salt of the hash.
+    //=========================================================================
+    explicit zip_tree(std::uint64_t seed)
+      : m_allocator(std::make_shared<allocator_type>()),
+        m_ranks(seed) {
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Constructor with a seed and a comparator object, for comparators
+    // with state.
+    //=========================================================================
+    zip_tree(std::uint64_t seed, const compare_type &compare)
+      : m_allocator(std::make_shared<allocator_type>()),
+        m_ranks(seed),
+        m_compare(compare) {
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Move constructor and assignment. The tree `other' is left empty.
+    //=========================================================================
+    zip_tree(zip_tree &&other)
+      : m_allocator(std::make_shared<allocator_type>()) {
+      m_root = 0;
+      m_size = 0;
+      swap(other);
+    }
+
+    zip_tree& operator=(zip_tree &&other) {
+      if (this != &other) {
+        clear();
+        swap(other);
+      }
+      return *this;
+    }
+
+    zip_tree(const zip_tree&) = delete;
+    zip_tree& operator=(const zip_tree&) = delete;
+
+    //=========================================================================
+    // Destructor.
+    //=========================================================================
+    ~zip_tree() {
+      clear();
+    }
+
+    //=========================================================================
+    // Exchange the contents of two trees.
+    //=========================================================================
+    void swap(zip_tree &other) {
+      std::swap(m_root, other.m_root);
+      std::swap(m_size, other.m_size);
+      std::swap(m_allocator, other.m_allocator);
+      std::swap(m_ranks, other.m_ranks);
+      std::swap(m_stats, other.m_stats);
+      std::swap(m_compare, other.m_compare);
+    }
+
+    //=========================================================================
+    // Remove all nodes from the tree. If the allocator supports it and
+    // is not shared with other trees, the memory is released in whole
+    // chunks and the nodes are only visited if their destructors have
+    // to be run.
+    //=========================================================================
+    void clear() {
+      if (allocator_type::k_bulk_release && m_allocator.use_count() == 1) {
+        if (!std::is_trivially_destructible<node_type>::value)
+          delete_subtree(m_root, false);
+        m_allocator->release();
+      } else delete_subtree(m_root, true);
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Return the number of items in the tree.
+    //=========================================================================
+    inline std::uint64_t size() const {
+      return m_size;
+    }
+
+    //=========================================================================
+    // Return the number of bytes reserved for the nodes, see
+    // pool_allocator::memory_usage() and heap_allocator::memory_usage().
+    //=========================================================================
+    std::uint64_t memory_usage() const {
+      return m_allocator->memory_usage(m_size);
+    }
+
+    //=========================================================================
+    // Split the tree around `key'. Return the pair of trees holding the
+    // items with keys smaller than `key' and the remaining items (with
+    // keys >= `key'). This tree is left empty. The split follows the
+    // search path of `key' (as in insert()), and only the parent
+    // pointers (and, if present, the subtree sizes) of the nodes on that
+    // path are updated. The larger tree keeps the allocator of this tree
+    // and the smaller one gets its own, so that the two can be handed to
+    // different threads. With pool_allocator, the nodes of the smaller
+    // tree are therefore moved into its new pool. The smaller tree is
+    // also counted, unless the trees are size-augmented. Thus the split
+    // takes O(log n) expected time for size-augmented trees using
+    // heap_allocator, and O(log n + min(m, n - m)) expected time
+    // otherwise, where m is the size of the left tree.
+    //=========================================================================
+    std::pair<zip_tree, zip_tree> split(const key_type &key) {
+      zip_tree left(std::make_shared<allocator_type>(), m_ranks.fork(),
+          m_compare);
+      zip_tree right(std::make_shared<allocator_type>(), m_ranks.fork(),
+          m_compare);
+      unzip(m_root, key, &(left.m_root), &(right.m_root), 0);
+      bool left_smaller;
+      std::uint64_t n_smaller = smaller_size(left.m_root, right.m_root,
+          left_smaller, size_tag());
+      zip_tree &smaller = (left_smaller ? left : right);
+      zip_tree &larger = (left_smaller ? right : left);
+      smaller.m_size = n_smaller;
+      larger.m_size = m_size - n_smaller;
+      std::swap(larger.m_allocator, m_allocator);
+      if (allocator_type::k_bulk_release)
+        smaller.m_root = move_subtree(smaller.m_root,
+            *larger.m_allocator, *smaller.m_allocator);
+      m_root = 0;
+      m_size = 0;
+      return std::make_pair(std::move(left), std::move(right));
+    }
+
+    //=========================================================================
+    // Join two trees into one and return it. Every key in `left' must be
+    // smaller than every key in `right', and both trees must use the same
+    // rank policy (e.g., the same salt for hashed_ranks). The right spine
+    // of `left' is zipped with the left spine of `right', which takes
+    // O(log n) expected time and only updates the nodes on these spines.
+    // With pool_allocator, the returned tree allocates from the pool of
+    // the larger input, into which the nodes of the smaller input are
+    // moved (see take_allocator()). This adds O(min(m, n)) time for
+    // inputs of sizes m and n. Both `left' and `right' are left empty.
+    //=========================================================================
+    static zip_tree join(zip_tree &&left, zip_tree &&right) {
+      zip_tree ret(std::move(left));
+      ret.take_allocator(right);
+      ret.m_root = ret.zip(ret.m_root, right.m_root, 0);
+      ret.m_size += right.m_size;
+      right.m_root = 0;
+      right.m_size = 0;
+      return ret;
+    }
+
+    //=========================================================================
+    // Insert the (key, value) pairs pairs[0..n) into the tree. Of equal
+    // keys, the first is inserted, and keys already in the tree keep
+    // their values, just as with a sequence of insert() calls. The batch
+    // is stably sorted (in parallel for large n), built into a tree in
+    // linear time with build_from_sorted(), and merged into this tree
+    // with union_with(), which unzips both trees recursively and inserts
+    // the independent parts on different threads. Uses up to `n_threads'
+    // threads (by default, as many as hardware threads).
+    //=========================================================================
+    void insert_batch(
+        const std::pair<key_type, value_type> *pairs,
+        const std::uint64_t n,
+        std::uint64_t n_threads = 0) {
+      if (n_threads == 0)
+        n_threads = std::max(1U, std::thread::hardware_concurrency());
+      std::vector<std::pair<key_type, value_type> > sorted(pairs, pairs + n);
+      parallel_stable_sort(sorted.begin(), sorted.end(), m_compare,
+          n_threads);
+      zip_tree batch(m_allocator, m_ranks.fork(), m_compare);
+      batch.build_from_sorted(sorted.begin(), sorted.end());
+      union_with(std::move(batch), n_threads);
+    }
+
+    //=========================================================================
+    // Set operations. Replace the contents of this tree with the union,
+    // intersection, or difference of the sets of items in this tree and
+    // in `other'. For keys present in both trees the value from this
+    // tree is kept. The nodes of `other' are reused (or destroyed) and
+    // `other' is left empty; both trees must use the same rank policy.
+    //
+    // The trees are combined recursively: the root of higher priority
+    // (i.e., higher rank, and smaller key among equal ranks) becomes the
+    // root of the result, the other tree is unzipped around its key, and
+    // the two pairs of subtrees are combined independently. This takes
+    // O(m log(n / m + 1)) expected work for trees of sizes m <= n. The
+    // independent subproblems are solved by different threads as long as
+    // the expected size of the subproblem is at least k_parallel_cutoff,
+    // using up to `n_threads' threads (by default, as many as hardware
+    // threads). The removed nodes are destroyed after all threads finish.
+    //=========================================================================
+    void union_with(zip_tree &&other, std::uint64_t n_threads = 0) {
+      set_operation(other, k_union, n_threads);
+    }
+
+    void intersect_with(zip_tree &&other, std::uint64_t n_threads = 0) {
+      set_operation(other, k_intersection, n_threads);
+    }
+
+    void difference_with(zip_tree &&other, std::uint64_t n_threads = 0) {
+      set_operation(other, k_difference, n_threads);
+    }
+
+    //=========================================================================
+    // Replace the contents of the tree with the (key, value) pairs in
+    // the range [first, last), which have to be sorted by key. Of equal
+    // keys only the first is kept. The tree is built in a single left to
+    // right pass, as a Cartesian tree on (rank, key): the right spine of
+    // the tree built so far, traversed upwards with parent pointers,
+    // serves as the stack. The nodes are allocated in key order, so with
+    // the pool allocator the tree occupies (mostly) contiguous memory in
+    // inorder. Runs in O(n) time.
+    //=========================================================================
+    template<typename iterator_type>
+    void build_from_sorted(iterator_type first, iterator_type last) {
+      clear();
+      node_type *prev = 0;
+      for (; first != last; ++first) {
+        const key_type &key = first->first;
+        if (prev && !m_compare(prev->m_key, key)) continue;
+        std::uint8_t rank = m_ranks.new_rank(key);
+        m_stats.record_rank(rank);
+
+        // Pop the nodes of smaller rank from the right spine.
+        // The last popped node becomes the left child of the
+        // new node, which becomes the right child of the node
+        // at which we stopped (or the root).
+        // Subtrees of popped nodes are complete, so
+        // (if needed) their sizes are computed here.
+        node_type *par = prev, *left = 0;
+        while (par && get_rank(par) < rank) {
+          update_size(par, size_tag());
+          left = par;
+          par = par->m_par;
+        }
+        node_type *newnode = new (m_allocator->allocate())
+          node_type(key, first->second, rank, left, 0, par);
+        if (left) left->m_par = newnode;
+        if (par) par->m_right = newnode;
+        else m_root = newnode;
+        prev = newnode;
+        ++m_size;
+      }
+      update_sizes_upto(prev, 0, size_tag());
+    }
+
+    //=========================================================================
+    // Move the nodes into one contiguous block of memory in the van Emde
+    // Boas order: the top half of the levels is stored first, followed
+    // by the subtrees hanging below it from left to right, each of them
+    // laid out recursively in the same way. Then any root-to-leaf path
+    // touches O(log_B n) blocks of B nodes for every B, so searches in a
+    // read-mostly tree incur fewer cache misses. The shape of the tree
+    // is unchanged, but all nodes move, which invalidates iterators. With
+    // pool_allocator, the block is a chunk of a new pool, which replaces
+    // the old one, and the old nodes are released with it at once. With
+    // heap_allocator the nodes are only allocated in the same order.
+    // Runs in O(n log log n) time and uses O(n) extra space.
+    //=========================================================================
+    void relayout() {
+      if (!m_root) return;
+      std::vector<node_type*> order;
+      std::vector<node_type*> frontier;
+      order.reserve(m_size);
+      veb_order(m_root, height(m_root), order, frontier);
+      if (allocator_type::k_bulk_release) {
+        std::shared_ptr<allocator_type> allocator =
+          std::make_shared<allocator_type>();
+        m_root = move_nodes(order, *m_allocator, *allocator, false);
+        m_allocator = allocator;
+      } else m_root = move_nodes(order, *m_allocator, *m_allocator, true);
+    }
+
+    //=========================================================================
+    // Insert a node with a given (key, value) pair into the tree.
+    // Return true if the insertion took place and false otherwise (the
+    // key was already in the tree). This is an optimized variant of the
+    // insertion which does not use recursion: after locating the place
+    // for the new node, the rest of the search path is traversed once to
+    // check for duplicates and once more to unzip it. The key and the
+    // value are copied into the node, or moved if given as rvalues.
+    //=========================================================================
+    bool insert(const key_type &key, const value_type &value) {
+      return insert_unique(key, key, value);
+    }
+
+    bool insert(key_type &&key, value_type &&value) {
+      return insert_unique(key, std::move(key), std::move(value));
+    }
+
+    //=========================================================================
+    // Insert an item with a given key and the value constructed in place
+    // from `args', as std::map::try_emplace(). If the key is already in
+    // the tree, return false without constructing the value (and without
+    // moving from `key' and `args').
+    //=========================================================================
+    template<typename... arg_types>
+    bool try_emplace(const key_type &key, arg_types&&... args) {
+      return insert_unique(key, key, std::forward<arg_types>(args)...);
+    }
+
+    template<typename... arg_types>
+    bool try_emplace(key_type &&key, arg_types&&... args) {
+      return insert_unique(key, std::move(key),
+          std::forward<arg_types>(args)...);
+    }
+
+    //=========================================================================
+    // Construct an item in place, the key from `key' and the value from
+    // `args', and insert it unless its key is already in the tree (in
+    // which case it is destroyed again and false is returned). Unlike in
+    // try_emplace(), the key need not be constructed beforehand.
+    //=========================================================================
+    template<typename key_arg_type, typename... value_arg_types>
+    bool emplace(key_arg_type &&key, value_arg_types&&... args) {
+      node_type *newnode = new (m_allocator->allocate())
+        node_type(std::piecewise_construct, 0, 0,
+            std::forward<key_arg_type>(key),
+            std::forward<value_arg_types>(args)...);
+      std::uint8_t rank = m_ranks.new_rank(newnode->m_key);
+      m_stats.record_rank(rank);
+      insert_place place;
+      if (!find_insert_place(newnode->m_key, rank, place)) {
+        delete_node(newnode);
+        return false;
+      }
+      newnode->set_rank(rank);
+      link_new_node(newnode, place);
+      return true;
+    }
+
+    //=========================================================================
+    // Delete the node with a given key from the tree.
+    // Return true if the deletion took place.
+    //=========================================================================
+    bool erase(const key_type &key) {
+      return erase_node(find_node(key));
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    bool erase(const query_type &key) {
+      return erase_node(find_node(key));
+    }
+
+    //=========================================================================
+    // Return the comparator of keys.
+    //=========================================================================
+    const compare_type& key_comp() const {
+      return m_compare;
+    }
+
+  private:
+
+    //=========================================================================
+    // Delete the node p.first found by find_node(), if any. Return true
+    // if the deletion took place.
+    //=========================================================================
+    bool erase_node(const std::pair<node_type*, node_type**> &p) {
+      if (!p.first) return false;
+      else {
+        node_type *x = p.first;
+        node_type *newroot = zip(x->m_left, x->m_right, x->m_par);
+        if (!p.second) m_root = newroot;
+        else *(p.second) = newroot;
+        add_size_upto(x->m_par, 0, -1, size_tag());
+        delete_node(x);
+        --m_size;
+        return true;
+      }
+    }
+
+  public:
+
+    //=========================================================================
+    // Print the tree.
+    //=========================================================================
+    void print() const {
+      print(m_root, 0);
+    }
+
+    //=========================================================================
+    // Return the operation statistics (see stats_policy), and reset them.
+    //=========================================================================
+    const stats_policy& stats() const {
+      return m_stats;
+    }
+
+    void reset_stats() {
+      m_stats.reset();
+    }
+
+    //=========================================================================
+    // Return the number of nodes at every depth of the tree (the root
+    // has depth 0). In a zip tree of n nodes, the expected depth of any
+    // node is at most 1.5 log2 n + O(1). Runs in O(n) time and does not
+    // depend on the stats_policy.
+    //=========================================================================
+    std::vector<std::uint64_t> depth_histogram() const {
+      std::vector<std::uint64_t> ret;
+      std::vector<std::pair<const node_type*, std::uint64_t> > stack;
+      if (m_root) stack.push_back(std::make_pair(m_root, 0));
+      while (!stack.empty()) {
+        const node_type *x = stack.back().first;
+        std::uint64_t depth = stack.back().second;
+        stack.pop_back();
+        if (ret.size() <= depth) ret.resize(depth + 1, 0);
+        ++ret[depth];
+        if (x->m_left) stack.push_back(std::make_pair(x->m_left, depth + 1));
+        if (x->m_right) stack.push_back(std::make_pair(x->m_right, depth + 1));
+      }
+      return ret;
+    }
+
+    //=========================================================================
+    // Return the average number of nodes visited by a successful search
+    // of a key chosen uniformly from the tree, i.e., the average depth
+    // of the nodes plus one. Return 0 for an empty tree. Runs in O(n).
+    //=========================================================================
+    double average_search_depth() const {
+      std::vector<std::uint64_t> histogram = depth_histogram();
+      std::uint64_t n_nodes = 0, total = 0;
+      for (std::uint64_t depth = 0; depth < histogram.size(); ++depth) {
+        n_nodes += histogram[depth];
+        total += histogram[depth] * (depth + 1);
+      }
+      return n_nodes ? (double)total / n_nodes : 0.0;
+    }
+
+    //=========================================================================
+    // Search for a given key in the tree.
+    // Return a pair containing the key and its value.
+    //=========================================================================
+    std::pair<bool, value_type> search(const key_type &key) const {
+      std::pair<node_type*, node_type**> p = find_node(key);
+      if (!p.first) return std::make_pair(false, value_type());
+      else return std::make_pair(true, p.first->m_value);
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    std::pair<bool, value_type> search(const query_type &key) const {
+      std::pair<node_type*, node_type**> p = find_node(key);
+      if (!p.first) return std::make_pair(false, value_type());
+      else return std::make_pair(true, p.first->m_value);
+    }
+
+    //=========================================================================
+    // Return a pointer to the value associated with `key', or nullptr if
+    // the key is not in the tree. Unlike search(), this copies nothing.
+    // The pointer is valid until the item is erased (or moved by relayout()).
+    //=========================================================================
+    value_type* lookup(const key_type &key) {
+      node_type *x = find_node(key).first;
+      return x ? &(x->m_value) : nullptr;
+    }
+
+    const value_type* lookup(const key_type &key) const {
+      const node_type *x = find_node(key).first;
+      return x ? &(x->m_value) : nullptr;
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    value_type* lookup(const query_type &key) {
+      node_type *x = find_node(key).first;
+      return x ? &(x->m_value) : nullptr;
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    const value_type* lookup(const query_type &key) const {
+      const node_type *x = find_node(key).first;
+      return x ? &(x->m_value) : nullptr;
+    }
+
+    //=========================================================================
+    // Return true if `key' is in the tree.
+    //=========================================================================
+    bool contains(const key_type &key) const {
+      return find_node(key).first != nullptr;
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    bool contains(const query_type &key) const {
+      return find_node(key).first != nullptr;
+    }
+
+    //=========================================================================
+    // Search for `n' keys at once. On return, results[i] points to the
+    // value associated with keys[i], or is nullptr if keys[i] is not in
+    // the tree. The lookups are processed in groups of k_batch_size,
+    // advanced in lock-step one level at a time, so that the cache
+    // misses of independent lookups overlap. The next node of every
+    // lookup is prefetched as soon as it is known.
+    //=========================================================================
+    void search_batch(
+        const key_type *keys,
+        const std::uint64_t n,
+        const value_type **results) const {
+      static const std::uint64_t k_batch_size = 16;
+      const node_type *cur[k_batch_size];
+      std::uint64_t active[k_batch_size];
+      for (std::uint64_t beg = 0; beg < n; beg += k_batch_size) {
+        std::uint64_t n_active = std::min(k_batch_size, n - beg);
+        for (std::uint64_t j = 0; j < n_active; ++j) {
+          results[beg + j] = nullptr;
+          cur[j] = m_root;
+          active[j] = beg + j;
+        }
+        if (!m_root) continue;
+        while (n_active > 0) {
+          for (std::uint64_t j = 0; j < n_active; ) {
+            const node_type *x = cur[j];
+            const key_type &key = keys[active[j]];
+            const node_type *next = nullptr;
+            const int cmp = compare_keys(key, x->m_key);
+            if (cmp < 0) next = x->m_left;
+            else if (cmp > 0) next = x->m_right;
+            else results[active[j]] = &(x->m_value);
+            if (next) {
+              __builtin_prefetch(next);
+              cur[j++] = next;
+            } else {
+
+              // The lookup is finished, replace
+              // it with the last active lookup.
+              --n_active;
+              cur[j] = cur[n_active];
+              active[j] = active[n_active];
+            }
+          }
+        }
+      }
+    }
+
+    //=========================================================================
+    // Write the image of the tree to file `path', see image_header
+    // above. The file can be opened with mapped_zip_tree without any
+    // deserialization. Keys and values are copied bytewise, hence they
+    // must be trivially copyable. mapped_zip_tree searches the image
+    // with "<", so the keys must be ordered by "<" too. Return true if
+    // the write succeeded.
+    //=========================================================================
+    bool save(const std::string &path) const {
+      static_assert(std::is_trivially_copyable<key_type>::value &&
+          std::is_trivially_copyable<value_type>::value,
+          "save() requires trivially copyable keys and values");
+      static_assert(std::is_same<compare_type, std::less<key_type> >::value ||
+          std::is_same<compare_type, transparent_less>::value ||
+          std::is_same<compare_type, three_way_less>::value,
+          "save() requires keys ordered by operator<");
+      typedef image_node<key_type, value_type> record_type;
+      std::uint64_t n = size();
+      if (n >= (1UL << 32)) return false;
+      std::FILE *f = std::fopen(path.c_str(), "wb");
+      if (!f) return false;
+
+      // Write the header.
+      char header_block[k_image_data_offset];
+      std::memset(header_block, 0, sizeof(header_block));
+      image_header header;
+      std::memcpy(header.m_magic, k_image_magic, sizeof(header.m_magic));
+      header.m_size = n;
+      header.m_key_size = sizeof(key_type);
+      header.m_value_size = sizeof(value_type);
+      header.m_node_size = sizeof(record_type);
+      std::memcpy(header_block, &header, sizeof(header));
+      bool ok = (std::fwrite(header_block, sizeof(header_block), 1, f) == 1);
+
+      // Write the nodes in BFS order. The queue doubles as the map
+      // from positions to nodes, so the positions of the children
+      // are known when the parent is written.
+      std::vector<const node_type*> queue;
+      queue.reserve(n);
+      if (m_root) queue.push_back(m_root);
+      for (std::uint64_t i = 0; ok && i < queue.size(); ++i) {
+        const node_type *x = queue[i];
+        record_type rec;
+        std::memset(&rec, 0, sizeof(rec));
+        rec.m_key = x->m_key;
+        rec.m_value = x->m_value;
+        rec.m_rank = get_rank(x);
+        if (x->m_left) {
+          queue.push_back(x->m_left);
+          rec.m_left = queue.size();
+        }
+        if (x->m_right) {
+          queue.push_back(x->m_right);
+          rec.m_right = queue.size();
+        }
+        ok = (std::fwrite(&rec, sizeof(rec), 1, f) == 1);
+      }
+      if (std::fclose(f) != 0) ok = false;
+      return ok;
+    }
+
+    //=========================================================================
+    // Check if a tree is a correct zip-tree, i.e., if the order of keys
+    // is correct, and whether rank[left[v]] < rank[v] and
+    // rank[right[v]] <= rank[v] conditions hold for every node.
+    //=========================================================================
+    void check_correctness() const {
+      if (m_root) {
+        check_keys(m_root);
+        check_ranks(m_root);
+        check_parents(m_root);
+        check_sizes(m_root, size_tag());
+        if (m_root->m_par != 0) {
+          std::cerr << "\nError: m_root->m_par != 0\n";
+          std::exit(EXIT_FAILURE);
+        }
+      }
+    }
+
+  public:
+
+    //=========================================================================
+    // Very simple non-const iterator.
+    //=========================================================================
+    class iterator {
+      private:
+        node_type *m_ptr;
+
+      public:
+        iterator(node_type *x)
+          : m_ptr(x) {}
+
+        iterator()
+          : m_ptr(nullptr) {}
+
+        const key_type& key() const {
+          return m_ptr->m_key;
+        }
+
+        value_type& value() const {
+          return m_ptr->m_value;
+        }
+
+        inline iterator& operator++() {
+          if (!m_ptr) {
+            std::cerr << "\nError: ++ on NULL iterator\n";
+            std::exit(EXIT_FAILURE);
+          }
+          m_ptr = next(m_ptr);
+          return *this;
+        }
+
+        inline iterator& operator--() {
+          if (!m_ptr)
+            m_ptr = max_node(m_root);
+          else m_ptr = prev(m_ptr);
+          return *this;
+        }
+
+        inline iterator operator++(int) {
+          if (!m_ptr) {
+            std::cerr << "\nError: ++ on NULL iterator\n";
+            std::exit(EXIT_FAILURE);
+          }
+          iterator ret = *this;
+          m_ptr = next(m_ptr);
+          return ret;
+        }
+
+        inline iterator operator--(int) {
+          iterator ret = *this;
+          if (!m_ptr)
+            m_ptr = max_node(m_root);
+          else m_ptr = prev(m_ptr);
+          return ret;
+        }
+
+        bool operator == (const iterator &it) const {
+          return m_ptr == it.m_ptr;
+        }
+
+        bool operator != (const iterator &it) const {
+          return m_ptr != it.m_ptr;
+        }
+    };
+
+    iterator begin() {
+      return iterator(min_node(m_root));
+    }
+
+    iterator end() {
+      return iterator(nullptr);
+    }
+
+    //=========================================================================
+    // Very simple const iterator, giving read-only access to the items
+    // of a const tree.
+    //=========================================================================
+    class const_iterator {
+      private:
+        node_type *m_ptr;
+
+      public:
+        const_iterator(node_type *x)
+          : m_ptr(x) {}
+
+        const_iterator()
+          : m_ptr(nullptr) {}
+
+        const key_type& key() const {
+          return m_ptr->m_key;
+        }
+
+        const value_type& value() const {
+          return m_ptr->m_value;
+        }
+
+        inline const_iterator& operator++() {
+          if (!m_ptr) {
+            std::cerr << "\nError: ++ on NULL iterator\n";
+            std::exit(EXIT_FAILURE);
+          }
+          m_ptr = next(m_ptr);
+          return *this;
+        }
+
+        inline const_iterator operator++(int) {
+          const_iterator ret = *this;
+          ++(*this);
+          return ret;
+        }
+
+        bool operator == (const const_iterator &it) const {
+          return m_ptr == it.m_ptr;
+        }
+
+        bool operator != (const const_iterator &it) const {
+          return m_ptr != it.m_ptr;
+        }
+    };
+
+    const_iterator begin() const {
+      return const_iterator(min_node(m_root));
+    }
+
+    const_iterator end() const {
+      return const_iterator(nullptr);
+    }
+
+    //=========================================================================
+    // Return the iterator to the item with the k-th smallest key
+    // (counting from 0), or end() if k >= size(). Requires the tree to
+    // be size-augmented. Runs in O(log n) expected time.
+    //=========================================================================
+    iterator select(std::uint64_t k) {
+      static_assert(size_augmented, "select() requires size_augmented");
+      node_type *x = m_root;
+      while (x) {
+        std::uint64_t left_size = get_size(x->m_left);
+        if (k < left_size) x = x->m_left;
+        else if (k == left_size) break;
+        else {
+          k -= left_size + 1;
+          x = x->m_right;
+        }
+      }
+      return iterator(x);
+    }
+
+    //=========================================================================
+    // Return the number of keys in the tree smaller than `key'. Requires
+    // the tree to be size-augmented. Runs in O(log n) expected time.
+    //=========================================================================
+    std::uint64_t rank(const key_type &key) const {
+      return rank_of(key);
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    std::uint64_t rank(const query_type &key) const {
+      return rank_of(key);
+    }
+
+    //=========================================================================
+    // Return the iterator to the item with key `key',
+    // or end() if there is no such item.
+    //=========================================================================
+    iterator find(const key_type &key) {
+      return iterator(find_node(key).first);
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    iterator find(const query_type &key) {
+      return iterator(find_node(key).first);
+    }
+
+    const_iterator find(const key_type &key) const {
+      return const_iterator(find_node(key).first);
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    const_iterator find(const query_type &key) const {
+      return const_iterator(find_node(key).first);
+    }
+
+    //=========================================================================
+    // Return the iterator to the first item with key >= `key',
+    // or end() if there is no such item.
+    //=========================================================================
+    iterator lower_bound(const key_type &key) {
+      return iterator(lower_bound_node(key));
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    iterator lower_bound(const query_type &key) {
+      return iterator(lower_bound_node(key));
+    }
+
+    const_iterator lower_bound(const key_type &key) const {
+      return const_iterator(lower_bound_node(key));
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    const_iterator lower_bound(const query_type &key) const {
+      return const_iterator(lower_bound_node(key));
+    }
+
+    //=========================================================================
+    // Return the iterator to the first item with key > `key',
+    // or end() if there is no such item.
+    //=========================================================================
+    iterator upper_bound(const key_type &key) {
+      return iterator(upper_bound_node(key));
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    iterator upper_bound(const query_type &key) {
+      return iterator(upper_bound_node(key));
+    }
+
+    const_iterator upper_bound(const key_type &key) const {
+      return const_iterator(upper_bound_node(key));
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    const_iterator upper_bound(const query_type &key) const {
+      return const_iterator(upper_bound_node(key));
+    }
+
+    //=========================================================================
+    // Return the range of items with a given key, i.e., the pair
+    // (lower_bound(key), upper_bound(key)). Since keys are distinct,
+    // the range contains at most one item.
+    //=========================================================================
+    std::pair<iterator, iterator> equal_range(const key_type &key) {
+      return equal_range_of(key);
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    std::pair<iterator, iterator> equal_range(const query_type &key) {
+      return equal_range_of(key);
+    }
+
+    //=========================================================================
+    // Call fn(key, value) for every item with lo <= key < hi, in the
+    // increasing order of keys. The subtrees outside the range are
+    // skipped and the items are visited by a walk descending from the
+    // root, without the parent climbs of iterator::operator++.
+    //=========================================================================
+    template<typename function_type>
+    void for_each_in_range(
+        const key_type &lo,
+        const key_type &hi,
+        function_type fn) {
+      for_each_in_range(m_root, lo, hi, fn);
+    }
+
+    template<typename query_type, typename function_type,
+        typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    void for_each_in_range(
+        const query_type &lo,
+        const query_type &hi,
+        function_type fn) {
+      for_each_in_range(m_root, lo, hi, fn);
+    }
+
+    //=========================================================================
+    // Return the number of items with lo <= key < hi. Runs in O(log n)
+    // expected time for size-augmented trees and in O(log n + k) expected
+    // time, where k is the answer, otherwise.
+    //=========================================================================
+    std::uint64_t count_in_range(const key_type &lo, const key_type &hi) {
+      return count_in_range(lo, hi, size_tag());
+    }
+
+    template<typename query_type, typename compare = compare_type,
+        typename = typename compare::is_transparent>
+    std::uint64_t count_in_range(
+        const query_type &lo,
+        const query_type &hi) {
+      return count_in_range(lo, hi, size_tag());
+    }
+
   private:
 
     //=========================================================================
-    // Define common aliases.
+    // Implementation of rank().
+    //=========================================================================
+    template<typename query_type>
+    std::uint64_t rank_of(const query_type &key) const {
+      static_assert(size_augmented, "rank() requires size_augmented");
+      std::uint64_t ret = 0;
+      const node_type *x = m_root;
+      while (x) {
+        const int cmp = compare_keys(key, x->m_key);
+        if (cmp < 0) x = x->m_left;
+        else if (cmp > 0) {
+          ret += get_size(x->m_left) + 1;
+          x = x->m_right;
+        } else {
+          ret += get_size(x->m_left);
+          break;
+        }
+      }
+      return ret;
+    }
+
+    //=========================================================================
+    // Implementation of lower_bound() and upper_bound().
+    //=========================================================================
+    template<typename query_type>
+    node_type* lower_bound_node(const query_type &key) const {
+      node_type *x = m_root, *ret = 0;
+      while (x) {
+        if (m_compare(x->m_key, key)) x = x->m_right;
+        else {
+          ret = x;
+          x = x->m_left;
+        }
+      }
+      return ret;
+    }
+
+    template<typename query_type>
+    node_type* upper_bound_node(const query_type &key) const {
+      node_type *x = m_root, *ret = 0;
+      while (x) {
+        if (m_compare(key, x->m_key)) {
+          ret = x;
+          x = x->m_left;
+        } else x = x->m_right;
+      }
+      return ret;
+    }
+
+    //=========================================================================
+    // Implementation of equal_range().
+    //=========================================================================
+    template<typename query_type>
+    std::pair<iterator, iterator> equal_range_of(const query_type &key) {
+      node_type *x = m_root, *lo = 0, *hi = 0;
+      while (x) {
+        const int cmp = compare_keys(key, x->m_key);
+        if (cmp < 0) {
+          lo = hi = x;
+          x = x->m_left;
+        } else if (cmp > 0) x = x->m_right;
+        else {
+          lo = x;
+          if (x->m_right) hi = min_node(x->m_right);
+          break;
+        }
+      }
+      return std::make_pair(iterator(lo), iterator(hi));
+    }
+
+    //=========================================================================
+    // Constructor of an empty tree with a given allocator, rank policy
+    // and comparator, used by split() and insert_batch().
+    //=========================================================================
+    zip_tree(
+        const std::shared_ptr<allocator_type> &allocator,
+        const rank_policy &ranks,
+        const compare_type &compare)
+      : m_allocator(allocator),
+        m_ranks(ranks),
+        m_compare(compare) {
+      m_root = 0;
+      m_size = 0;
+    }
+
+    //=========================================================================
+    // Stably sort the pairs in [first, last) by key, in the order given
+    // by `compare'. The halves of the range are sorted by different
+    // threads (recursively, up to `n_threads' threads) and then merged.
+    //=========================================================================
+    template<typename iterator_type>
+    static void parallel_stable_sort(
+        iterator_type first,
+        iterator_type last,
+        const compare_type &compare,
+        const std::uint64_t n_threads) {
+      typedef typename std::iterator_traits<iterator_type>::value_type
+        pair_type;
+      auto comp = [&compare](const pair_type &a, const pair_type &b) {
+        return compare(a.first, b.first);
+      };
+      std::uint64_t n = last - first;
+      if (n_threads <= 1 || n < 2 * k_parallel_cutoff)
+        std::stable_sort(first, last, comp);
+      else {
+        iterator_type mid = first + n / 2;
+        std::thread t([&]() {
+          parallel_stable_sort(first, mid, compare, n_threads / 2);
+        });
+        parallel_stable_sort(mid, last, compare, n_threads - n_threads / 2);
+        t.join();
+        std::inplace_merge(first, mid, last, comp);
+      }
+    }
+
+    //=========================================================================
+    // Make sure that this tree can take over the nodes of `other': if
+    // both trees use different pools, the nodes of the smaller tree are
+    // moved into the pool of the larger one, which becomes the allocator
+    // of this tree. Takes O(min(m, n)) time for trees of sizes m and n.
+    // Nodes from the heap can be freed by any heap_allocator as they are.
+    //=========================================================================
+    void take_allocator(zip_tree &other) {
+      if (!allocator_type::k_bulk_release ||
+          m_allocator == other.m_allocator)
+        return;
+      if (m_size < other.m_size) {
+        m_root = move_subtree(m_root, *m_allocator, *other.m_allocator);
+        std::swap(m_allocator, other.m_allocator);
+      } else {
+        other.m_root = move_subtree(other.m_root, *other.m_allocator,
+            *m_allocator);
+      }
+    }
+
+    //=========================================================================
+    // Set operations and the expected size of a subproblem below
+    // which it is never split between threads.
     //=========================================================================
-    typedef node<key_type, value_type> node_type;
+    enum set_operation_type {
+      k_union,
+      k_intersection,
+      k_difference
+    };
 
-  public:
+    static const std::uint64_t k_parallel_cutoff = (1UL << 14);
 
     //=========================================================================
-    // Key, value, rank, and pointers.
+    // Implementation of union_with(), intersect_with(),
+    // and difference_with().
     //=========================================================================
-    key_type m_key;
-    value_type m_value;
-    std::uint8_t m_rank;
-    node_type *m_left;
-    node_type *m_right;
-    node_type *m_par;
+    void set_operation(
+        zip_tree &other,
+        const set_operation_type op,
+        std::uint64_t n_threads) {
+      if (this == &other) {
+        if (op == k_difference) clear();
+        return;
+      }
+      if (n_threads == 0)
+        n_threads = std::max(1U, std::thread::hardware_concurrency());
+
+      // The threads would all update the same statistics.
+      if (stats_policy::k_enabled) n_threads = 1;
+      std::uint64_t size = m_size + other.m_size;
+      take_allocator(other);
+      std::vector<node_type*> removed;
+      m_root = set_operation(m_root, other.m_root, op,
+          size, n_threads, removed);
+      if (m_root) m_root->m_par = 0;
+      other.m_root = 0;
+      other.m_size = 0;
+      for (std::uint64_t i = 0; i < removed.size(); ++i)
+        size -= delete_subtree(removed[i], true);
+      m_size = size;
+    }
 
     //=========================================================================
-    // Constructor.
+    // Combine the subtrees rooted in `x' (from this tree) and `y' (from
+    // the other tree) and return the root of the result. The parent
+    // pointer of the root is not set. The roots of the subtrees that are
+    // no longer part of the result are appended to `removed'.
     //=========================================================================
-    node(
-        const key_type &key,
-        const value_type &value,
-        const std::uint8_t rank,
-        node_type *left,
-        node_type *right,
-        node_type *par) {
-      m_key = key;
-      m_value = value;
-      m_rank = rank;
-      m_left = left;
-      m_right = right;
-      m_par = par;
-    }
-};
+    node_type* set_operation(
+        node_type *x,
+        node_type *y,
+        const set_operation_type op,
+        const std::uint64_t size_estimate,
+        const std::uint64_t n_threads,
+        std::vector<node_type*> &removed) const {
+      if (!x || !y) {
+        if (op == k_union) return (x ? x : y);
+        if (y) removed.push_back(y);
+        if (op == k_difference) return x;
+        if (x) removed.push_back(x);
+        return 0;
+      }
 
-//=============================================================================
-// Simple implementation of Zip Tree. It works with any key_type as
-// long as objects of key_type can be compared using "<" operator.
-//=============================================================================
-template<typename key_type, typename value_type>
-class zip_tree {
-  private:
+      // Unzip the tree of smaller priority around the
+      // key of the root `r' of higher priority.
+      bool x_first = (get_rank(x) > get_rank(y) ||
+          (get_rank(x) == get_rank(y) && !m_compare(y->m_key, x->m_key)));
+      node_type *r = (x_first ? x : y);
+      node_type *r_left = r->m_left, *r_right = r->m_right;
+      node_type *s_left, *s_right;
+      node_type *eq = unzip(x_first ? y : x, r->m_key,
+          &s_left, &s_right, 0, true);
+
+      // Solve the subproblems, in parallel if they are large enough.
+      node_type *left, *right;
+      node_type *x_left = (x_first ? r_left : s_left);
+      node_type *y_left = (x_first ? s_left : r_left);
+      node_type *x_right = (x_first ? r_right : s_right);
+      node_type *y_right = (x_first ? s_right : r_right);
+      if (n_threads > 1 && size_estimate >= 2 * k_parallel_cutoff) {
+        std::vector<node_type*> removed_left;
+        std::thread t([&]() {
+          left = set_operation(x_left, y_left, op, size_estimate / 2,
+              n_threads / 2, removed_left);
+        });
+        right = set_operation(x_right, y_right, op, size_estimate / 2,
+            n_threads - n_threads / 2, removed);
+        t.join();
+        removed.insert(removed.end(),
+            removed_left.begin(), removed_left.end());
+      } else {
+        left = set_operation(x_left, y_left, op, size_estimate / 2,
+            1, removed);
+        right = set_operation(x_right, y_right, op, size_estimate / 2,
+            1, removed);
+      }
+
+      // Decide whether the key of `r' belongs to the result. If it
+      // does, but its node `eq' in this tree was not chosen as the
+      // root, `r' takes over the value from `eq'.
+      bool keep = (op == k_union ||
+          (op == k_intersection && eq) ||
+          (op == k_difference && x_first && !eq));
+      if (keep && !x_first && eq)
+        std::swap(r->m_value, eq->m_value);
+      if (eq) {
+        eq->m_left = eq->m_right = 0;
+        removed.push_back(eq);
+      }
+      if (!keep) {
+        r->m_left = r->m_right = 0;
+        removed.push_back(r);
+        return zip(left, right, 0);
+      }
+      r->m_left = left;
+      r->m_right = right;
+      if (left) left->m_par = r;
+      if (right) right->m_par = r;
+      update_size(r, size_tag());
+      return r;
+    }
 
     //=========================================================================
-    // Define common aliases.
+    // Implementation of count_in_range().
     //=========================================================================
-    typedef node<key_type, value_type> node_type;
+    template<typename query_type>
+    std::uint64_t count_in_range(
+        const query_type &lo,
+        const query_type &hi,
+        std::true_type) {
+      const std::uint64_t rank_lo = rank_of(lo), rank_hi = rank_of(hi);
+      return rank_hi > rank_lo ? rank_hi - rank_lo : 0;
+    }
+
+    template<typename query_type>
+    std::uint64_t count_in_range(
+        const query_type &lo,
+        const query_type &hi,
+        std::false_type) {
+      std::uint64_t ret = 0;
+      auto count = [&ret](const key_type &, value_type &) { ++ret; };
+      for_each_in_range(m_root, lo, hi, count);
+      return ret;
+    }
 
     //=========================================================================
-    // Pointer to the root of the tree.
+    // Call fn(key, value) for every item with lo <= key < hi in the
+    // subtree rooted in `x'. Recursion is only used for left children.
     //=========================================================================
-    node_type *m_root;
+    template<typename query_type, typename function_type>
+    void for_each_in_range(
+        node_type *x,
+        const query_type &lo,
+        const query_type &hi,
+        function_type &fn) const {
+      while (x) {
+        if (m_compare(x->m_key, lo)) x = x->m_right;
+        else if (!m_compare(x->m_key, hi)) x = x->m_left;
+        else {
+          for_each_in_range(x->m_left, lo, hi, fn);
+          fn(x->m_key, x->m_value);
+          x = x->m_right;
+        }
+      }
+    }
 
-  public:
 
     //=========================================================================
-    // Constructor.
+    // Zip-in two subtrees and return the root of the resulting tree,
+    // whose parent pointer is set to `par'. We assume that any key in
+    // `x' is smaller than any key in `y'. The merge is done in a single
+    // top-down pass along the right spine of `x' and the left spine of
+    // `y', using `hook' as the address of the pointer to fill next.
     //=========================================================================
-    zip_tree() {
-      m_root = 0;
+    node_type* zip(node_type *x, node_type *y, node_type *par) const {
+      node_type *root = 0, **hook = &root, *top = par;
+      std::uint64_t length = 0;
+      while (x && y) {
+        ++length;
+        if (get_rank(x) >= get_rank(y)) {
+          *hook = x;
+          x->m_par = par;
+          par = x;
+          hook = &(x->m_right);
+          x = x->m_right;
+        } else {
+          *hook = y;
+          y->m_par = par;
+          par = y;
+          hook = &(y->m_left);
+          y = y->m_left;
+        }
+      }
+      *hook = (x ? x : y);
+      if (*hook)
+        (*hook)->m_par = par;
+      m_stats.record_zip(length);
+      update_sizes_upto(par, top, size_tag());
+      return root;
     }
 
     //=========================================================================
-    // Destructor.
+    // Split the subtree rooted in `x' into two subtrees with keys smaller
+    // than `key' and not smaller than `key', store their roots in *lhook
+    // and *rhook, and set their parent pointers to `z'. The split is done
+    // in a single top-down pass along the search path of `key', with
+    // `lhook' and `rhook' pointing to the next free slot on the right
+    // spine of the smaller part and on the left spine of the larger
+    // part, respectively. The size of `z' is not updated. If `extract'
+    // is true, the node with key equal to `key' (if any) is not put in
+    // either part, but returned (with its children pointers unchanged).
     //=========================================================================
-    ~zip_tree() {
-      delete_subtree(m_root);
+    node_type* unzip(
+        node_type *x,
+        const key_type &key,
+        node_type **lhook,
+        node_type **rhook,
+        node_type *z,
+        const bool extract = false) const {
+      node_type *lpar = z, *rpar = z, *eq = 0;
+      std::uint64_t length = 0;
+      while (x) {
+        ++length;
+        const int cmp = extract ? compare_keys(x->m_key, key) :
+          (m_compare(x->m_key, key) ? -1 : 1);
+        if (cmp < 0) {
+          *lhook = x;
+          x->m_par = lpar;
+          lpar = x;
+          lhook = &(x->m_right);
+          x = x->m_right;
+        } else if (cmp > 0) {
+          *rhook = x;
+          x->m_par = rpar;
+          rpar = x;
+          rhook = &(x->m_left);
+          x = x->m_left;
+        } else {
+
+          // The subtrees of `x' are the
+          // remaining parts of the split.
+          eq = x;
+          break;
+        }
+      }
+      *lhook = (eq ? eq->m_left : 0);
+      *rhook = (eq ? eq->m_right : 0);
+      if (*lhook) (*lhook)->m_par = lpar;
+      if (*rhook) (*rhook)->m_par = rpar;
+      m_stats.record_unzip(length);
+      update_sizes_upto(lpar, z, size_tag());
+      update_sizes_upto(rpar, z, size_tag());
+      return eq;
     }
 
     //=========================================================================
-    // Insert a node with a given (key, value) pair into the tree.
-    // Return true if the insertion took place and false otherwise (the
-    // key was already in the tree). This is an optimized variant of the
-    // insertion which does only a single downward pass in the tree.
+    // Insert a node with key `key' (constructed from `key_arg') and the
+    // value constructed from `args', unless `key' is in the tree. The
+    // new node is only constructed (and `key_arg' is only moved from,
+    // which may be `key' itself) after the place for it has been found.
     //=========================================================================
-    bool insert(const key_type &key, const value_type &value) {
-      std::uint8_t rank = random_rank();
+    template<typename key_arg_type, typename... value_arg_types>
+    bool insert_unique(
+        const key_type &key,
+        key_arg_type &&key_arg,
+        value_arg_types&&... args) {
+      std::uint8_t rank = m_ranks.new_rank(key);
+      m_stats.record_rank(rank);
+      insert_place place;
+      if (!find_insert_place(key, rank, place))
+        return false;
+      node_type *newnode = new (m_allocator->allocate())
+        node_type(std::piecewise_construct, rank, place.m_par,
+            std::forward<key_arg_type>(key_arg),
+            std::forward<value_arg_types>(args)...);
+      link_new_node(newnode, place);
+      return true;
+    }
+
+    //=========================================================================
+    // The place of a new node in the tree: the topmost node of its search
+    // path which becomes its descendant (`m_cur', or null), the parent of
+    // the new node and the pointer to fill with it (null for the root).
+    //=========================================================================
+    struct insert_place {
+      node_type *m_cur;
+      node_type *m_par;
+      node_type **m_edgeptr;
+    };
+
+    //=========================================================================
+    // Find the place for a new node with a given key and rank. Return
+    // false if the key is already in the tree.
+    //=========================================================================
+    bool find_insert_place(
+        const key_type &key,
+        const std::uint8_t rank,
+        insert_place &place) const {
       node_type *cur = m_root, *par = 0, **edgeptr = 0;
-      while (cur && cur->m_rank > rank) {
-        if (key < cur->m_key) {
+      while (cur && get_rank(cur) > rank) {
+        const int cmp = compare_keys(key, cur->m_key);
+        if (cmp < 0) {
           par = cur;
           edgeptr = &(cur->m_left);
           cur = cur->m_left;
-        } else if (cur->m_key < key) {
+        } else if (cmp > 0) {
           par = cur;
           edgeptr = &(cur->m_right);
           cur = cur->m_right;
         } else return false;
       }
-      while (cur && cur->m_rank == rank && cur->m_key < key) {
+      while (cur && get_rank(cur) == rank && m_compare(cur->m_key, key)) {
         par = cur;
         edgeptr = &(cur->m_right);
         cur = cur->m_right;
       }
-      std::pair<node_type*, node_type*> p = unzip(cur, key);
-      if (cur && !p.first && !p.second) return false;
-      node_type *newnode =
-        new node_type(key, value, rank, p.first, p.second, par);
-      if (p.first) p.first->m_par = newnode;
-      if (p.second) p.second->m_par = newnode;
-      if (!edgeptr) m_root = newnode;
-      else *edgeptr = newnode;
+
+      // The search path below `cur' is exactly the path that
+      // unzip() is going to follow. Walk it once to make sure the
+      // key is not in the tree, so that unzip() never has to undo.
+      for (node_type *x = cur; x; ) {
+        const int cmp = compare_keys(key, x->m_key);
+        if (cmp < 0) x = x->m_left;
+        else if (cmp > 0) x = x->m_right;
+        else return false;
+      }
+      place.m_cur = cur;
+      place.m_par = par;
+      place.m_edgeptr = edgeptr;
       return true;
     }
 
     //=========================================================================
-    // Delete the node with a given key from the tree.
-    // Return true if the deletion took place.
+    // Link the new node `newnode' into the tree at `place', found by
+    // find_insert_place(), and unzip the search path below it.
     //=========================================================================
-    bool erase(const key_type &key) {
-      std::pair<node_type*, node_type**> p = find(key);
-      if (!p.first) return false;
-      else {
-        if (!p.second) {
-          m_root = zip(p.first->m_left, p.first->m_right);
-          if (m_root)
-            m_root->m_par = 0;
-        } else {
-          node_type *par = p.first->m_par;
-          *(p.second) = zip(p.first->m_left, p.first->m_right);
-          if (*(p.second))
-            (*(p.second))->m_par = par;
-        }
-        delete p.first;
-        return true;
-      }
+    void link_new_node(node_type *newnode, const insert_place &place) {
+      newnode->m_par = place.m_par;
+      if (!place.m_edgeptr) m_root = newnode;
+      else *(place.m_edgeptr) = newnode;
+      unzip(place.m_cur, newnode->m_key, &(newnode->m_left),
+          &(newnode->m_right), newnode);
+      update_size(newnode, size_tag());
+      add_size_upto(place.m_par, 0, 1, size_tag());
+      ++m_size;
     }
 
     //=========================================================================
-    // Print the tree.
+    // Search for a node with a given `key'. Return a pointer to the node and
+    // the address of the pointer of which it is the target.
     //=========================================================================
-    void print() const {
-      print(m_root, 0);
+    template<typename query_type>
+    std::pair<node_type*, node_type**> find_node(const query_type &key) const {
+      node_type *cur = m_root, **edgeptr = 0; 
+      std::uint64_t n_visited = 0;
+      while (cur) {
+        ++n_visited;
+        const int cmp = compare_keys(key, cur->m_key);
+        if (cmp < 0) {
+          edgeptr = &(cur->m_left);
+          cur = cur->m_left;
+        } else if (cmp > 0) {
+          edgeptr = &(cur->m_right);
+          cur = cur->m_right;
+        } else {
+          m_stats.record_search(n_visited);
+          return std::make_pair(cur, edgeptr);
+        }
+      }
+      m_stats.record_search(n_visited);
+      return std::make_pair(nullptr, nullptr);
     }
 
     //=========================================================================
-    // Search for a given key in the tree.
-    // Return a pair containing the key and its value.
+    // Compare `lhs' and `rhs' three ways: return a negative number, zero
+    // or a positive number if `lhs' is smaller than, equal to or greater
+    // than `rhs'. This takes a single call of compare_type::compare() for
+    // a three-way comparator, and up to two calls of the comparator
+    // otherwise.
     //=========================================================================
-    std::pair<bool, value_type> search(const key_type &key) const {
-      std::pair<node_type*, node_type**> p = find(key);
-      if (!p.first) return std::make_pair(false, value_type());
-      else return std::make_pair(true, p.first->m_value);
+    template<typename lhs_type, typename rhs_type>
+    inline int compare_keys(const lhs_type &lhs, const rhs_type &rhs) const {
+      return compare_keys(lhs, rhs, three_way_tag());
     }
 
-    //=========================================================================
-    // Check if a tree is a correct zip-tree, i.e., if the order of keys
-    // is correct, and whether rank[left[v]] < rank[v] and
-    // rank[right[v]] <= rank[v] conditions hold for every node.
-    //=========================================================================
-    void check_correctness() const {
-      if (m_root) {
-        check_keys(m_root);
-        check_ranks(m_root);
-        check_parents(m_root);
-        if (m_root->m_par != 0) {
-          std::cerr << "\nError: m_root->m_par != 0\n";
-          std::exit(EXIT_FAILURE);
-        }
-      }
+    template<typename lhs_type, typename rhs_type>
+    inline int compare_keys(
+        const lhs_type &lhs,
+        const rhs_type &rhs,
+        std::true_type) const {
+      return m_compare.compare(lhs, rhs);
     }
 
-  public:
+    template<typename lhs_type, typename rhs_type>
+    inline int compare_keys(
+        const lhs_type &lhs,
+        const rhs_type &rhs,
+        std::false_type) const {
+      return m_compare(lhs, rhs) ? -1 : m_compare(rhs, lhs);
+    }
 
     //=========================================================================
-    // Very simple non-const iterator.
+    // Return the rank of node `x'.
     //=========================================================================
-    class iterator {
-      private:
-        node_type *m_ptr;
-
-      public:
-        iterator(node_type *x)
-          : m_ptr(x) {}
-
-        iterator()
-          : m_ptr(nullptr) {}
-
-        const key_type& key() const {
-          return m_ptr->m_key;
-        }
-
-        value_type& value() {
-          return m_ptr->m_value;
-        }
+    inline std::uint8_t get_rank(const node_type *x) const {
+      return get_rank(x,
+          std::integral_constant<bool, rank_policy::k_stored>());
+    }
 
-        inline iterator& operator++() {
-          if (!m_ptr) {
-            std::cerr << "\nError: ++ on NULL iterator\n";
-            std::exit(EXIT_FAILURE);
-          }
-          m_ptr = next(m_ptr);
-          return *this;
-        }
+    inline std::uint8_t get_rank(const node_type *x, std::true_type) const {
+      return x->m_rank;
+    }
 
-        inline iterator& operator--() {
-          if (!m_ptr)
-            m_ptr = max_node(m_root);
-          else m_ptr = prev(m_ptr);
-          return *this;
-        }
+    inline std::uint8_t get_rank(const node_type *x, std::false_type) const {
+      return m_ranks.new_rank(x->m_key);
+    }
 
-        inline iterator operator++(int) {
-          if (!m_ptr) {
-            std::cerr << "\nError: ++ on NULL iterator\n";
-            std::exit(EXIT_FAILURE);
-          }
-          iterator ret = *this;
-          m_ptr = next(m_ptr);
-          return ret;
-        }
+    //=========================================================================
+    // Return the size of the subtree rooted in `x'. The remaining
+    // functions maintain the subtree sizes; they do nothing (and
+    // compile to nothing) unless the tree is size-augmented.
+    //=========================================================================
+    inline static std::uint64_t get_size(const node_type *x) {
+      return x ? x->m_size : 0;
+    }
 
-        inline iterator operator--(int) {
-          iterator ret = *this;
-          if (!m_ptr)
-            m_ptr = max_node(m_root);
-          else m_ptr = prev(m_ptr);
-          return ret;
-        }
+    //=========================================================================
+    // Recompute the size of `x' from the sizes of its children.
+    //=========================================================================
+    inline static void update_size(node_type *x, std::true_type) {
+      x->m_size = 1 + get_size(x->m_left) + get_size(x->m_right);
+    }
 
-        bool operator == (const iterator &it) const {
-          return m_ptr == it.m_ptr;
-        }
+    inline static void update_size(node_type *, std::false_type) {}
 
-        bool operator != (const iterator &it) const {
-          return m_ptr != it.m_ptr;
-        }
-    };
+    //=========================================================================
+    // Return the number of nodes in the smaller of the subtrees rooted in
+    // `x' and `y', and set `x_smaller' to whether it is the one of `x'.
+    // Without subtree sizes, both subtrees are traversed in order in
+    // lockstep until one of them ends, which takes O(min(m, n)) time.
+    //=========================================================================
+    inline static std::uint64_t smaller_size(
+        node_type *x,
+        node_type *y,
+        bool &x_smaller,
+        std::true_type) {
+      x_smaller = (get_size(x) < get_size(y));
+      return std::min(get_size(x), get_size(y));
+    }
 
-    iterator begin() {
-      return iterator(min_node(m_root));
+    inline static std::uint64_t smaller_size(
+        node_type *x,
+        node_type *y,
+        bool &x_smaller,
+        std::false_type) {
+      std::uint64_t ret = 0;
+      for (x = min_node(x), y = min_node(y); x && y; x = next(x), y = next(y))
+        ++ret;
+      x_smaller = !x;
+      return ret;
     }
 
-    iterator end() {
-      return iterator(nullptr);
+    //=========================================================================
+    // Recompute the sizes on the path from `x' up to (and excluding)
+    // its ancestor `top'. Used after zip() and unzip(), which change
+    // the children only of nodes on such paths.
+    //=========================================================================
+    inline static void update_sizes_upto(
+        node_type *x,
+        const node_type *top,
+        std::true_type) {
+      for (; x != top; x = x->m_par)
+        update_size(x, std::true_type());
     }
 
-  private:
+    inline static void update_sizes_upto(
+        node_type *,
+        const node_type *,
+        std::false_type) {}
 
     //=========================================================================
-    // Zip-in two subtrees and return the root of the resulting tree.
-    // We assume that any key in `x' is smaller than any key in `y'.
+    // Add `delta' to the sizes on the path from `x' up
+    // to (and excluding) its ancestor `top'.
     //=========================================================================
-    node_type* zip(node_type *x, node_type *y) {
-      if (!x) return y;
-      if (!y) return x;
-      if (x->m_rank >= y->m_rank) {
-        node_type *xright = x->m_right;
-        if (xright && xright->m_rank >= y->m_rank) {
-          x->m_right = zip(xright, y);
-          x->m_right->m_par = x;
-        } else {
-          x->m_right = y;
-          y->m_par = x;
-          y->m_left = zip(xright, y->m_left);
-          if (y->m_left)
-            y->m_left->m_par = y;
-        }
-        return x;
-      } else {
-        node_type *yleft = y->m_left;
-        if (yleft && yleft->m_rank >= x->m_rank) {
-          y->m_left = zip(x, yleft);
-          y->m_left->m_par = y;
-        } else {
-          y->m_left = x;
-          x->m_par = y;
-          x->m_right = zip(x->m_right, yleft);
-          if (x->m_right)
-            x->m_right->m_par = x;
-        }
-        return y;
-      }
+    inline static void add_size_upto(
+        node_type *x,
+        const node_type *top,
+        const std::int64_t delta,
+        std::true_type) {
+      for (; x != top; x = x->m_par)
+        x->m_size += delta;
     }
 
+    inline static void add_size_upto(
+        node_type *,
+        const node_type *,
+        const std::int64_t,
+        std::false_type) {}
+
     //=========================================================================
-    // Split the subtree rooted in `x' into two subtrees with keys smaller
-    // and larger than the given `key'. If `key' occurs in subtree `x' then
-    // function returns a pair (nullptr, nullptr) and tree remains unchanged.
-    // NOTE: Is a more elegant/shorter implementation of this function possible?
+    // Destroy the node `x' and return its memory to the allocator.
     //=========================================================================
-    std::pair<node_type*, node_type*> unzip(
-        node_type *x,
-        const key_type &key) {
-      if (!x) return std::make_pair(nullptr, nullptr);
-      else if (key < x->m_key) {
-        node_type *xleft = x->m_left;
-        if (xleft && xleft->m_key < key) {
-          std::pair<node_type*, node_type*> p = unzip(xleft->m_right, key);
-          if (xleft->m_right && !p.first && !p.second) return p;
-          xleft->m_right = p.first;
-          if (p.first)
-            p.first->m_par = xleft;
-          x->m_left = p.second;
-          if (p.second)
-            p.second->m_par = x;
-          return std::make_pair(xleft, x);
-        } else {
-          std::pair<node_type*, node_type*> p = unzip(xleft, key);
-          if (xleft && !p.first && !p.second) return p;
-          else return std::make_pair(p.first, x);
-        }
-      } else if (x->m_key < key) {
-        node_type *xright = x->m_right;
-        if (xright && key < xright->m_key) {
-          std::pair<node_type*, node_type*> p = unzip(xright->m_left, key);
-          if (xright->m_left && !p.first && !p.second) return p;
-          xright->m_left = p.second;
-          if (p.second)
-            p.second->m_par = xright;
-          x->m_right = p.first;
-          if (p.first)
-            p.first->m_par = x;
-          return std::make_pair(x, xright);
-        } else {
-          std::pair<node_type*, node_type*> p = unzip(xright, key);
-          if (xright && !p.first && !p.second) return p;
-          else return std::make_pair(x, p.second);
-        }
-      } else return std::make_pair(nullptr, nullptr);
+    inline void delete_node(node_type *x) {
+      x->~node_type();
+      m_allocator->deallocate(x);
     }
 
     //=========================================================================
-    // Search for a node with a given `key'. Return a pointer to the node and
-    // the address of the pointer of which it is the target.
+    // Move the nodes of the tree rooted in `x' from the allocator `from'
+    // to `to', see move_nodes(), and return the new root. The nodes are
+    // taken in BFS order, so that the copies of the top levels are close.
     //=========================================================================
-    std::pair<node_type*, node_type**> find(const key_type &key) const {
-      node_type *cur = m_root, **edgeptr = 0; 
-      while (cur) {
-        if (key < cur->m_key) {
-          edgeptr = &(cur->m_left);
-          cur = cur->m_left;
-        } else if (cur->m_key < key) {
-          edgeptr = &(cur->m_right);
-          cur = cur->m_right;
-        } else return std::make_pair(cur, edgeptr);
+    node_type* move_subtree(
+        node_type *x,
+        allocator_type &from,
+        allocator_type &to) const {
+      if (!x) return 0;
+      std::vector<node_type*> order(1, x);
+      for (std::uint64_t i = 0; i < order.size(); ++i) {
+        if (order[i]->m_left) order.push_back(order[i]->m_left);
+        if (order[i]->m_right) order.push_back(order[i]->m_right);
       }
-      return std::make_pair(nullptr, nullptr);
+      return move_nodes(order, from, to, true);
     }
 
     //=========================================================================
-    // Return random rank.
+    // Move the nodes in `order' (of a whole tree, every node preceding
+    // its descendants) to consecutive memory from the allocator `to', in
+    // that order, and return the copy of the root order[0]. The old nodes
+    // are destroyed and, if `dealloc' is true, returned to `from'.
     //=========================================================================
-    std::uint8_t random_rank() const {
+    node_type* move_nodes(
+        const std::vector<node_type*> &order,
+        allocator_type &from,
+        allocator_type &to,
+        const bool dealloc) const {
+      node_type *block = to.allocate_block(order.size());
+
+      // Move the key and value of every node into its copy. The parent
+      // pointer of the old node is then redirected to the copy, which
+      // allows to translate the pointers of the copies afterwards.
+      for (std::uint64_t i = 0; i < order.size(); ++i) {
+        node_type *x = order[i];
+        node_type *y = new (block ? block + i : to.allocate())
+          node_type(std::piecewise_construct, get_rank(x), x->m_par,
+              std::move(x->m_key), std::move(x->m_value));
+        y->m_left = x->m_left;
+        y->m_right = x->m_right;
+        x->m_par = y;
+      }
+      for (std::uint64_t i = 0; i < order.size(); ++i) {
+        node_type *y = order[i]->m_par;
+        if (y->m_left) y->m_left = y->m_left->m_par;
+        if (y->m_right) y->m_right = y->m_right->m_par;
+        if (i > 0) y->m_par = y->m_par->m_par;
+      }
 
-      // Note the static below. This variable
-      // will keep its value between calls, which
-      // reduces the number of calls to rand().
-      static std::uint32_t random_bits = 0;
-      while (!random_bits)
-        random_bits = rand();
-      std::uint8_t rank = __builtin_ctz(random_bits);
-      random_bits >>= (rank + 1);
-      return rank;
+      // The sizes are computed backwards, from the bottom up.
+      for (std::uint64_t i = order.size(); i > 0; --i)
+        update_size(order[i - 1]->m_par, size_tag());
+
+      node_type *ret = order[0]->m_par;
+      for (std::uint64_t i = 0; i < order.size(); ++i) {
+        order[i]->~node_type();
+        if (dealloc) from.deallocate(order[i]);
+      }
+      return ret;
     }
 
     //=========================================================================
-    // Delete subtree rooted in `x'.
+    // Destroy all nodes in the subtree rooted in `x' and, if `dealloc' is
+    // true, return their memory to the allocator. Return the number of
+    // nodes. To avoid recursion, the left child of the current node is
+    // rotated up until there is none, and then the node is destroyed and
+    // we move to its right child.
     //=========================================================================
-    void delete_subtree(node_type *x) {
-      if (x) {
-        delete_subtree(x->m_left);
-        delete_subtree(x->m_right);
-        delete x;
+    std::uint64_t delete_subtree(node_type *x, bool dealloc) {
+      std::uint64_t ret = 0;
+      while (x) {
+        if (x->m_left) {
+          node_type *y = x->m_left;
+          x->m_left = y->m_right;
+          y->m_right = x;
+          x = y;
+        } else {
+          node_type *next = x->m_right;
+          if (dealloc) delete_node(x);
+          else x->~node_type();
+          x = next;
+          ++ret;
+        }
       }
+      return ret;
     }
 
     //=========================================================================
@@ -420,7 +2454,7 @@ class zip_tree {
       if (x) {
         if (x->m_right) print(x->m_right, indent + 4);
         for (std::uint64_t j = 0; j < indent; ++j) std::cout << ' ';
-        std::cout << "(" << x->m_key << ", rank = " << (int)x->m_rank << ")\n ";
+        std::cout << "(" << x->m_key << ", rank = " << (int)get_rank(x) << ")\n ";
         if (x->m_left) print(x->m_left, indent + 4);
       }
     }
@@ -437,7 +2471,7 @@ class zip_tree {
     // Check if all keys in the subtree rooted in `x' are < key.
     //=========================================================================
     void check_keys_left(const node_type *x, const key_type &key) const {
-      if (!(x->m_key < key)) {
+      if (!(m_compare(x->m_key, key))) {
         std::cerr << "\nError: check_keys_left failed!\n";
         std::exit(EXIT_FAILURE);
       }
@@ -449,7 +2483,7 @@ class zip_tree {
     // Check if all the keys in the subtree rooted in `x' are > key.
     //=========================================================================
     void check_keys_right(const node_type *x, const key_type &key) const {
-      if (!(key < x->m_key)) {
+      if (!(m_compare(key, x->m_key))) {
         std::cerr << "\nError: check_keys_right_ failed!\n";
         std::exit(EXIT_FAILURE);
       }
@@ -465,7 +2499,7 @@ class zip_tree {
         const node_type *x,
         const key_type &key_left,
         const key_type &key_right) const {
-      if (!(key_left < x->m_key) || !(x->m_key < key_right)) {
+      if (!m_compare(key_left, x->m_key) || !m_compare(x->m_key, key_right)) {
         std::cerr << "\nError: check_keys failed!\n";
         std::exit(EXIT_FAILURE);
       }
@@ -479,7 +2513,7 @@ class zip_tree {
     void check_ranks(const node_type *x) const {
       if (x->m_left) {
         check_ranks(x->m_left);
-        if (x->m_left->m_rank >= x->m_rank) {
+        if (get_rank(x->m_left) >= get_rank(x)) {
           std::cerr << "\nError: check_ranks failed!\n";
           print();
           std::exit(EXIT_FAILURE);
@@ -488,7 +2522,7 @@ class zip_tree {
 
       if (x->m_right) {
         check_ranks(x->m_right);
-        if (x->m_right->m_rank > x->m_rank) {
+        if (get_rank(x->m_right) > get_rank(x)) {
           std::cerr << "\nError: check_ranks failed!\n";
           print();
           std::exit(EXIT_FAILURE);
@@ -516,6 +2550,20 @@ class zip_tree {
       }
     }
 
+    //=========================================================================
+    // Check correctness of subtree sizes in the subtree rooted in `x'.
+    //=========================================================================
+    void check_sizes(const node_type *x, std::true_type) const {
+      if (x->m_left) check_sizes(x->m_left, std::true_type());
+      if (x->m_right) check_sizes(x->m_right, std::true_type());
+      if (x->m_size != 1 + get_size(x->m_left) + get_size(x->m_right)) {
+        std::cerr << "\nError: check_sizes failed!\n";
+        std::exit(EXIT_FAILURE);
+      }
+    }
+
+    void check_sizes(const node_type *, std::false_type) const {}
+
     //=========================================================================
     // Compute the next node in inorder. We assume x != nullptr.
     //=========================================================================
@@ -547,6 +2595,47 @@ class zip_tree {
       }
     }
 
+    //=========================================================================
+    // Return the number of levels of the subtree rooted in `x'.
+    //=========================================================================
+    static std::uint64_t height(node_type *x) {
+      std::uint64_t ret = 0;
+      std::vector<std::pair<node_type*, std::uint64_t> > stack;
+      if (x) stack.push_back(std::make_pair(x, 1));
+      while (!stack.empty()) {
+        node_type *y = stack.back().first;
+        std::uint64_t depth = stack.back().second;
+        stack.pop_back();
+        ret = std::max(ret, depth);
+        if (y->m_left) stack.push_back(std::make_pair(y->m_left, depth + 1));
+        if (y->m_right) stack.push_back(std::make_pair(y->m_right, depth + 1));
+      }
+      return ret;
+    }
+
+    //=========================================================================
+    // Append to `out' the nodes of the top `levels' levels of the subtree
+    // rooted in `x' in the van Emde Boas order (see relayout()), and to
+    // `frontier' the roots of the subtrees below them, from left to right.
+    //=========================================================================
+    static void veb_order(
+        node_type *x,
+        std::uint64_t levels,
+        std::vector<node_type*> &out,
+        std::vector<node_type*> &frontier) {
+      if (levels == 1) {
+        out.push_back(x);
+        if (x->m_left) frontier.push_back(x->m_left);
+        if (x->m_right) frontier.push_back(x->m_right);
+      } else {
+        std::uint64_t top = levels / 2;
+        std::vector<node_type*> bottom;
+        veb_order(x, top, out, bottom);
+        for (std::uint64_t i = 0; i < bottom.size(); ++i)
+          veb_order(bottom[i], levels - top, out, frontier);
+      }
+    }
+
     //=========================================================================
     // Return the leftmost node in the subtree rooted in `x'.
     //=========================================================================